@@ -6,6 +6,10 @@
 #include "bitboard.h"
 #include "extra/long_effect.h"
 #include "extra/mate/mate1ply.h"
+#include "misc.h"
+#if defined(USE_CPU_DISPATCH)
+#include "extra/cpu_info.h"
+#endif
 
 using namespace std;
 
@@ -69,11 +73,19 @@ Bitboard RookStepEffectBB[SQ_NB_PLUS1];
 Bitboard BishopEffect[2][1856+1];
 Bitboard BishopEffectMask[2][SQ_NB_PLUS1];
 int BishopEffectIndex[2][SQ_NB_PLUS1];
+u64      BishopMagic[2][SQ_NB_PLUS1];
+int      BishopMagicShift[2][SQ_NB_PLUS1];
+Bitboard BishopMagicEffect[2][1856+1];
 
 // 飛車の縦、横の利き
 u64      RookFileEffect[RANK_NB + 1][128];
 Bitboard RookRankEffect[FILE_NB + 1][128];
 
+#if defined(USE_CPU_DISPATCH)
+// Bitboards::init()で、実行中のCPUに合わせて設定する。
+bool UsePext = false;
+#endif
+
 // 歩が打てる筋を得るためのBitboard
 // bit0 = 9筋に歩が打てないなら1 , bit1 = 8筋に… , bit8 = 1筋に歩が打てないなら1
 // というbit列をindexとして、歩の打てるBitboardを返すためのテーブル。
@@ -253,6 +265,9 @@ void Bitboards::init()
 	};
   
 	// 角の利きテーブルの初期化
+	// magic numberを探すための乱数。(毎回同じテーブルになるようにseedは固定)
+	PRNG magic_prng(20171111);
+
 	for (int n : { 0 , 1 })
 	{
 		int index = 0;
@@ -280,13 +295,56 @@ void Bitboards::init()
 			{
 				Bitboard occupied = indexToOccupied(i, bits, mask);
 				// 初期化するテーブル
-				BishopEffect[n][index + occupiedToIndex(occupied & mask, mask)] = effectCalc(sq, occupied, n);
+				// USE_CPU_DISPATCHのときもpextの使えないCPUで初期化できるように、occupiedToIndex()ではなくPEXT64()を用いる。
+				BishopEffect[n][index + PEXT64((occupied & mask).merge(), mask.merge())] = effectCalc(sq, occupied, n);
+			}
+
+			// pextを用いないとき(NO_PEXT)のためのmagic numberを探す。
+			// 乱数で候補を作り、利きが異なるoccupiedが同じindexに衝突しないものを採用する。
+			// (利きが同じであれば衝突しても良い)
+			// bits == 0のときは64bit shiftになってしまうので63bit shiftとする。このときblockは0なのでindexは0になる。
+			{
+				const int shift = bits ? 64 - bits : 63;
+				vector<u64> blocks(num);
+				vector<Bitboard> effects(num);
+				for (int i = 0; i < num; ++i)
+				{
+					Bitboard occupied = indexToOccupied(i, bits, mask);
+					blocks[i] = (occupied & mask).merge();
+					effects[i] = effectCalc(sq, occupied, n);
+				}
+
+				vector<int> used(num);
+				for (int trial = 1; ; ++trial)
+				{
+					const u64 magic = magic_prng.rand<u64>() & magic_prng.rand<u64>() & magic_prng.rand<u64>();
+					bool ok = true;
+					for (int i = 0; i < num && ok; ++i)
+					{
+						const int idx = int((blocks[i] * magic) >> shift);
+						auto& e = BishopMagicEffect[n][index + idx];
+						if (used[idx] != trial)
+						{
+							used[idx] = trial;
+							e = effects[i];
+						}
+						else
+							ok = (e == effects[i]);
+					}
+					if (ok)
+					{
+						BishopMagic[n][sq] = magic;
+						BishopMagicShift[n][sq] = shift;
+						break;
+					}
+				}
 			}
 			index += num;
 		}
 
 		// 盤外(SQ_NB)に駒を配置したときに利きがZERO_BBとなるときのための処理
 		BishopEffectIndex[n][SQ_NB] = index;
+		BishopMagicShift[n][SQ_NB] = 63;
 
 		// 何番まで使ったか出力してみる。(確保する配列をこのサイズに収めたいので)
 		// cout << index << endl;
@@ -575,5 +633,11 @@ void Bitboards::init()
 #ifdef USE_MATE_1PLY
 	Mate1Ply::init();
 #endif
+
+	// 12. 遠方駒の利きの計算方式の選択
+	// pextの使えるCPUでも、pextがmicrocodeで実装されていて遅いCPU(ZEN/ZEN2)では用いない。
+#if defined(USE_CPU_DISPATCH)
+	UsePext = CpuInfo::detect() >= CpuInfo::LEVEL_AVX2 && !CpuInfo::slow_pext();
+#endif
 }
 
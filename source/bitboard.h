@@ -415,9 +415,34 @@ extern u8		Slide[SQ_NB_PLUS1];
 extern u64      RookFileEffect[RANK_NB + 1][128];
 extern Bitboard RookRankEffect[FILE_NB + 1][128];
 
+#if defined(USE_CPU_DISPATCH)
+// 遠方駒の利きをpextで求めるか。起動時にCPUを判定して決める。(Bitboards::init())
+// pextの使えないCPUや、pextの遅いCPU(ZEN/ZEN2)ではfalseになり、NO_PEXTのときと同じ方式で求める。
+extern bool UsePext;
+
+// 遠方駒の利きの計算に用いるpext。pext命令そのものなので、UsePextがtrueのときにしか呼び出してはならない。
+#define EFFECT_PEXT64(a,b) PEXT64_BMI2(a,b)
+#else
+#define EFFECT_PEXT64(a,b) PEXT64(a,b)
+#endif
+
 // Haswellのpext()を呼び出す。occupied = occupied bitboard , mask = 利きの算出に絡む升が1のbitboard
 // この関数で戻ってきた値をもとに利きテーブルを参照して、遠方駒の利きを得る。
-inline uint64_t occupiedToIndex(const Bitboard& occupied, const Bitboard& mask) { return PEXT64(occupied.merge(), mask.merge()); }
+inline uint64_t occupiedToIndex(const Bitboard& occupied, const Bitboard& mask) { return EFFECT_PEXT64(occupied.merge(), mask.merge()); }
+
+// --- pextを用いない遠方駒の利き(NO_PEXTのときに用いる)
+
+// Zen/Zen2のようにpextがmicrocodeで実装されていて遅いCPUや、pextがsoftware emulationになる
+// AVX2未満のCPU向けに、角の利きはmagic bitboard(乗算とshiftによるindexの計算)で、
+// 飛車の横の利きは乗算によるbitの寄せ集めで求める。
+// "bench effect"で両方式の速度を比較できるように、NO_PEXTであるかどうかに関わらずテーブルは初期化しておく。
+
+// 角の利きのmagic number。BishopEffectMask[n][sq]に対応するbitを乗算で上位bitに集める。
+extern u64      BishopMagic[2][SQ_NB_PLUS1];
+extern int      BishopMagicShift[2][SQ_NB_PLUS1];
+
+// magic numberで求めたindexで引く角の利き。各升のテーブルの開始位置はBishopEffectIndexと共通。
+extern Bitboard BishopMagicEffect[2][1856+1];
 
 // --------------------
 //   大駒・小駒の利き
@@ -481,22 +506,55 @@ inline Bitboard cross45StepEffect(Square sq) { ASSERT_LV3(sq <= SQ_NB); return b
 
 // --- 遠方駒(盤上の駒の状態を考慮しながら利きを求める)
 
-// 角の右上と左下方向への利き
-inline Bitboard bishopEffect0(Square sq, const Bitboard& occupied)
+// 角の右上と左下方向への利き(pextによるテーブル参照)
+inline Bitboard bishopEffect0_pext(Square sq, const Bitboard& occupied)
 {
 	ASSERT_LV3(sq <= SQ_NB);
 	const Bitboard block0(occupied & BishopEffectMask[0][sq]);
 	return BishopEffect[0][BishopEffectIndex[0][sq] + occupiedToIndex(block0, BishopEffectMask[0][sq])];
 }
 
-// 角の左上と右下方向への利き
-inline Bitboard bishopEffect1(Square sq, const Bitboard& occupied)
+// 角の左上と右下方向への利き(pextによるテーブル参照)
+inline Bitboard bishopEffect1_pext(Square sq, const Bitboard& occupied)
 {
 	ASSERT_LV3(sq <= SQ_NB);
 	const Bitboard block1(occupied & BishopEffectMask[1][sq]);
 	return BishopEffect[1][BishopEffectIndex[1][sq] + occupiedToIndex(block1, BishopEffectMask[1][sq])];
 }
 
+// 角の右上と左下方向への利き(magic bitboardによるテーブル参照)
+inline Bitboard bishopEffect0_magic(Square sq, const Bitboard& occupied)
+{
+	ASSERT_LV3(sq <= SQ_NB);
+	const u64 block0 = (occupied & BishopEffectMask[0][sq]).merge();
+	return BishopMagicEffect[0][BishopEffectIndex[0][sq] + ((block0 * BishopMagic[0][sq]) >> BishopMagicShift[0][sq])];
+}
+
+// 角の左上と右下方向への利き(magic bitboardによるテーブル参照)
+inline Bitboard bishopEffect1_magic(Square sq, const Bitboard& occupied)
+{
+	ASSERT_LV3(sq <= SQ_NB);
+	const u64 block1 = (occupied & BishopEffectMask[1][sq]).merge();
+	return BishopMagicEffect[1][BishopEffectIndex[1][sq] + ((block1 * BishopMagic[1][sq]) >> BishopMagicShift[1][sq])];
+}
+
+#if defined(USE_CPU_DISPATCH)
+// 角の右上と左下方向への利き
+inline Bitboard bishopEffect0(Square sq, const Bitboard& occupied) { return UsePext ? bishopEffect0_pext(sq, occupied) : bishopEffect0_magic(sq, occupied); }
+
+// 角の左上と右下方向への利き
+inline Bitboard bishopEffect1(Square sq, const Bitboard& occupied) { return UsePext ? bishopEffect1_pext(sq, occupied) : bishopEffect1_magic(sq, occupied); }
+#elif !defined(NO_PEXT)
+// 角の右上と左下方向への利き
+inline Bitboard bishopEffect0(Square sq, const Bitboard& occupied) { return bishopEffect0_pext(sq, occupied); }
+
+// 角の左上と右下方向への利き
+inline Bitboard bishopEffect1(Square sq, const Bitboard& occupied) { return bishopEffect1_pext(sq, occupied); }
+#else
+inline Bitboard bishopEffect0(Square sq, const Bitboard& occupied) { return bishopEffect0_magic(sq, occupied); }
+inline Bitboard bishopEffect1(Square sq, const Bitboard& occupied) { return bishopEffect1_magic(sq, occupied); }
+#endif
+
 
 // 角 : occupied bitboardを考慮しながら角の利きを求める
 inline Bitboard bishopEffect(Square sq, const Bitboard& occupied)
@@ -522,8 +580,8 @@ inline Bitboard rookFileEffect(Square sq, const Bitboard& occupied)
 		Bitboard(0, RookFileEffect[rank_of(sq)][index] << int((File)(f - FILE_8) | RANK_1));
 }
 
-// 飛車の横の利き
-inline Bitboard rookRankEffect(Square sq, const Bitboard& occupied)
+// 飛車の横の利き(pextによるindexの計算)
+inline Bitboard rookRankEffect_pext(Square sq, const Bitboard& occupied)
 {
 	ASSERT_LV3(sq <= SQ_NB);
 	// 将棋盤をシフトして、SQ_71 , SQ_61 .. SQ_11に飛車の横方向の情報を持ってくる。
@@ -532,10 +590,35 @@ inline Bitboard rookRankEffect(Square sq, const Bitboard& occupied)
 	// PEXT64()の第二引数のほうを左シフトしておく。
 	int r = rank_of(sq);
 	u64 u = (occupied.extract64<1>() << 6*9 ) + (occupied.extract64<0>() >> 9);
-	u64 index = PEXT64(u, 0b1000000001000000001000000001000000001000000001000000001 << r);
+	u64 index = EFFECT_PEXT64(u, 0b1000000001000000001000000001000000001000000001000000001 << r);
 	return RookRankEffect[file_of(sq)][index] << r;
 }
 
+// 飛車の横の利き(乗算によるindexの計算)
+inline Bitboard rookRankEffect_mul(Square sq, const Bitboard& occupied)
+{
+	ASSERT_LV3(sq <= SQ_NB);
+	// uのbit0,9,18,..,54(9bit間隔の7bit)を拾ってくるのはpextと同じ。
+	// 0x0101010101010100を掛けると、bit 9kが2^(56-8k)倍されたものがbit 56+kに来る。
+	// それ以外の項はすべて異なるbit位置に来て繰り上がりが生じないので、上位8bitにindexが得られる。
+	int r = rank_of(sq);
+	u64 u = (occupied.extract64<1>() << 6*9 ) + (occupied.extract64<0>() >> 9);
+	u64 index = (((u >> r) & 0x0040201008040201ULL) * 0x0101010101010100ULL) >> 56;
+	return RookRankEffect[file_of(sq)][index] << r;
+}
+
+// 飛車の横の利き
+inline Bitboard rookRankEffect(Square sq, const Bitboard& occupied)
+{
+#if defined(USE_CPU_DISPATCH)
+	return UsePext ? rookRankEffect_pext(sq, occupied) : rookRankEffect_mul(sq, occupied);
+#elif !defined(NO_PEXT)
+	return rookRankEffect_pext(sq, occupied);
+#else
+	return rookRankEffect_mul(sq, occupied);
+#endif
+}
+
 // 飛 : occupied bitboardを考慮しながら飛車の利きを求める
 inline Bitboard rookEffect(Square sq, const Bitboard& occupied)
 {
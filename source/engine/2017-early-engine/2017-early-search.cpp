@@ -249,6 +249,24 @@ namespace YaneuraOu2017Early
 
 	EasyMoveManager EasyMove;
 
+	// -----------------------
+	//  置換表のfalse hitの計測
+	// -----------------------
+
+	// 置換表から取り出した指し手(指し手が格納されていなかったときを除く)がpseudo_legalでなければ、壊れたTTEntryかkeyの衝突によるfalse hitとして
+	// このスレッドのカウンターに加算する。USE_TT_FALSE_HIT_STATSがdefineされていなければ何もしない。
+	inline void count_tt_false_hit(const Position& pos, Move ttMove)
+	{
+#if defined(USE_TT_FALSE_HIT_STATS)
+		// move16_to_move()は上位16bitに移動後の駒を入れるので、指し手が格納されていなかったかは下位16bitで判定する。
+		if ((u16)ttMove != MOVE_NONE && !pos.pseudo_legal_s<false>(ttMove))
+		{
+			auto& c = pos.this_thread()->ttFalseHits;
+			c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+#endif
+	}
+
 	template <NodeType NT>
 	Value search(Position& pos, Stack* ss, Value alpha, Value beta, Depth depth, bool cutNode, bool skipEarlyPruning);
 
@@ -346,6 +364,7 @@ namespace YaneuraOu2017Early
 
 		// hash key関係
 		TTEntry* tte;          // 置換表にhitしたときの置換表のエントリーへのポインタ
+		TTEntry ttData;        // そのエントリーの内容のコピー。置換表の値はこちらから読み出す。
 		Key posKey;            // この局面のhash key
 		bool ttHit;            // 置換表にhitしたかのフラグ
 		Move ttMove;           // 置換表に登録されていた指し手
@@ -394,22 +413,23 @@ namespace YaneuraOu2017Early
 			: DEPTH_QS_NO_CHECKS;
 
 		posKey = pos.key();
-		tte = TT.probe(posKey, ttHit
+		tte = TT.probe(posKey, ttHit, ttData
 #if defined(USE_GLOBAL_OPTIONS)
 			, pos.this_thread()->thread_id()
 #endif
 		);
-		ttMove = ttHit ? pos.move16_to_move(tte->move()) : MOVE_NONE;
-		ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
+		ttMove = ttHit ? pos.move16_to_move(ttData.move()) : MOVE_NONE;
+		ttValue = ttHit ? value_from_tt(ttData.value(), ss->ply) : VALUE_NONE;
+		count_tt_false_hit(pos, ttMove);
 
 		// nonPVでは置換表の指し手で枝刈りする
 		// PVでは置換表の指し手では枝刈りしない(前回evaluateした値は使える)
 		if (!PvNode
 			&& ttHit
-			&& tte->depth() >= ttDepth
+			&& ttData.depth() >= ttDepth
 			&& ttValue != VALUE_NONE // 置換表から取り出したときに他スレッドが値を潰している可能性があるのでこのチェックが必要
-			&& (ttValue >= beta ? (tte->bound() & BOUND_LOWER)
-								: (tte->bound() & BOUND_UPPER)))
+			&& (ttValue >= beta ? (ttData.bound() & BOUND_LOWER)
+								: (ttData.bound() & BOUND_UPPER)))
 			// ttValueが下界(真の評価値はこれより大きい)もしくはジャストな値で、かつttValue >= beta超えならbeta cutされる
 			// ttValueが上界(真の評価値はこれより小さい)だが、tte->depth()のほうがdepthより深いということは、
 			// 今回の探索よりたくさん探索した結果のはずなので、今回よりは枝刈りが甘いはずだから、その値を信頼して
@@ -469,7 +489,7 @@ namespace YaneuraOu2017Early
 
 				// 置換表に評価値が格納されているとは限らないのでその場合は評価関数の呼び出しが必要
 				// bestValueの初期値としてこの局面のevaluate()の値を使う。これを上回る指し手があるはずなのだが..
-				if ((ss->staticEval = bestValue = tte->eval()) == VALUE_NONE)
+				if ((ss->staticEval = bestValue = ttData.eval()) == VALUE_NONE)
 					ss->staticEval = bestValue = evaluate(pos);
 
 				// 毎回evaluate()を呼ぶならtte->eval()自体不要なのだが、
@@ -479,7 +499,7 @@ namespace YaneuraOu2017Early
 				// 置換表に格納されていたスコアは、この局面で今回探索するものと同等か少しだけ劣るぐらいの
 				// 精度で探索されたものであるなら、それをbestValueの初期値として使う。
 				if (   ttValue != VALUE_NONE
-					&& (tte->bound() & (ttValue > bestValue ? BOUND_LOWER : BOUND_UPPER)))
+					&& (ttData.bound() & (ttValue > bestValue ? BOUND_LOWER : BOUND_UPPER)))
 						bestValue = ttValue;
 
 			} else {
@@ -874,7 +894,11 @@ namespace YaneuraOu2017Early
 
 		bool ttHit;    // 置換表がhitしたか
 
-		TTEntry* tte = TT.probe(posKey, ttHit
+		// 置換表のエントリーの内容のコピー
+		// 置換表上のエントリー(tte)は他のスレッドによって書き換えられるかも知れないので、値はこちらから読み出す。
+		TTEntry ttData;
+
+		TTEntry* tte = TT.probe(posKey, ttHit, ttData
 #if defined(USE_GLOBAL_OPTIONS)
 			, pos.this_thread()->thread_id()
 #endif
@@ -888,7 +912,7 @@ namespace YaneuraOu2017Early
 		// 置換表上のスコア
 		// 置換表にhitしなければVALUE_NONE
 
-		Value ttValue = ttHit && !excludedMove ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
+		Value ttValue = ttHit && !excludedMove ? value_from_tt(ttData.value(), ss->ply) : VALUE_NONE;
 
 		// 置換表の指し手
 		// 置換表にhitしなければMOVE_NONE
@@ -896,16 +920,18 @@ namespace YaneuraOu2017Early
 		// それが置換表にあったものとして指し手を進める。
 
 		Move ttMove = RootNode ? thisThread->rootMoves[thisThread->PVIdx].pv[0]
-					: ttHit && !excludedMove ? pos.move16_to_move(tte->move()) : MOVE_NONE;
+					: ttHit && !excludedMove ? pos.move16_to_move(ttData.move()) : MOVE_NONE;
+		if (!RootNode)
+			count_tt_false_hit(pos, ttMove);
 
 		// 置換表の値による枝刈り
 
 		if (  !PvNode        // PV nodeでは置換表の指し手では枝刈りしない(PV nodeはごくわずかしかないので..)
 			&& ttHit         // 置換表の指し手がhitして
-			&& tte->depth() >= depth   // 置換表に登録されている探索深さのほうが深くて
+			&& ttData.depth() >= depth   // 置換表に登録されている探索深さのほうが深くて
 			&& ttValue != VALUE_NONE   // (VALUE_NONEだとすると他スレッドからTTEntryが読みだす直前に破壊された可能性がある)
-			&& (ttValue >= beta ? (tte->bound() & BOUND_LOWER)
-		                		: (tte->bound() & BOUND_UPPER))
+			&& (ttValue >= beta ? (ttData.bound() & BOUND_LOWER)
+		                		: (ttData.bound() & BOUND_UPPER))
 			// ttValueが下界(真の評価値はこれより大きい)もしくはジャストな値で、かつttValue >= beta超えならbeta cutされる
 			// ttValueが上界(真の評価値はこれより小さい)だが、tte->depth()のほうがdepthより深いということは、
 			// 今回の探索よりたくさん探索した結果のはずなので、今回よりは枝刈りが甘いはずだから、その値を信頼して
@@ -1057,7 +1083,7 @@ namespace YaneuraOu2017Early
 			// 2. ttValue < evaluate()でかつ、ttValueがBOUND_UPPERなら、真の値はこれより小さいはずだから、
 			//   evalとしてttValueを採用したほうがこの局面に対する評価値の見積りとして適切である。
 			if (ttValue != VALUE_NONE
-				&& (tte->bound() & (ttValue > eval ? BOUND_LOWER : BOUND_UPPER)))
+				&& (ttData.bound() & (ttValue > eval ? BOUND_LOWER : BOUND_UPPER)))
 					eval = ttValue;
 
 		}
@@ -1252,12 +1278,13 @@ namespace YaneuraOu2017Early
 			Depth d = (3 * depth / (4 * ONE_PLY) - 2) * ONE_PLY;
 			search<NT>(pos, ss, alpha, beta, d , cutNode,true);
 
-			tte = TT.probe(posKey, ttHit
+			tte = TT.probe(posKey, ttHit, ttData
 #if defined(USE_GLOBAL_OPTIONS)
 				,pos.this_thread()->thread_id()
 #endif
 			);
-			ttMove = ttHit ? pos.move16_to_move(tte->move()) : MOVE_NONE;
+			ttMove = ttHit ? pos.move16_to_move(ttData.move()) : MOVE_NONE;
+			count_tt_false_hit(pos, ttMove);
 		}
 
 
@@ -1280,8 +1307,8 @@ namespace YaneuraOu2017Early
 			&&  ttMove != MOVE_NONE
 			&&  ttValue != VALUE_NONE // 詰み絡みのスコアであってもsingular extensionはしたほうが良いらしい。
 			&& !excludedMove // 再帰的なsingular延長はすべきではない
-			&& (tte->bound() & BOUND_LOWER)
-			&& tte->depth() >= depth - 3 * ONE_PLY;
+			&& (ttData.bound() & BOUND_LOWER)
+			&& ttData.depth() >= depth - 3 * ONE_PLY;
 		// このnodeについてある程度調べたことが置換表によって証明されている。
 		// (そうでないとsingularの指し手以外に他の有望な指し手がないかどうかを調べるために
 		// null window searchするときに大きなコストを伴いかねないから。)
@@ -2211,8 +2238,7 @@ void Search::clear()
 	TT.clear();
 
 	// Threadsが変更になってからisreadyが送られてこないとisreadyでthread数だけ初期化しているものはこれではまずい。
-	for (Thread* th : Threads)
-		th->clear();
+	Threads.clear();
 
 	Threads.main()->callsCnt = 0;
 	Threads.main()->previousScore = VALUE_INFINITE;
@@ -91,6 +91,15 @@ namespace MateEngine
   // 通常の探索エンジンとは置換表に保存したい値が異なるため
   // 詰め将棋専用の置換表を用いている
   // ただしSmallTreeGCは実装せず、Stockfishの置換表の実装を真似ている
+  //
+  // 並列探索(Threadsが2以上)のときは全スレッドでこの置換表を共有する。
+  // ・entryの読み書きはclusterごとのspin lockで排他する。
+  // 　LookUp()はentryのコピーを返し、書き戻すときはStore()で改めてentryを探して書き込む。
+  // 　(探索中に他のスレッドによってentryが別の局面のために置き換えられることがあるため、参照を保持してはならない)
+  // ・他のスレッドが書き込んだ少し古い値を読むことがある。証明数・反証数が多少古いだけなら
+  // 　反復のなかで再計算されるので問題ないが、古い値から計算した証明・反証されていない値で、
+  // 　他のスレッドが証明(pn == 0)・反証(dn == 0)したentryを上書きすると、その結果が失われてしまう。
+  // 　そこでStore()は、証明・反証済みのentryを証明・反証されていない値では上書きしない。
   struct TranspositionTable {
     static const constexpr uint32_t kInfiniteDepth = 1000000;
     static const constexpr int CacheLineSize = 64;
@@ -111,7 +120,8 @@ namespace MateEngine
 
     struct Cluster {
       TTEntry entries[3];
-      int padding;
+      // entryを確保・置換するときのlock。(0 = unlock , 1 = lock)
+      std::atomic<uint32_t> lock;
     };
     static_assert(sizeof(Cluster) == 64, "");
     static_assert(CacheLineSize % sizeof(Cluster) == 0, "");
@@ -124,8 +134,59 @@ namespace MateEngine
       }
     }
 
-    TTEntry& LookUp(Key key) {
+    // clusterのlock。並列探索でないときは何もしない。
+    struct ClusterLock {
+      ClusterLock(Cluster& c, bool shared) : lock(shared ? &c.lock : nullptr) {
+        if (lock)
+          while (lock->exchange(1, std::memory_order_acquire))
+            while (lock->load(std::memory_order_relaxed))
+              ;
+      }
+      ~ClusterLock() {
+        if (lock)
+          lock->store(0, std::memory_order_release);
+      }
+      std::atomic<uint32_t>* lock;
+    };
+
+    // keyに対応するentryのコピーを返す。見つからなければ新しく確保する。
+    TTEntry LookUp(Key key) {
       auto& entries = tt[key & clusters_mask];
+      ClusterLock lk(entries, shared);
+      return FindOrCreate(entries, key);
+    }
+
+    TTEntry LookUp(Position& n) {
+      return LookUp(n.key());
+    }
+
+    // moveを指した後の子ノードの置換表エントリを返す
+    TTEntry LookUpChildEntry(Position& n, Move move) {
+      return LookUp(n.key_after(move));
+    }
+
+    // LookUp()で得たentryを書き換えたものを置換表に書き戻す。
+    void Store(Key key, const TTEntry& e) {
+      auto& entries = tt[key & clusters_mask];
+      ClusterLock lk(entries, shared);
+      auto& entry = FindOrCreate(entries, key);
+      entry.minimum_distance = std::min(entry.minimum_distance, e.minimum_distance);
+
+      // 証明済み・反証済みのentryは、証明・反証されていない値では上書きしない。
+      if ((entry.pn == 0 || entry.dn == 0) && e.pn != 0 && e.dn != 0)
+        return;
+
+      entry.pn = e.pn;
+      entry.dn = e.dn;
+      entry.num_searched = e.num_searched;
+    }
+
+    void Store(Position& n, const TTEntry& e) {
+      Store(n.key(), e);
+    }
+
+    // LookUp()とStore()の下請け。clusterのlockを取った状態で呼び出す。
+    TTEntry& FindOrCreate(Cluster& entries, Key key) {
       uint32_t hash_high = key >> 32;
       // 検索条件に合致するエントリを返す
       for (auto& entry : entries.entries) {
@@ -147,10 +208,13 @@ namespace MateEngine
         }
       }
 
-      // 合致するエントリが見つからなかったので
-      // 世代が一番古いエントリをつぶす
+      // 合致するエントリが見つからなかったので、以下の順でつぶすエントリを選ぶ。
+      // ・世代が一番古いエントリ
+      // ・すべて現在の世代なら、証明済み(pn == 0)でないもののうち、num_searchedが最小のもの。
+      // 　(探索に手間のかかっていない小さな部分木のほうが、つぶしても再計算が安く済む)
       TTEntry* best_entry = nullptr;
-      uint32_t best_generation = UINT_MAX;
+      uint32_t best_generation = 0;
+      int64_t best_cost = INT64_MAX;
       for (auto& entry : entries.entries) {
         uint32_t temp_generation;
         if (generation < entry.generation) {
@@ -159,10 +223,14 @@ namespace MateEngine
         else {
           temp_generation = generation - entry.generation;
         }
+        int64_t cost = entry.pn == 0 ? INT_MAX + (int64_t)entry.num_searched : entry.num_searched;
 
-        if (best_generation > temp_generation) {
+        if (best_entry == nullptr ||
+          best_generation < temp_generation ||
+          (best_generation == temp_generation && best_cost > cost)) {
           best_entry = &entry;
           best_generation = temp_generation;
+          best_cost = cost;
         }
       }
       best_entry->hash_high = hash_high;
@@ -174,20 +242,66 @@ namespace MateEngine
       return *best_entry;
     }
 
-    TTEntry& LookUp(Position& n) {
-      return LookUp(n.key());
+    // 置換表の使用率を1000分率で返す。(先頭の約1000エントリーだけをサンプリングする)
+    // 現在の世代のエントリーのみを数える。
+    int hashfull() const {
+      int cnt = 0;
+      for (int i = 0; i < std::min<int64_t>(1000 / 3, num_clusters); ++i)
+        for (const auto& entry : tt[i].entries)
+          if (entry.hash_high != 0 && entry.generation == generation)
+            ++cnt;
+      return cnt;
     }
 
-    // moveを指した後の子ノードの置換表エントリを返す
-    TTEntry& LookUpChildEntry(Position& n, Move move) {
-      return LookUp(n.key_after(move));
+    // 置換表のガベージコレクション。(SmallTreeGC)
+    // num_searchedの小さい(=探索に手間のかかっていない小さな部分木の)エントリーから捨てて空きを作る。
+    // ・現在の世代のエントリーのうち、kGcRemovePermille/1000ぐらいが消えるように閾値を決める。
+    // ・前の世代のエントリーはすべて捨てる。
+    // ・証明済み(pn == 0)のエントリーは詰み手順を取り出すのに必要なので残す。
+    // 探索中に他のスレッドから呼び出されても良いように、clusterごとにlockを取って処理する。
+    // 返し値は捨てたエントリー数。
+    uint64_t CollectGarbage() {
+      // 閾値は先頭のclusterのnum_searchedの分布から決める。
+      std::vector<int> samples;
+      for (int64_t i = 0; i < std::min<int64_t>(kGcSampleClusters, num_clusters); ++i) {
+        ClusterLock lk(tt[i], shared);
+        for (const auto& entry : tt[i].entries)
+          if (entry.hash_high != 0 && entry.generation == generation && entry.pn != 0)
+            samples.push_back(entry.num_searched);
+      }
+      int threshold = -1;
+      if (!samples.empty()) {
+        auto nth = samples.begin() + samples.size() * kGcRemovePermille / 1000;
+        std::nth_element(samples.begin(), nth, samples.end());
+        threshold = *nth;
+      }
+
+      uint64_t removed = 0;
+      for (int64_t i = 0; i < num_clusters; ++i) {
+        auto& cluster = tt[i];
+        ClusterLock lk(cluster, shared);
+
+        // FindOrCreate()は空きエントリーが後ろにあることを前提としているので、残すものを前に詰める。
+        int n = 0;
+        for (auto& entry : cluster.entries) {
+          if (entry.hash_high == 0)
+            break;
+          if (entry.generation == generation && (entry.pn == 0 || entry.num_searched > threshold))
+            cluster.entries[n++] = entry;
+          else
+            ++removed;
+        }
+        for (int j = n; j < 3; ++j)
+          cluster.entries[j].hash_high = 0;
+      }
+
+      ++gc_count;
+      gc_removed += removed;
+      return removed;
     }
 
     void Resize() {
-      int64_t hash_size_mb = (int)Options["Hash"];
-      if (hash_size_mb == 16) {
-        hash_size_mb = 4096;
-      }
+      int64_t hash_size_mb = (int)Options["MateHash"];
       int64_t new_num_clusters = 1LL << MSB64((hash_size_mb * 1024 * 1024) / sizeof(Cluster));
       if (new_num_clusters == num_clusters) {
         return;
@@ -206,40 +320,143 @@ namespace MateEngine
       clusters_mask = num_clusters - 1;
     }
 
-    void NewSearch() {
+    // 探索開始時に呼び出す。
+    // shared_ : 複数スレッドで共有して用いるのか
+    void NewSearch(bool shared_) {
       generation = (generation + 1) & 0xff;
+      shared = shared_;
+      gc_count = 0;
+      gc_removed = 0;
+      gc_skip = 0;
+      gc_backoff = 0;
     }
 
+    // 置換表の使用率を調べるたびに呼び出して、CollectGarbage()を行なうべきかを返す。
+    // 前回のCollectGarbage()でほとんど捨てられなかったとき(大半が証明済みのエントリーのとき)は、
+    // 毎回置換表全体を走査しないように、次に行なうまでの間隔を倍々に広げる。
+    bool ShouldCollectGarbage() {
+      if (gc_skip > 0) {
+        --gc_skip;
+        return false;
+      }
+      return hashfull() >= kGcHashfull;
+    }
+
+    // CollectGarbage()で捨てたエントリー数を渡して、次のCollectGarbage()までの間隔を決める。
+    void UpdateGcBackoff(uint64_t removed) {
+      if (removed * 1000 < (uint64_t)num_clusters * 3 * kGcMinRemovePermille)
+        gc_backoff = std::min(std::max(gc_backoff * 2, 1), kGcMaxBackoff);
+      else
+        gc_backoff = 0;
+      gc_skip = gc_backoff;
+    }
+
+    // CollectGarbage()を呼び出すhashfull()の値
+    static const constexpr int kGcHashfull = 900;
+    // CollectGarbage()で捨てるエントリーの割合(1000分率)
+    static const constexpr int kGcRemovePermille = 500;
+    // CollectGarbage()で閾値を決めるためにサンプリングするclusterの数
+    static const constexpr int kGcSampleClusters = 1 << 14;
+    // CollectGarbage()で捨てたエントリーが全体のこの割合(1000分率)未満なら、次のCollectGarbage()までの間隔を広げる。
+    static const constexpr int kGcMinRemovePermille = 50;
+    // 間隔を広げるときに飛ばす、置換表の使用率のチェックの回数の上限
+    static const constexpr int kGcMaxBackoff = 64;
+
     int tt_mask = 0;
     void* tt_raw = nullptr;
     Cluster* tt = nullptr;
     int64_t num_clusters = 0;
     int64_t clusters_mask = 0;
     uint32_t generation = 0; // 256で一周する
+    bool shared = false;
+
+    // 今回の探索でCollectGarbage()を呼び出した回数と、捨てたエントリー数の合計
+    int gc_count = 0;
+    uint64_t gc_removed = 0;
+
+    // あと何回、置換表の使用率のチェックを飛ばすか。(UpdateGcBackoff()で設定される)
+    int gc_skip = 0;
+    // 現在の、飛ばすチェックの回数
+    int gc_backoff = 0;
   };
 
   static const constexpr int kInfinitePnDn = 100000000;
   static const constexpr int kMaxDepth = MAX_PLY;
+  // 置換表の使用率を調べる間隔(mainスレッドの探索ノード数)
+  static const constexpr uint64_t kGcCheckInterval = 100000;
 
   TranspositionTable transposition_table;
 
+  // --- 並列探索
+
+  // 全スレッドがrootから同じdf-pnを行ない、置換表を介して結果を共有する。(shared-TT SMP)
+  // 同じ局面ばかりを探索しないように、他のスレッドが探索中の子ノードは、
+  // 証明数(ORノード)・反証数(ANDノード)が実際より大きいとみなして選ばれにくくする。(virtual proof number)
+
+  // 各局面を探索中のスレッドの数。局面のhash keyの下位bitで引く。(衝突しても選ばれにくくなるだけなので気にしない)
+  static const constexpr int kSearchingTableSize = 1 << 20;
+  std::atomic<uint16_t> searching_threads[kSearchingTableSize];
+
+  // virtual proof numberを用いるか。(Threadsが2以上のとき)
+  bool use_virtual_pn = false;
+
+  std::atomic<uint16_t>& SearchingThreads(Key key) {
+    return searching_threads[key & (kSearchingTableSize - 1)];
+  }
+
+  // 他のスレッドが探索中の局面のpn(dn)を、探索中のスレッド数に応じて大きくしたもの。子ノードの選択にのみ用いる。
+  int VirtualPnDn(int pndn, Key key) {
+    if (!use_virtual_pn || pndn == 0 || pndn >= kInfinitePnDn)
+      return pndn;
+    int n = SearchingThreads(key).load(std::memory_order_relaxed);
+    return std::min(pndn * (1 + n), kInfinitePnDn - 1);
+  }
+
+  // mainスレッドの探索が終わったらtrueにする。helperスレッドはこれを見て探索を打ち切る。
+  std::atomic<bool> search_finished;
+
+  bool ShouldStop() {
+    return Threads.stop.load(std::memory_order_relaxed) || search_finished.load(std::memory_order_relaxed);
+  }
+
+  // 探索中のentryを置換表に書き戻す。
+  // 探索を打ち切ったあとは書き込まない。(mainスレッドがrootを証明したあとに、helperスレッドが
+  // 途中までの古い値を書き込んで、詰み手順を取り出すのに必要なentryを潰さないように)
+  void StoreEntry(Position& n, const TranspositionTable::TTEntry& entry) {
+    if (!ShouldStop())
+      transposition_table.Store(n, entry);
+  }
+
   // TODO(tanuki-): ネガマックス法的な書き方に変更する
   void DFPNwithTCA(Position& n, int thpn, int thdn, bool inc_flag, bool or_node, int depth) {
-    if (Threads.stop.load(std::memory_order_relaxed)) {
+    if (ShouldStop()) {
       return;
     }
 
     auto nodes_searched = n.this_thread()->nodes.load(memory_order_relaxed);
-    if (nodes_searched && nodes_searched % 10000000 == 0) {
-      sync_cout << "info string nodes_searched=" << nodes_searched << sync_endl;
+    if (nodes_searched && n.this_thread() == Threads.main()) {
+      if (nodes_searched % 10000000 == 0) {
+        sync_cout << "info string nodes_searched=" << nodes_searched
+          << " hashfull=" << transposition_table.hashfull() << sync_endl;
+      }
+
+      // 置換表が埋まってきたらガベージコレクションを行なう。
+      if (nodes_searched % kGcCheckInterval == 0 && transposition_table.ShouldCollectGarbage()) {
+        int hashfull = transposition_table.hashfull();
+        auto removed = transposition_table.CollectGarbage();
+        transposition_table.UpdateGcBackoff(removed);
+        sync_cout << "info string mate tt gc : removed " << removed << " entries , hashfull "
+          << hashfull << " -> " << transposition_table.hashfull() << sync_endl;
+      }
     }
 
-    auto& entry = transposition_table.LookUp(n);
+    auto entry = transposition_table.LookUp(n);
 
     if (depth > kMaxDepth) {
       entry.pn = kInfinitePnDn;
       entry.dn = 0;
       entry.minimum_distance = std::min(entry.minimum_distance, depth);
+      StoreEntry(n, entry);
       return;
     }
 
@@ -250,6 +467,7 @@ namespace MateEngine
       entry.pn = 0;
       entry.dn = kInfinitePnDn;
       entry.minimum_distance = std::min(entry.minimum_distance, depth);
+      StoreEntry(n, entry);
       return;
     }
 
@@ -269,6 +487,7 @@ namespace MateEngine
       }
 
       entry.minimum_distance = std::min(entry.minimum_distance, depth);
+      StoreEntry(n, entry);
       return;
     }
 
@@ -277,7 +496,7 @@ namespace MateEngine
     entry.minimum_distance = std::min(entry.minimum_distance, depth);
 
     bool first_time = true;
-    while (!Threads.stop.load(std::memory_order_relaxed)) {
+    while (!ShouldStop()) {
       ++entry.num_searched;
 
       // determine whether thpn and thdn are increased.
@@ -336,6 +555,7 @@ namespace MateEngine
       // if (pn(n) ≥ thpn || dn(n) ≥ thdn)
       //   break; // termination condition is satisfied
       if (entry.pn >= thpn || entry.dn >= thdn) {
+        StoreEntry(n, entry);
         break;
       }
 
@@ -350,7 +570,7 @@ namespace MateEngine
       //   thpn child = thpn - pn(n) + pn(n1);
       //   thdn child = min(thdn, dn(n2) + 1);
       // }
-      Move best_move;
+      Move best_move = MOVE_NONE;
       int thpn_child;
       int thdn_child;
       if (or_node) {
@@ -360,17 +580,19 @@ namespace MateEngine
         int best_dn = 0;
         int best_num_search = INT_MAX;
         for (const auto& move : move_picker) {
-          const auto& child_entry = transposition_table.LookUpChildEntry(n, move);
-          if (child_entry.pn < best_pn ||
-            child_entry.pn == best_pn && best_num_search > child_entry.num_searched) {
+          const Key child_key = n.key_after(move);
+          const auto& child_entry = transposition_table.LookUp(child_key);
+          const int child_pn = VirtualPnDn(child_entry.pn, child_key);
+          if (child_pn < best_pn ||
+            child_pn == best_pn && best_num_search > child_entry.num_searched) {
             second_best_pn = best_pn;
-            best_pn = child_entry.pn;
+            best_pn = child_pn;
             best_dn = child_entry.dn;
             best_move = move;
             best_num_search = child_entry.num_searched;
           }
-          else if (child_entry.pn < second_best_pn) {
-            second_best_pn = child_entry.pn;
+          else if (child_pn < second_best_pn) {
+            second_best_pn = child_pn;
           }
         }
 
@@ -384,16 +606,18 @@ namespace MateEngine
         int best_pn = 0;
         int best_num_search = INT_MAX;
         for (const auto& move : move_picker) {
-          const auto& child_entry = transposition_table.LookUpChildEntry(n, move);
-          if (child_entry.dn < best_dn ||
-            child_entry.dn == best_dn && best_num_search > child_entry.num_searched) {
+          const Key child_key = n.key_after(move);
+          const auto& child_entry = transposition_table.LookUp(child_key);
+          const int child_dn = VirtualPnDn(child_entry.dn, child_key);
+          if (child_dn < best_dn ||
+            child_dn == best_dn && best_num_search > child_entry.num_searched) {
             second_best_dn = best_dn;
-            best_dn = child_entry.dn;
+            best_dn = child_dn;
             best_pn = child_entry.pn;
             best_move = move;
           }
-          else if (child_entry.dn < second_best_dn) {
-            second_best_dn = child_entry.dn;
+          else if (child_dn < second_best_dn) {
+            second_best_dn = child_dn;
           }
         }
 
@@ -401,10 +625,31 @@ namespace MateEngine
         thdn_child = std::min(thdn, second_best_dn + 1);
       }
 
+      StoreEntry(n, entry);
+
+      // pn(dn)を計算したあとで、他のスレッドによってすべての子ノードが反証(証明)されたときは、選べる子ノードがない。
+      // このノードの値は次にLookUp()したときに子ノードから計算しなおされるので、ここで打ち切る。
+      if (best_move == MOVE_NONE)
+        break;
+
       StateInfo state_info;
       n.do_move(best_move, state_info);
+
+      // このスレッドが探索中であることを他のスレッドに知らせる。
+      auto& searching = SearchingThreads(n.key());
+      if (use_virtual_pn)
+        searching.fetch_add(1, std::memory_order_relaxed);
+
       DFPNwithTCA(n, thpn_child, thdn_child, inc_flag, !or_node, depth + 1);
+
+      if (use_virtual_pn)
+        searching.fetch_sub(1, std::memory_order_relaxed);
+
       n.undo_move(best_move);
+
+      // 子ノードを探索している間に他のスレッドが書き込んだ値を反映させるため、引き直しておく。
+      entry = transposition_table.LookUp(n);
+      entry.minimum_distance = std::min(entry.minimum_distance, depth);
     }
   }
 
@@ -467,18 +712,36 @@ namespace MateEngine
 
     transposition_table.Resize();
     // キャッシュの世代を進める
-    transposition_table.NewSearch();
+    transposition_table.NewSearch(Threads.size() > 1);
+
+    use_virtual_pn = Threads.size() > 1;
+    search_finished = false;
 
     auto start = std::chrono::system_clock::now();
 
+    // helperスレッドにも同じ局面から探索を開始させる。
+    for (Thread* th : Threads)
+      if (th != r.this_thread())
+        th->start_searching();
+
     DFPNwithTCA(r, kInfinitePnDn, kInfinitePnDn, false, true, 0);
+
+    // rootの証明・反証が終わった(or stopが来た)ので、helperスレッドを停止させて待つ。
+    search_finished = true;
+    for (Thread* th : Threads)
+      if (th != r.this_thread())
+        th->wait_for_search_finished();
+
     const auto& entry = transposition_table.LookUp(r);
 
-    auto nodes_searched = r.this_thread()->nodes.load(memory_order_relaxed);
+    auto nodes_searched = Threads.nodes_searched();
     sync_cout << "info string" <<
       " pn " << entry.pn <<
       " dn " << entry.dn <<
-      " nodes_searched " << nodes_searched << sync_endl;
+      " nodes_searched " << nodes_searched <<
+      " hashfull " << transposition_table.hashfull() <<
+      " gc " << transposition_table.gc_count <<
+      " gc_removed " << transposition_table.gc_removed << sync_endl;
 
     std::vector<Move> moves;
     std::unordered_set<Key> visited;
@@ -487,7 +750,7 @@ namespace MateEngine
     auto end = std::chrono::system_clock::now();
     if (!moves.empty()) {
       auto time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-      time_ms = std::max(time_ms, 1LL);
+      time_ms = std::max(time_ms, (decltype(time_ms))1);
       int64_t nps = nodes_searched * 1000LL / time_ms;
       std::ostringstream oss;
       oss << "info depth " << moves.size() << " time " << time_ms << " nodes " << nodes_searched << " pv";
@@ -502,7 +765,7 @@ namespace MateEngine
     // "ponderhit"が送られてきたらLimits.ponder == 0になるので、それを待つ。(stopOnPonderhitは用いない)
     //    また、このときThreads.stop == trueにはならない。(この点、Stockfishとは異なる。)
     // "go infinite"に対してはstopが送られてくるまで待つ。
-    while (!Threads.stop && (Limits.ponder || Limits.infinite))
+    while (!Threads.stop && (Threads.ponder || Limits.infinite))
       sleep(1);
     //	こちらの思考は終わっているわけだから、ある程度細かく待っても問題ない。
     // (思考のためには計算資源を使っていないので。)
@@ -519,19 +782,45 @@ namespace MateEngine
 
     Threads.stop = true;
   }
+
+  // helperスレッドのエントリポイント
+  // mainスレッドと同じくrootからdf-pnを行なう。置換表を介して結果がmainスレッドに伝わる。
+  void dfpn_helper(Position& r) {
+    if (r.in_check())
+      return;
+
+    DFPNwithTCA(r, kInfinitePnDn, kInfinitePnDn, false, true, 0);
+
+    // このスレッドがrootを証明(反証)したなら、mainスレッドがそれに気づくのを待たずに探索を終了させる。
+    // (mainスレッドは自分が探索中の部分木から戻るまでrootの値を見ないので)
+    const auto& entry = transposition_table.LookUp(r);
+    if (entry.pn == 0 || entry.dn == 0)
+      search_finished = true;
+  }
 }
 
-void USI::extra_option(USI::OptionsMap & o) {}
+// USIに追加オプションを設定したいときは、この関数を定義すること。
+// USI::init()のなかからコールバックされる。
+void USI::extra_option(USI::OptionsMap & o)
+{
+  // Hash上限。32bitモードなら2GB、64bitモードなら1024GB
+  const int MaxHashMB = Is64Bit ? 1024 * 1024 : 2048;
+
+  // 詰将棋探索で確保する置換表のサイズ[MB]。通常探索用の"Hash"とは別。
+  // 埋まってきたら置換表のガベージコレクションを行なうので、長手数の詰将棋でもこのサイズの範囲内で探索する。
+  // (32bitモードではデフォルト値も上限に合わせる)
+  o["MateHash"] << Option(std::min(4096, MaxHashMB), 1, MaxHashMB);
+}
 
 // --- Search
 
 void Search::init() {}
 void Search::clear() { }
 void MainThread::think() {
-  Thread::search();
+  MateEngine::dfpn(rootPos);
 }
 void Thread::search() {
-  MateEngine::dfpn(rootPos);
+  MateEngine::dfpn_helper(rootPos);
 }
 
 #endif
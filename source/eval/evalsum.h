@@ -2,6 +2,7 @@
 #define _EVAL_SUM_H_
 
 #include "../shogi.h"
+#include "../misc.h"
 #include <array>
 
 // KPPT,KPP_PPTで使うためのヘルパクラス
@@ -224,35 +225,62 @@ namespace Eval {
 	static bool operator != (const EvalSum& lhs, const EvalSum rhs)	{ return !(lhs == rhs);	}
 
 #ifdef USE_EVAL_HASH
-	// シンプルなHashTableの実装。
-	// Sizeは2のべき乗。
-	template <typename T, size_t Size>
-	struct HashTable
+	// evaluateしたものを保存しておくHashTable(俗にいうehash)
+	// ・サイズはOptions["EvalHash"]で[MB]単位で指定する。isreadyのタイミングでresize()される。
+	// ・置換表と同じく、LargeMemoryを用いてLarge Pageで確保する。
+	// ・entryのread/writeはEvalSum::encode()/decode()によってkeyとデータの整合性が検証されるので、lockは不要。
+	struct EvaluateHashTable
 	{
-		HashTable() { clear(); }
-		T* operator [] (const Key k) { return entries_ + (static_cast<size_t>(k) & (Size - 1)); }
-		void clear() { memset(entries_, 0, sizeof(T)*Size); }
+		EvaluateHashTable() : entries_(&dummy_), mask_(0), large_page_mode(LARGE_PAGE_NONE), numa_interleave(false)
+		{ memset(&dummy_, 0, sizeof(dummy_)); }
+
+		// kに対応するentryのアドレスを返す。
+		EvalSum* operator [] (const Key k) { return entries_ + (static_cast<size_t>(k) & mask_); }
+
+		// テーブルをmbSize[MB]で確保しなおす。entry数は2のべき乗に切り捨てる。
+		// サイズと確保方法(LargePages,NumaInterleave)が前回と同じなら何もしない。(中身も保持される)
+		void resize(size_t mbSize);
 
-		// Size が 2のべき乗であることのチェック
-		static_assert((Size & (Size - 1)) == 0, "");
+		// テーブルを全クリアする。評価関数を読み直したときには呼び出さなければならない。
+		void clear();
+
+		// 確保しているサイズ[MB]
+		size_t size_mb() const { return ((mask_ + 1) * sizeof(EvalSum)) >> 20; }
+
+		// テーブルの使用率を千分率で返す。(先頭の1000 entryを調べる)
+		int hashfull() const;
 
 	private:
-		T entries_[Size];
-	};
+		// テーブル本体。resize()されるまではdummy_を指しているので、isready前に評価関数を呼び出しても落ちない。
+		EvalSum* entries_;
 
-	// evaluateしたものを保存しておくHashTable(俗にいうehash)
+		// entry数 - 1
+		size_t mask_;
+
+		// テーブルを確保したメモリとその確保方法
+		LargeMemory mem;
+		LargePageMode large_page_mode;
+		bool numa_interleave;
 
+		EvalSum dummy_;
+	};
+
+	// EvalHashオプションのデフォルト値[MB]
 #if !defined(USE_LARGE_EVAL_HASH)
-	// 134MB(魔女のAVX2以外の時の設定)
-	struct EvaluateHashTable : HashTable<EvalSum, 0x400000> {};
+	// 128MB(魔女のAVX2以外の時の設定)
+	const int EvalHashDefaultMB = 128;
 #else
 	// prefetch有りなら大きいほうが良いのでは…。
 	// →　あまり変わらないし、メモリもったいないのでデフォルトでは↑の設定で良いか…。
 	// 1GB(魔女のAVX2の時の設定)
-	struct EvaluateHashTable : HashTable<EvalSum, 0x2000000> {};
+	const int EvalHashDefaultMB = 1024;
 #endif
 
 	extern EvaluateHashTable g_evalTable;
+
+	// eval hashのサイズ、使用率と、probes回調べてhits回hit、collisions回衝突したことを"info string"で出力する。
+	// probes == 0なら、サイズと使用率だけを出力する。
+	void print_evalhash_stats(u64 probes, u64 hits, u64 collisions);
 #endif
 
 } // namespace Eval
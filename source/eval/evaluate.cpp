@@ -2,6 +2,18 @@
 #include "../position.h"
 #include "../evaluate.h"
 #include "../misc.h"
+#include "evaluate_common.h"
+
+#include <iomanip>
+#include <sstream>
+
+#if defined (USE_SHARED_MEMORY_IN_EVAL) && !defined(_WIN32)
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <climits>
+#include <cstdlib>
+#endif
 
 // 全評価関数に共通の処理などもここに記述する。
 
@@ -108,6 +120,226 @@ namespace Eval
 		sync_cout << "info string Eval Check Sum = " << std::hex << check_sum << std::dec
 			<< " , Eval File = " << softname << sync_endl;
 	}
+
+#if defined(USE_EVAL_HASH)
+
+	// eval hashのサイズを確保しなおす。
+	void EvaluateHashTable::resize(size_t mbSize)
+	{
+		const size_t newEntryCount = size_t(1) << MSB64(std::max((mbSize * 1024 * 1024) / sizeof(EvalSum), (size_t)1));
+
+		LargePageMode mode = to_large_page_mode(Options["LargePages"]);
+		bool interleave = Options["NumaInterleave"];
+
+		// 同じサイズ、同じ確保方法なら確保しなおす必要はない。
+		if (entries_ != &dummy_ && newEntryCount == mask_ + 1 && mode == large_page_mode && interleave == numa_interleave)
+			return;
+
+		large_page_mode = mode;
+		numa_interleave = interleave;
+
+		// 古いメモリを先に解放しておかないと、一時的に2倍のメモリが必要になる。
+		entries_ = &dummy_;
+		mask_ = 0;
+		mem.free();
+
+		// 置換表と同じくcache line(64byte)でalignしておく。(EvalSumは32byteなので、1 entryが2つのcache lineを跨ぐことはない)
+		EvalSum* table = (EvalSum*)mem.alloc(newEntryCount * sizeof(EvalSum), 64, mode, interleave);
+		if (!table)
+		{
+			std::cout << "info string Error : Failed to allocate " << mbSize << "MB for eval hash." << std::endl;
+			my_exit();
+		}
+
+		entries_ = table;
+		mask_ = newEntryCount - 1;
+
+		clear();
+
+		sync_cout << "info string EvalHash " << size_mb() << "MB allocated with " << mem.info() << sync_endl;
+	}
+
+	// eval hashの全クリア
+	void EvaluateHashTable::clear()
+	{
+		const size_t size = (mask_ + 1) * sizeof(EvalSum);
+
+		// 置換表のclear()と同じく、大きいときは探索スレッド数だけのスレッドで並列にゼロクリアしてfirst touchしておく。
+		const size_t thread_num = size < 64 * 1024 * 1024 ? 1 : std::max(Threads.size(), (size_t)1);
+
+		std::vector<std::thread> threads;
+		for (size_t idx = 0; idx < thread_num; ++idx)
+		{
+			threads.push_back(std::thread([this, idx, thread_num, size]() {
+
+				if (thread_num > 8)
+					WinProcGroup::bindThisThread(idx);
+
+				const size_t stride = size / thread_num;
+				const size_t start = stride * idx;
+				const size_t len = idx != thread_num - 1 ? stride : size - start;
+
+				std::memset((u8*)entries_ + start, 0, len);
+			}));
+		}
+
+		for (auto& th : threads)
+			th.join();
+	}
+
+	// eval hashの使用率を千分率で返す。
+	int EvaluateHashTable::hashfull() const
+	{
+		const size_t n = std::min(mask_ + 1, (size_t)1000);
+
+		size_t cnt = 0;
+		for (size_t i = 0; i < n; ++i)
+		{
+			EvalSum entry = entries_[i];
+			entry.decode();
+			cnt += entry.key != 0;
+		}
+		return int(cnt * 1000 / n);
+	}
+
+	// eval hashの統計を"info string"で出力する。
+	void print_evalhash_stats(u64 probes, u64 hits, u64 collisions)
+	{
+		const u64 p = std::max(probes, (u64)1);
+
+		// coutの書式を変更したくないので、一度stringstreamに書き出す。
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(2)
+			<< "info string EvalHash " << g_evalTable.size_mb() << "MB , hashfull " << g_evalTable.hashfull();
+
+		// probesはUSE_EVAL_HASH_STATSがdefineされていないと数えていない。(0になっている)
+		if (probes)
+			ss << " , probes " << probes
+				<< " , hit " << (100.0 * hits / p) << "%"
+				<< " , collision " << (100.0 * collisions / p) << "%";
+		sync_cout << ss.str() << sync_endl;
+	}
+
+#endif
+
+#if defined(EVAL_KPPT) || defined(EVAL_KPP_KKPT)
+
+	// 評価関数ファイルをmapしたメモリ(KK,KKP,KPP)
+	LargeMemory eval_file_memory[3];
+
+	bool map_eval_files(const std::vector<std::string>& filenames, const std::vector<u64>& sizes, std::vector<void*>& ptrs)
+	{
+		unmap_eval_files();
+
+		const std::string mode = Options["EvalMmap"];
+		if (mode == "No")
+			return false;
+
+		ASSERT_LV1(filenames.size() == sizes.size() && filenames.size() <= 3);
+
+		Timer time;
+		time.reset();
+
+		ptrs.clear();
+		for (size_t i = 0; i < filenames.size(); ++i)
+		{
+			const std::string path = path_combine((std::string)Options["EvalDir"], filenames[i]);
+			size_t size;
+
+#if defined(EVAL_LEARN)
+			// 学習時は評価関数パラメーターを書き換えるので読み込み専用にはしない。(copy-on-writeになる)
+			const bool read_only = false;
+#else
+			const bool read_only = true;
+#endif
+			void* ptr = eval_file_memory[i].map_file(path, size, mode == "Populate", read_only);
+
+			// 評価関数の実験のためにfe_endを変更しているときなどは、ファイルの形式がメモリ上の形式と一致しないので、
+			// mapしたものをそのまま使うことは出来ない。
+			if (ptr == nullptr || size != sizes[i])
+			{
+				sync_cout << "info string can't map " << path << " , fall back to reading." << sync_endl;
+				unmap_eval_files();
+				return false;
+			}
+			ptrs.push_back(ptr);
+		}
+
+		sync_cout << "info string use mapped eval files. EvalMmap = " << mode << " , " << time.elapsed() << "ms" << sync_endl;
+		return true;
+	}
+
+	void unmap_eval_files()
+	{
+		for (auto& m : eval_file_memory)
+			m.free();
+	}
+
+#endif
+
+#if defined (USE_SHARED_MEMORY_IN_EVAL) && !defined(_WIN32)
+
+	// 評価関数を共有しているshared memory。プロセスの終了時にdetachされる。
+	SharedMemory shared_eval_memory;
+
+	void* attach_shared_eval(size_t size, const char* eval_type, const std::function<void(void*)>& load)
+	{
+		const std::string dir = (std::string)Options["EvalDir"];
+
+		// EvalDirの絶対pathと、そのフォルダ内のファイルの名前・サイズ・更新日時をつなげた文字列
+		std::string id = std::to_string(size);
+		char path[PATH_MAX];
+		id += realpath(dir.c_str(), path) ? path : dir.c_str();
+
+		std::vector<std::string> files;
+		if (DIR* d = opendir(dir.c_str()))
+		{
+			while (dirent* e = readdir(d))
+				files.push_back(e->d_name);
+			closedir(d);
+		}
+		std::sort(files.begin(), files.end());
+		for (auto& f : files)
+		{
+			struct stat st;
+			if (stat((dir + "/" + f).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+				id += "/" + f + ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtime);
+		}
+
+		// FNV-1aでhash値にする。shm_open()に渡す名前には'/'を含められないのと、長さの制限があるため。
+		u64 h = 14695981039346656037ULL;
+		for (unsigned char c : id)
+			h = (h ^ c) * 1099511628211ULL;
+
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+		const std::string name = std::string("/YANEURAOU_") + eval_type + "_" ENGINE_VERSION "_" + hex;
+
+#if defined(EVAL_LEARN)
+		// 学習時は評価関数パラメーターを書き換えるので読み込み専用にはしない。
+		const bool read_only = false;
+#else
+		const bool read_only = true;
+#endif
+
+		// kill -9などで強制終了されたプロセスが残していった、どのプロセスも使っていない評価関数を削除しておく。
+		SharedMemory::remove_unused(std::string("/YANEURAOU_") + eval_type + "_");
+
+		void* ptr = shared_eval_memory.attach(name, size, load, read_only);
+		if (ptr != nullptr)
+			sync_cout << "info string " << (shared_eval_memory.initialized_by_self() ? "created" : "use")
+				<< " shared eval memory. name = " << name << sync_endl;
+		return ptr;
+	}
+
+	bool detach_shared_eval()
+	{
+		const bool attached = shared_eval_memory.attached();
+		shared_eval_memory.detach();
+		return attached;
+	}
+#endif
+
 #endif
 
 #if defined (USE_EVAL_MAKE_LIST_FUNCTION)
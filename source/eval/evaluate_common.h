@@ -19,12 +19,38 @@
 #define KPPP_BIN "KPPP_synthesized.bin"
 #endif
 
+#if defined(USE_EVAL_HASH)
+#include "../thread.h"
+#endif
+
 namespace Eval
 {
 
 #if defined(USE_EVAL_HASH)
 	// prefetchする関数
 	void prefetch_evalhash(const Key key);
+
+	// eval hashを調べた結果を、posを探索しているスレッドの統計に加算する。
+	// hit       : eval hashにhitしたか
+	// collision : hitしなかったときに、そのentryに別の局面が入っていたか
+	// USE_EVAL_HASH_STATSがdefineされていなければ何もしない。
+#if defined(USE_EVAL_HASH_STATS)
+	inline void count_evalhash(const Position& pos, bool hit, bool collision)
+	{
+		Thread* th = pos.this_thread();
+		if (th == nullptr)
+			return;
+
+		auto inc = [](std::atomic<uint64_t>& c) { c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); };
+		inc(th->evalHashProbes);
+		if (hit)
+			inc(th->evalHashHits);
+		else if (collision)
+			inc(th->evalHashCollisions);
+	}
+#else
+	inline void count_evalhash(const Position& , bool , bool ) {}
+#endif
 #endif
 
 	// 評価関数のそれぞれのパラメーターに対して関数fを適用してくれるoperator。
@@ -36,6 +62,32 @@ namespace Eval
 	//   type = 2  : KPPのみ 
 	void foreach_eval_param(std::function<void(s32, s32)>f, int type = -1);
 
+#if defined(EVAL_KPPT) || defined(EVAL_KPP_KKPT)
+	// "EvalMmap"オプションに従って、EvalDirにあるfilenames[i]の評価関数ファイルをmapして、その先頭をptrs[i]に返す。
+	// ・ファイル上の形式がメモリ上の形式と一致している(ファイルサイズがsizes[i]と一致する)ときにだけ、
+	// 　読み込み(コピー)せずにmapしたものをそのまま評価関数パラメーターとして使える。
+	// ・EvalMmapが"No"のとき、mapできなかったときはfalseが返る。(このとき何もmapしていない)
+	// ・学習時などに書き換えても、copy-on-writeなのでファイルには反映されない。
+	bool map_eval_files(const std::vector<std::string>& filenames, const std::vector<u64>& sizes, std::vector<void*>& ptrs);
+
+	// map_eval_files()でmapしていた評価関数ファイルをunmapする。
+	void unmap_eval_files();
+#endif
+
+#if defined (USE_SHARED_MEMORY_IN_EVAL) && !defined(_WIN32)
+	// 評価関数パラメーターをPOSIXのshared memoryに確保して、他のプロセスと共有する。
+	// (Windowsでは各評価関数のload_eval()でCreateFileMapping()を用いて共有している。)
+	// ・shared memoryは、評価関数の種類(eval_type)と、EvalDirの絶対pathとそのフォルダ内のファイルの
+	// 　名前・サイズ・更新日時から求めたhash値で識別する。評価関数ファイルを差し替えれば別のものになる。
+	// ・最初にattachしたプロセスだけがload(ptr)を呼び出して評価関数を読み込み、
+	// 　他のプロセスはその完了を待ってから読み込み専用で共有する。
+	// ・返し値はsizeバイトのshared memoryの先頭。(32バイト以上でalignされている) 失敗したときはnullptr。
+	void* attach_shared_eval(size_t size, const char* eval_type, const std::function<void(void*)>& load);
+
+	// attach_shared_eval()で共有していたshared memoryの共有をやめる。共有していたならtrueが返る。
+	bool detach_shared_eval();
+#endif
+
 	// --------------------------
 	//        学習用
 	// --------------------------
@@ -16,6 +16,10 @@
 #include "../evaluate_io.h"
 #include "evaluate_kpp_kkpt.h"
 
+#if defined(USE_CPU_DISPATCH)
+#include "../../extra/cpu_info.h"
+#endif
+
 // 実験中の評価関数を読み込む。(現状非公開)
 #if defined (EVAL_EXPERIMENTAL)
 #include "../experimental/evaluate_experimental.h"
@@ -98,10 +102,18 @@ namespace Eval
 		return sum;
 	}
 
+#if defined(USE_CPU_DISPATCH)
+	// KPPの計算に用いる命令セットを選ぶ。(後述)
+	static void select_kpp_kernel();
+#endif
+
 	void init()
 	{
 #if defined(EVAL_EXPERIMENTAL)
 		init_eval_experimental();
+#endif
+#if defined(USE_CPU_DISPATCH)
+		select_kpp_kernel();
 #endif
 	}
 
@@ -114,19 +126,50 @@ namespace Eval
 		kpp_ = (ValueKpp(*)[SQ_NB][fe_end][fe_end]) (p + size_of_kk + size_of_kkp);
 	}
 
+	// eval_malloc()で確保したメモリ。
+	// 評価関数パラメーターはshared memoryやmapしたファイル上にあることもあるので、kk_とは別に保持しておく。
+	void* eval_memory = nullptr;
+
+	// eval_malloc()で確保したメモリを解放する。
+	void eval_free()
+	{
+		if (eval_memory != nullptr)
+		{
+			aligned_free(eval_memory);
+			eval_memory = nullptr;
+		}
+	}
+
 	void eval_malloc()
 	{
 		// benchコマンドなどでOptionsを保存して復元するのでこのときEvalDirが変更されたことになって、
 		// 評価関数の再読込の必要があるというフラグを立てるため、この関数は2度呼び出されることがある。
-		if (kk_ != nullptr)
-		{
-			aligned_free((void*)kk_);
-			kk_ = nullptr;
-		}
+		eval_free();
 
 		// メモリ確保は一回にして、連続性のある確保にする。
 		// このメモリは、プロセス終了のときに自動開放されることを期待している。
-		eval_assign(aligned_malloc(size_of_eval, 32));
+		eval_memory = aligned_malloc(size_of_eval, 32);
+		eval_assign(eval_memory);
+	}
+
+	// "EvalMmap"オプションが指定されていれば、評価関数ファイルをmapしてそのまま評価関数パラメーターとして用いる。
+	// ファイルの読み込み(コピー)をしないので、ファイルがpage cacheにあれば一瞬で終わる。
+	// mapしなかったときはfalseが返るので、普通に読み込むこと。
+	bool load_eval_mapped()
+	{
+		vector<void*> ptrs;
+		if (!map_eval_files({ KK_BIN, KKP_BIN, KPP_BIN }, { size_of_kk, size_of_kkp, size_of_kpp }, ptrs))
+			return false;
+
+		eval_free();
+#if defined (USE_SHARED_MEMORY_IN_EVAL) && !defined(_WIN32)
+		detach_shared_eval();
+#endif
+
+		kk_  = (ValueKk(*)[SQ_NB][SQ_NB]) ptrs[0];
+		kkp_ = (ValueKkp(*)[SQ_NB][SQ_NB][fe_end]) ptrs[1];
+		kpp_ = (ValueKpp(*)[SQ_NB][fe_end][fe_end]) ptrs[2];
+		return true;
 	}
 
 #if defined (USE_SHARED_MEMORY_IN_EVAL) && defined(_WIN32)
@@ -135,6 +178,10 @@ namespace Eval
 
 	void load_eval()
 	{
+		// 評価関数ファイルをmapして用いるなら、読み込む必要はない。
+		if (load_eval_mapped())
+			return;
+
 		// 評価関数を共有するのか
 		if (!(bool)Options["EvalShare"])
 		{
@@ -222,12 +269,58 @@ namespace Eval
 		// が必要であるが、1),2)がプロセスが解体されるときに自動でなされるので、この処理は特に入れない。
 	}
 
+#elif defined (USE_SHARED_MEMORY_IN_EVAL)
+	// Windows以外の環境では、POSIXのshared memoryを用いて評価関数を共有する。
+	// 名前の付け方やプロセス間の待ち合わせについては、eval/evaluate.cppのattach_shared_eval()を参照のこと。
+
+	void load_eval()
+	{
+		// 評価関数ファイルをmapして用いるなら、読み込む必要はない。
+		if (load_eval_mapped())
+			return;
+
+		// 前回shared memoryに読み込んでいたなら、その共有をやめておく。
+		detach_shared_eval();
+
+		// 評価関数を共有するのか
+		if (!(bool)Options["EvalShare"])
+		{
+			eval_malloc();
+			load_eval_impl();
+
+			// 共有されていないメモリを用いる。
+			sync_cout << "info string use non-shared eval_memory." << sync_endl;
+
+			return;
+		}
+
+		eval_free();
+
+		const u64 size_of_eval_ = size_of_eval;
+
+		// shared memoryを新規に作成したプロセスだけが評価関数ファイルを読み込む。
+		auto shared_eval_ptr = attach_shared_eval((size_t)size_of_eval_, "KPP_KKPT", [](void* ptr) { eval_assign(ptr); load_eval_impl(); });
+		if (shared_eval_ptr == nullptr)
+		{
+			// /dev/shmの空きが足りないときなど。共有されていないメモリに読み込む。
+			eval_malloc();
+			load_eval_impl();
+			sync_cout << "info string can't allocate shared eval memory. use non-shared eval_memory." << sync_endl;
+			return;
+		}
+		eval_assign(shared_eval_ptr);
+	}
+
 #else
 
 	// 評価関数のプロセス間共有を行わないときは、普通に
 	// load_eval_impl()を呼び出すだけで良い。
 	void load_eval()
 	{
+		// 評価関数ファイルをmapして用いるなら、読み込む必要はない。
+		if (load_eval_mapped())
+			return;
+
 		eval_malloc();
 		load_eval_impl();
 	}
@@ -237,6 +330,89 @@ namespace Eval
 	// KP,KPP,KKPのスケール
 	const int FV_SCALE = 32;
 
+#if defined(USE_CPU_DISPATCH)
+
+	// --- 実行時にCPUを判定して選ぶKPPの計算(USE_CPU_DISPATCH)
+
+	// 以下のAVX2化してある差分計算のKPPの和を求める部分だけ、ターゲットCPU用とAVX2用とを用意しておき、
+	// init()で実行中のCPUに合わせて関数ポインタで選ぶ。(KPPTのevaluate_kppt.cppと同様。どちらを選んでも計算結果は同じ)
+
+	// row[list[0]]～row[list[n-1]]の合計
+	typedef s32 (*KppRowSum)(const ValueKpp* row, const BonaPiece* list, int n);
+
+	// pp[list[i]][list[j]] (0 <= j < i < PIECE_NUMBER_KING)の合計。玉が移動したときに用いる。
+	typedef s32 (*KppTriangleSum)(const ValueKpp(*pp)[fe_end], const BonaPiece* list);
+
+	// ターゲットCPU(SSE4.2など)用
+	static s32 kpp_row_sum_generic(const ValueKpp* row, const BonaPiece* list, int n)
+	{
+		s32 sum = 0;
+		for (int j = 0; j < n; ++j)
+			sum += row[list[j]];
+		return sum;
+	}
+	static s32 kpp_triangle_sum_generic(const ValueKpp(*pp)[fe_end], const BonaPiece* list)
+	{
+		s32 sum = 0;
+		for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+			sum += kpp_row_sum_generic(pp[list[i]], list, i);
+		return sum;
+	}
+
+	// AVX2用
+	// row[list[0]]～row[list[n-1]]をgather命令で8個ずつまとめて取ってきて、sumに(laneごとに)加算する。
+	// ValueKppはs16なので、32bitとしてgatherしてから下位16bitを符号拡張する。
+	TARGET_AVX2 static FORCE_INLINE __m256i add_kpp_row_avx2(const ValueKpp* row, const BonaPiece* list, int n, __m256i sum)
+	{
+		const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i vn = _mm256_set1_epi32(n);
+
+		for (int j = 0; j < n; j += 8)
+		{
+			// j + lane < n のところだけ読み込む。(listの範囲外は読まない)
+			const __m256i mask = _mm256_cmpgt_epi32(vn, _mm256_add_epi32(_mm256_set1_epi32(j), lane));
+			const __m256i idx = _mm256_maskload_epi32(reinterpret_cast<const int*>(list + j), mask);
+			__m256i w = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(row), idx, mask, 2);
+			w = _mm256_srai_epi32(_mm256_slli_epi32(w, 16), 16);
+			sum = _mm256_add_epi32(sum, w);
+		}
+		return sum;
+	}
+
+	// 8つのs32の合計
+	TARGET_AVX2 static FORCE_INLINE s32 hsum_epi32_avx2(__m256i v)
+	{
+		__m128i t = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		t = _mm_add_epi32(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(1, 0, 3, 2)));
+		t = _mm_add_epi32(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(t);
+	}
+
+	TARGET_AVX2 static s32 kpp_row_sum_avx2(const ValueKpp* row, const BonaPiece* list, int n)
+	{
+		return hsum_epi32_avx2(add_kpp_row_avx2(row, list, n, _mm256_setzero_si256()));
+	}
+	TARGET_AVX2 static s32 kpp_triangle_sum_avx2(const ValueKpp(*pp)[fe_end], const BonaPiece* list)
+	{
+		__m256i sum = _mm256_setzero_si256();
+		for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+			sum = add_kpp_row_avx2(pp[list[i]], list, i, sum);
+		return hsum_epi32_avx2(sum);
+	}
+
+	// init()で設定する。
+	static KppRowSum      kpp_row_sum      = kpp_row_sum_generic;
+	static KppTriangleSum kpp_triangle_sum = kpp_triangle_sum_generic;
+
+	// 実行中のCPUで使える命令セット用のものを選ぶ。
+	static void select_kpp_kernel()
+	{
+		const bool avx2 = CpuInfo::detect() >= CpuInfo::LEVEL_AVX2;
+		kpp_row_sum      = avx2 ? kpp_row_sum_avx2      : kpp_row_sum_generic;
+		kpp_triangle_sum = avx2 ? kpp_triangle_sum_avx2 : kpp_triangle_sum_generic;
+	}
+#endif
+
 	// 評価関数。全計算。(駒割りは差分)
 	// 返し値は持たず、計算結果としてpos.state()->sumに値を代入する。
 	void compute_eval_impl(const Position& pos)
@@ -404,7 +580,10 @@ namespace Eval
 
         // NPSが約6.1%程度向上した
 
-#ifdef USE_AVX2
+#if defined(USE_CPU_DISPATCH)
+        sum.p[0][0] = kpp_row_sum(pkppb, list0, PIECE_NUMBER_KING);
+        sum.p[1][0] = kpp_row_sum(pkppw, list1, PIECE_NUMBER_KING);
+#elif defined(USE_AVX2)
         __m256i sum0 = _mm256_setzero_si256();
         __m256i sum1 = _mm256_setzero_si256();
         int i = 0;
@@ -545,7 +724,18 @@ namespace Eval
 				diff.p[1][0] = 0;
 				diff.p[1][1] = 0;
 
-#ifdef USE_AVX2
+#if defined(USE_CPU_DISPATCH)
+				diff.p[1][0] = kpp_triangle_sum(ppkppw, list1);
+
+				for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+				{
+					const int k1 = list1[i];
+
+					// KKPのWK分。(以下と同じ)
+					diff.p[2][0] -= kkp[Inv(sq_wk)][Inv(sq_bk)][k1][0];
+					diff.p[2][1] += kkp[Inv(sq_wk)][Inv(sq_bk)][k1][1];
+				}
+#elif defined(USE_AVX2)
                 __m256i sum1_256 = _mm256_setzero_si256();
                 __m128i sum1_128 = _mm_setzero_si128();
 
@@ -629,7 +819,13 @@ namespace Eval
 				diff.p[0][0] = 0;
 				diff.p[0][1] = 0;
 
-#ifdef USE_AVX2
+#if defined(USE_CPU_DISPATCH)
+				diff.p[0][0] = kpp_triangle_sum(ppkppb, list0);
+
+				// KKP
+				for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+					diff.p[2] += kkp[sq_bk][sq_wk][list0[i]];
+#elif defined(USE_AVX2)
                 __m256i sum0_256 = _mm256_setzero_si256();
                 __m128i sum0_128 = _mm_setzero_si128();
 
@@ -781,6 +977,7 @@ namespace Eval
 		//		cout << "EvalSum " << hex << g_evalTable[keyExcludeTurn] << endl;
 		EvalSum entry = *g_evalTable[keyExcludeTurn];   // atomic にデータを取得する必要がある。
 		entry.decode();
+		count_evalhash(pos, entry.key == keyExcludeTurn, entry.key != 0);
 		if (entry.key == keyExcludeTurn)
 		{
 			//	dbg_hit_on(true);
@@ -242,6 +242,52 @@ namespace Eval
 		// が必要であるが、1),2)がプロセスが解体されるときに自動でなされるので、この処理は特に入れない。
 	}
 
+#elif defined (USE_SHARED_MEMORY_IN_EVAL)
+	// Windows以外の環境では、POSIXのshared memoryを用いて評価関数を共有する。
+	// 名前の付け方やプロセス間の待ち合わせについては、eval/evaluate.cppのattach_shared_eval()を参照のこと。
+
+	void load_eval()
+	{
+		// 前回shared memoryに読み込んでいたなら、eval_malloc()でaligned_free()されないようにしておく。
+		if (detach_shared_eval())
+			kk_ = nullptr;
+
+		// 評価関数を共有するのか
+		if (!(bool)Options["EvalShare"])
+		{
+			eval_malloc();
+			load_eval_impl();
+
+			// 共有されていないメモリを用いる。
+			sync_cout << "info string use non-shared eval_memory." << sync_endl;
+
+			return;
+		}
+
+		if (kk_ != nullptr)
+		{
+			aligned_free((void*)kk_);
+			kk_ = nullptr;
+		}
+
+		u64 size_of_eval_ = size_of_eval;
+#if KPPP_NULL_KING_SQ == 1
+		size_of_eval_ += kppp_triangle_fe_end * sizeof(ValueKppp);
+#endif
+
+		// shared memoryを新規に作成したプロセスだけが評価関数ファイルを読み込む。
+		auto shared_eval_ptr = attach_shared_eval((size_t)size_of_eval_, "KPPP_KKPT", [](void* ptr) { eval_assign(ptr); load_eval_impl(); });
+		if (shared_eval_ptr == nullptr)
+		{
+			// /dev/shmの空きが足りないときなど。共有されていないメモリに読み込む。
+			eval_malloc();
+			load_eval_impl();
+			sync_cout << "info string can't allocate shared eval memory. use non-shared eval_memory." << sync_endl;
+			return;
+		}
+		eval_assign(shared_eval_ptr);
+	}
+
 #else
 
 	// 評価関数のプロセス間共有を行わないときは、普通に
@@ -1042,6 +1088,7 @@ namespace Eval
 		//		cout << "EvalSum " << hex << g_evalTable[keyExcludeTurn] << endl;
 		EvalSum entry = *g_evalTable[keyExcludeTurn];   // atomic にデータを取得する必要がある。
 		entry.decode();
+		count_evalhash(pos, entry.key == keyExcludeTurn, entry.key != 0);
 		if (entry.key == keyExcludeTurn)
 		{
 			//	dbg_hit_on(true);
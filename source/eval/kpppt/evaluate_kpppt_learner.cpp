@@ -84,6 +84,10 @@ namespace Eval
 	// 手番ありに変更するかも知れないので、配列をkppと分けておく。
 	std::vector<Weight2> weights_kppp;
 
+	// 前回のupdate_weights()以降に勾配が加算されたindex(直列化したindex)の記録
+	// update_weights()では、ここに記録されているindexだけを処理する。
+	GradDirtyMap grad_dirty;
+
 	// 学習のときの勾配配列の初期化
 	// 引数のetaは、AdaGradのときの定数η(eta)。
 	void init_grad(double eta1, u64 eta1_epoch, double eta2, u64 eta2_epoch, double eta3)
@@ -119,6 +123,9 @@ namespace Eval
 		weights_kppp.resize(size_kppp);
 		memset(&weights_kppp[0], 0, sizeof(Weight2) * weights_kppp.size());
 
+		// 勾配が加算されたindexの記録用
+		grad_dirty.resize(g_kppp.max_index());
+
 		// 学習率の設定
 		Weight::init_eta(eta1, eta2, eta3, eta1_epoch, eta2_epoch);
 
@@ -155,6 +162,11 @@ namespace Eval
 		// 180度盤面を回転させた位置関係に対する勾配
 		std::array<LearnFloatType,2> g_flip = { -g[0] , g[1] };
 
+		// 勾配を加算して、そのindexをgrad_dirtyに記録する。
+		auto add_weight = [&](const auto& x, const auto& g_) { u64 index = x.toIndex(); weights[index].add_grad(g_); grad_dirty.set(index); };
+		auto add_weight_kpp = [&](const auto& x, const auto& g_) { weights_kpp[x.toRawIndex()].add_grad(g_); grad_dirty.set(x.toIndex()); };
+		auto add_weight_kppp = [&](const auto& x, const auto& g_) { weights_kppp[x.toRawIndex()].add_grad(g_); grad_dirty.set(x.toIndex()); };
+
 		Square sq_bk = pos.king_square(BLACK);
 		Square sq_wk = pos.king_square(WHITE);
 		Square inv_sq_wk = Inv(sq_wk);
@@ -249,7 +261,7 @@ namespace Eval
 		BonaPiece k0, k1, l0, l1, m0, m1;
 
 		// KK
-		weights[KK(sq_bk,sq_wk).toIndex()].add_grad(g);
+		add_weight(KK(sq_bk,sq_wk), g);
 
 		// KPPPは、Kが対象範囲にないと適用できないので、
 		// case 0. KPPPなし
@@ -276,8 +288,8 @@ namespace Eval
 
 				if (!freeze_kpp)
 				{
-					weights_kpp[KPP(sq_bk    , k0, l0).toRawIndex()].add_grad(g);
-					weights_kpp[KPP(inv_sq_wk, k1, l1).toRawIndex()].add_grad(g_flip);
+					add_weight_kpp(KPP(sq_bk    , k0, l0), g);
+					add_weight_kpp(KPP(inv_sq_wk, k1, l1), g_flip);
 				}
 
 				// KPPP
@@ -289,7 +301,7 @@ namespace Eval
 					for (k = 0; k < j; ++k)
 					{
 						m0 = list_fb[k];
-						weights_kppp[g_kppp.fromKPPP((int)sq_bk_for_kppp, k0, l0, m0).toRawIndex()].add_grad(g);
+						add_weight_kppp(g_kppp.fromKPPP((int)sq_bk_for_kppp, k0, l0, m0), g);
 					}
 					break;
 				case 2:
@@ -297,7 +309,7 @@ namespace Eval
 					for (k = 0; k < j; ++k)
 					{
 						m1 = list_fw[k];
-						weights_kppp[g_kppp.fromKPPP((int)sq_wk_for_kppp, k1, l1, m1).toRawIndex()].add_grad(g_flip);
+						add_weight_kppp(g_kppp.fromKPPP((int)sq_wk_for_kppp, k1, l1, m1), g_flip);
 					}
 					break;
 				case 3:
@@ -307,15 +319,15 @@ namespace Eval
 						m0 = list_fb[k];
 						m1 = list_fw[k];
 
-						weights_kppp[g_kppp.fromKPPP((int)sq_bk_for_kppp, k0, l0, m0).toRawIndex()].add_grad(g);
-						weights_kppp[g_kppp.fromKPPP((int)sq_wk_for_kppp, k1, l1, m1).toRawIndex()].add_grad(g_flip);
+						add_weight_kppp(g_kppp.fromKPPP((int)sq_bk_for_kppp, k0, l0, m0), g);
+						add_weight_kppp(g_kppp.fromKPPP((int)sq_wk_for_kppp, k1, l1, m1), g_flip);
 					}
 					break;
 				}
 			}
 
 			// KKP
-			weights[KKP(sq_bk, sq_wk, k0).toIndex()].add_grad(g);
+			add_weight(KKP(sq_bk, sq_wk, k0), g);
 		}
 	}
 
@@ -335,6 +347,10 @@ namespace Eval
 		const bool freeze_kpp = freeze[2];
 		const bool freeze_kppp = freeze[3];
 			
+		// 勾配が加算されたindexの記録を取り出す。
+		// これ以降に(async_updateで)加算された勾配は、次回のupdate_weights()で処理される。
+		grad_dirty.swap();
+
 		// epochに応じたetaを設定してやる。
 		Weight::calc_eta(epoch);
 
@@ -353,12 +369,18 @@ namespace Eval
 			WinProcGroup::bindThisThread(thread_index);
 #endif
 
-#pragma omp for schedule(dynamic,20000)
-			for (s64 index_ = 0; index_ < (s64)vector_length; ++index_)
+#pragma omp for schedule(dynamic,64)
+			for (s64 word_ = 0; word_ < (s64)grad_dirty.word_count(); ++word_)
+			for (u64 bits = grad_dirty.word((u64)word_); bits; )
 			{
 				// OpenMPではループ変数は符号型変数でなければならないが
 				// さすがに使いにくい。
-				u64 index = (u64)index_;
+				u64 index = (u64)word_ * 64 + pop_lsb(bits);
+
+				// 前回のupdate_weights()以降に勾配が加算されたindexだけを処理する。
+				// 次元下げしたもののうち、処理すべきindex(min_index_flagが立っているほう)に変換する。
+				if (!grad_dirty.to_update_index(index) || index >= vector_length)
+					continue;
 
 				// 自分が更新すべきやつか？
 				// 次元下げしたときのindexの小さいほうが自分でないならこの更新は行わない。
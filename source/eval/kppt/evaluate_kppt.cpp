@@ -24,6 +24,10 @@
 #include "../../misc.h"
 #include "../../extra/bitop.h"
 
+#if defined(USE_CPU_DISPATCH)
+#include "../../extra/cpu_info.h"
+#endif
+
 // 実験中の評価関数を読み込む。(現状非公開)
 #if defined (EVAL_EXPERIMENTAL)
 #include "../experimental/evaluate_experimental.h"
@@ -157,10 +161,18 @@ namespace Eval
 		return sum;
 	}
 
+#if defined(USE_CPU_DISPATCH)
+	// KPPの計算に用いる命令セットを選ぶ。(後述)
+	static void select_kpp_kernel();
+#endif
+
 	void init()
 	{
 #if defined(EVAL_EXPERIMENTAL)
 		init_eval_experimental();
+#endif
+#if defined(USE_CPU_DISPATCH)
+		select_kpp_kernel();
 #endif
 	}
 
@@ -173,19 +185,50 @@ namespace Eval
 		kpp_ = (ValueKpp(*)[SQ_NB][fe_end][fe_end]) (p + size_of_kk + size_of_kkp);
 	}
 
+	// eval_malloc()で確保したメモリ。
+	// 評価関数パラメーターはshared memoryやmapしたファイル上にあることもあるので、kk_とは別に保持しておく。
+	void* eval_memory = nullptr;
+
+	// eval_malloc()で確保したメモリを解放する。
+	void eval_free()
+	{
+		if (eval_memory != nullptr)
+		{
+			aligned_free(eval_memory);
+			eval_memory = nullptr;
+		}
+	}
+
 	void eval_malloc()
 	{
 		// benchコマンドなどでOptionsを保存して復元するのでこのときEvalDirが変更されたことになって、
 		// 評価関数の再読込の必要があるというフラグを立てるため、この関数は2度呼び出されることがある。
-		if (kk_ != nullptr)
-		{
-			aligned_free((void*)kk_);
-			kk_ = nullptr;
-		}
+		eval_free();
 
 		// メモリ確保は一回にして、連続性のある確保にする。
 		// このメモリは、プロセス終了のときに自動開放されることを期待している。
-		eval_assign(aligned_malloc(size_of_eval, 32));
+		eval_memory = aligned_malloc(size_of_eval, 32);
+		eval_assign(eval_memory);
+	}
+
+	// "EvalMmap"オプションが指定されていれば、評価関数ファイルをmapしてそのまま評価関数パラメーターとして用いる。
+	// ファイルの読み込み(コピー)をしないので、ファイルがpage cacheにあれば一瞬で終わる。
+	// mapしなかったときはfalseが返るので、普通に読み込むこと。
+	bool load_eval_mapped()
+	{
+		vector<void*> ptrs;
+		if (!map_eval_files({ KK_BIN, KKP_BIN, KPP_BIN }, { size_of_kk, size_of_kkp, size_of_kpp }, ptrs))
+			return false;
+
+		eval_free();
+#if defined (USE_SHARED_MEMORY_IN_EVAL) && !defined(_WIN32)
+		detach_shared_eval();
+#endif
+
+		kk_  = (ValueKk(*)[SQ_NB][SQ_NB]) ptrs[0];
+		kkp_ = (ValueKkp(*)[SQ_NB][SQ_NB][fe_end]) ptrs[1];
+		kpp_ = (ValueKpp(*)[SQ_NB][fe_end][fe_end]) ptrs[2];
+		return true;
 	}
 
 #if defined (USE_SHARED_MEMORY_IN_EVAL) && defined(_WIN32)
@@ -194,6 +237,10 @@ namespace Eval
 
 	void load_eval()
 	{
+		// 評価関数ファイルをmapして用いるなら、読み込む必要はない。
+		if (load_eval_mapped())
+			return;
+
 		// 評価関数を共有するのか
 		if (!(bool)Options["EvalShare"])
 		{
@@ -281,12 +328,58 @@ namespace Eval
 		// が必要であるが、1),2)がプロセスが解体されるときに自動でなされるので、この処理は特に入れない。
 	}
 
+#elif defined (USE_SHARED_MEMORY_IN_EVAL)
+	// Windows以外の環境では、POSIXのshared memoryを用いて評価関数を共有する。
+	// 名前の付け方やプロセス間の待ち合わせについては、eval/evaluate.cppのattach_shared_eval()を参照のこと。
+
+	void load_eval()
+	{
+		// 評価関数ファイルをmapして用いるなら、読み込む必要はない。
+		if (load_eval_mapped())
+			return;
+
+		// 前回shared memoryに読み込んでいたなら、その共有をやめておく。
+		detach_shared_eval();
+
+		// 評価関数を共有するのか
+		if (!(bool)Options["EvalShare"])
+		{
+			eval_malloc();
+			load_eval_impl();
+
+			// 共有されていないメモリを用いる。
+			sync_cout << "info string use non-shared eval_memory." << sync_endl;
+
+			return;
+		}
+
+		eval_free();
+
+		const u64 size_of_eval_ = size_of_eval;
+
+		// shared memoryを新規に作成したプロセスだけが評価関数ファイルを読み込む。
+		auto shared_eval_ptr = attach_shared_eval((size_t)size_of_eval_, "KPPT", [](void* ptr) { eval_assign(ptr); load_eval_impl(); });
+		if (shared_eval_ptr == nullptr)
+		{
+			// /dev/shmの空きが足りないときなど。共有されていないメモリに読み込む。
+			eval_malloc();
+			load_eval_impl();
+			sync_cout << "info string can't allocate shared eval memory. use non-shared eval_memory." << sync_endl;
+			return;
+		}
+		eval_assign(shared_eval_ptr);
+	}
+
 #else
 
 	// 評価関数のプロセス間共有を行わないときは、普通に
 	// load_eval_impl()を呼び出すだけで良い。
 	void load_eval()
 	{
+		// 評価関数ファイルをmapして用いるなら、読み込む必要はない。
+		if (load_eval_mapped())
+			return;
+
 		eval_malloc();
 		load_eval_impl();
 	}
@@ -296,6 +389,192 @@ namespace Eval
 	// KP,KPP,KKPのスケール
 	const int FV_SCALE = 32;
 
+#if defined(USE_AVX512) || defined(USE_CPU_DISPATCH)
+	// row[list[0]]～row[list[n-1]]を、AVX-512のgather命令で16個ずつまとめて取ってきて
+	// 手番なしの値をsum0に、手番ありの値をsum1に(laneごとに)加算する。
+	// ValueKppはs16が2つで4バイトなので、1要素を32bitとしてgatherしてから分解する。
+	// 端数はmaskで処理するので、listのn個目以降は読まない。
+	TARGET_AVX512 static FORCE_INLINE void add_kpp_row_avx512(const ValueKpp* row, const BonaPiece* list, int n, __m512i& sum0, __m512i& sum1)
+	{
+		// s16の組に対する積和で、下位16bit(手番なし)と上位16bit(手番あり)をそれぞれs32に符号拡張して取り出すための係数
+		const __m512i mul_lo = _mm512_set1_epi32(0x00000001);
+		const __m512i mul_hi = _mm512_set1_epi32(0x00010000);
+
+		for (int j = 0; j < n; j += 16)
+		{
+			const __mmask16 mask = (n - j >= 16) ? (__mmask16)0xffff : (__mmask16)((1U << (n - j)) - 1);
+			const __m512i idx = _mm512_maskz_loadu_epi32(mask, list + j);
+			const __m512i v = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, idx, row, 4);
+			sum0 = _mm512_add_epi32(sum0, _mm512_madd_epi16(v, mul_lo));
+			sum1 = _mm512_add_epi32(sum1, _mm512_madd_epi16(v, mul_hi));
+		}
+	}
+
+#if defined(USE_AVX512VNNI) || defined(USE_CPU_DISPATCH)
+	// add_kpp_row_avx512()と同じ。vpdpwssdで積和と加算を1命令で行なう。(AVX-512 VNNI)
+	TARGET_AVX512VNNI static FORCE_INLINE void add_kpp_row_avx512vnni(const ValueKpp* row, const BonaPiece* list, int n, __m512i& sum0, __m512i& sum1)
+	{
+		const __m512i mul_lo = _mm512_set1_epi32(0x00000001);
+		const __m512i mul_hi = _mm512_set1_epi32(0x00010000);
+
+		for (int j = 0; j < n; j += 16)
+		{
+			const __mmask16 mask = (n - j >= 16) ? (__mmask16)0xffff : (__mmask16)((1U << (n - j)) - 1);
+			const __m512i idx = _mm512_maskz_loadu_epi32(mask, list + j);
+			const __m512i v = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, idx, row, 4);
+			sum0 = _mm512_dpwssd_epi32(sum0, v, mul_lo);
+			sum1 = _mm512_dpwssd_epi32(sum1, v, mul_hi);
+		}
+	}
+#endif
+
+	// 16個のs32の合計
+	TARGET_AVX512 static FORCE_INLINE s32 hsum_epi32(__m512i v) { return _mm512_reduce_add_epi32(v); }
+#endif
+
+#if defined(USE_AVX2) || defined(USE_CPU_DISPATCH)
+	// row[list[0]]～row[list[n-1]]を、AVX2のgather命令で8個ずつまとめて取ってきて
+	// 手番なしの値をsum0に、手番ありの値をsum1に(laneごとに)加算する。
+	// ValueKppはs16が2つで4バイトなので、1要素を32bitとしてgatherしてから分解する。
+	TARGET_AVX2 static FORCE_INLINE void add_kpp_row_avx2(const ValueKpp* row, const BonaPiece* list, int n, __m256i& sum0, __m256i& sum1)
+	{
+		const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i vn = _mm256_set1_epi32(n);
+
+		// s16の組に対するmaddで、下位16bit(手番なし)と上位16bit(手番あり)をそれぞれs32に符号拡張して取り出すための係数
+		const __m256i mul_lo = _mm256_set1_epi32(0x00000001);
+		const __m256i mul_hi = _mm256_set1_epi32(0x00010000);
+
+		for (int j = 0; j < n; j += 8)
+		{
+			// j + lane < n のところだけ読み込む。(listの範囲外は読まない)
+			const __m256i mask = _mm256_cmpgt_epi32(vn, _mm256_add_epi32(_mm256_set1_epi32(j), lane));
+			const __m256i idx = _mm256_maskload_epi32(reinterpret_cast<const int*>(list + j), mask);
+			const __m256i v = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(row), idx, mask, 4);
+			sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(v, mul_lo));
+			sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(v, mul_hi));
+		}
+	}
+
+	// 8つのs32の合計
+	TARGET_AVX2 static FORCE_INLINE s32 hsum_epi32(__m256i v)
+	{
+		__m128i t = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		t = _mm_add_epi32(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(1, 0, 3, 2)));
+		t = _mm_add_epi32(t, _mm_shuffle_epi32(t, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(t);
+	}
+#endif
+
+#if defined(USE_CPU_DISPATCH)
+
+	// --- 実行時にCPUを判定して選ぶKPPの計算(USE_CPU_DISPATCH)
+
+	// KPPの和を求める部分だけ命令セットごとに用意しておき、init()で実行中のCPUに合わせて関数ポインタで選ぶ。
+	// どれを選んでも計算結果は同じ。(KKPは呼び出し側で先手から見て計算するので、これも命令セットによらない)
+
+	// row[list[0]]～row[list[n-1]]の合計
+	typedef std::array<s32, 2> (*KppRowSum)(const ValueKpp* row, const BonaPiece* list, int n);
+
+	// pp[list[i]][list[j]] (0 <= j < i < PIECE_NUMBER_KING)の合計。全計算と玉が移動したときに用いる。
+	typedef std::array<s32, 2> (*KppTriangleSum)(const ValueKpp(*pp)[fe_end], const BonaPiece* list);
+
+	// ターゲットCPU(SSE4.2など)用
+	static std::array<s32, 2> kpp_row_sum_generic(const ValueKpp* row, const BonaPiece* list, int n)
+	{
+		std::array<s32, 2> sum = { { 0, 0 } };
+		for (int j = 0; j < n; ++j)
+			sum += row[list[j]];
+		return sum;
+	}
+	static std::array<s32, 2> kpp_triangle_sum_generic(const ValueKpp(*pp)[fe_end], const BonaPiece* list)
+	{
+		std::array<s32, 2> sum = { { 0, 0 } };
+		for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+			sum += kpp_row_sum_generic(pp[list[i]], list, i);
+		return sum;
+	}
+
+	// AVX2用
+	TARGET_AVX2 static std::array<s32, 2> kpp_row_sum_avx2(const ValueKpp* row, const BonaPiece* list, int n)
+	{
+		__m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+		add_kpp_row_avx2(row, list, n, sum0, sum1);
+		return std::array<s32, 2> { { hsum_epi32(sum0), hsum_epi32(sum1) } };
+	}
+	TARGET_AVX2 static std::array<s32, 2> kpp_triangle_sum_avx2(const ValueKpp(*pp)[fe_end], const BonaPiece* list)
+	{
+		__m256i sum0 = _mm256_setzero_si256(), sum1 = _mm256_setzero_si256();
+		for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+			add_kpp_row_avx2(pp[list[i]], list, i, sum0, sum1);
+		return std::array<s32, 2> { { hsum_epi32(sum0), hsum_epi32(sum1) } };
+	}
+
+	// AVX-512用
+	TARGET_AVX512 static std::array<s32, 2> kpp_row_sum_avx512(const ValueKpp* row, const BonaPiece* list, int n)
+	{
+		__m512i sum0 = _mm512_setzero_si512(), sum1 = _mm512_setzero_si512();
+		add_kpp_row_avx512(row, list, n, sum0, sum1);
+		return std::array<s32, 2> { { hsum_epi32(sum0), hsum_epi32(sum1) } };
+	}
+	TARGET_AVX512 static std::array<s32, 2> kpp_triangle_sum_avx512(const ValueKpp(*pp)[fe_end], const BonaPiece* list)
+	{
+		__m512i sum0 = _mm512_setzero_si512(), sum1 = _mm512_setzero_si512();
+		for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+			add_kpp_row_avx512(pp[list[i]], list, i, sum0, sum1);
+		return std::array<s32, 2> { { hsum_epi32(sum0), hsum_epi32(sum1) } };
+	}
+
+	// AVX-512 VNNI用
+	TARGET_AVX512VNNI static std::array<s32, 2> kpp_row_sum_avx512vnni(const ValueKpp* row, const BonaPiece* list, int n)
+	{
+		__m512i sum0 = _mm512_setzero_si512(), sum1 = _mm512_setzero_si512();
+		add_kpp_row_avx512vnni(row, list, n, sum0, sum1);
+		return std::array<s32, 2> { { hsum_epi32(sum0), hsum_epi32(sum1) } };
+	}
+	TARGET_AVX512VNNI static std::array<s32, 2> kpp_triangle_sum_avx512vnni(const ValueKpp(*pp)[fe_end], const BonaPiece* list)
+	{
+		__m512i sum0 = _mm512_setzero_si512(), sum1 = _mm512_setzero_si512();
+		for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+			add_kpp_row_avx512vnni(pp[list[i]], list, i, sum0, sum1);
+		return std::array<s32, 2> { { hsum_epi32(sum0), hsum_epi32(sum1) } };
+	}
+
+	// init()で設定する。
+	static KppRowSum      kpp_row_sum      = kpp_row_sum_generic;
+	static KppTriangleSum kpp_triangle_sum = kpp_triangle_sum_generic;
+
+	// 実行中のCPUで使える最上位の命令セット用のものを選ぶ。
+	static void select_kpp_kernel()
+	{
+		switch (CpuInfo::detect())
+		{
+		case CpuInfo::LEVEL_AVX512VNNI:
+			kpp_row_sum = kpp_row_sum_avx512vnni; kpp_triangle_sum = kpp_triangle_sum_avx512vnni; break;
+		case CpuInfo::LEVEL_AVX512:
+			kpp_row_sum = kpp_row_sum_avx512;     kpp_triangle_sum = kpp_triangle_sum_avx512;     break;
+		case CpuInfo::LEVEL_AVX2:
+			kpp_row_sum = kpp_row_sum_avx2;       kpp_triangle_sum = kpp_triangle_sum_avx2;       break;
+		default:
+			kpp_row_sum = kpp_row_sum_generic;    kpp_triangle_sum = kpp_triangle_sum_generic;    break;
+		}
+	}
+
+#elif defined(USE_AVX512VNNI)
+	// 以下の全計算と差分計算では、buildのターゲットCPU用のものを用いる。
+	typedef __m512i KppSumVec;
+	static FORCE_INLINE KppSumVec kpp_sum_zero() { return _mm512_setzero_si512(); }
+	static FORCE_INLINE void add_kpp_row(const ValueKpp* row, const BonaPiece* list, int n, __m512i& sum0, __m512i& sum1) { add_kpp_row_avx512vnni(row, list, n, sum0, sum1); }
+#elif defined(USE_AVX512)
+	typedef __m512i KppSumVec;
+	static FORCE_INLINE KppSumVec kpp_sum_zero() { return _mm512_setzero_si512(); }
+	static FORCE_INLINE void add_kpp_row(const ValueKpp* row, const BonaPiece* list, int n, __m512i& sum0, __m512i& sum1) { add_kpp_row_avx512(row, list, n, sum0, sum1); }
+#elif defined(USE_AVX2)
+	typedef __m256i KppSumVec;
+	static FORCE_INLINE KppSumVec kpp_sum_zero() { return _mm256_setzero_si256(); }
+	static FORCE_INLINE void add_kpp_row(const ValueKpp* row, const BonaPiece* list, int n, __m256i& sum0, __m256i& sum1) { add_kpp_row_avx2(row, list, n, sum0, sum1); }
+#endif
+
 	// 評価関数。全計算。(駒割りは差分)
 	// 返し値は持たず、計算結果としてpos.state()->sumに値を代入する。
 	void compute_eval_impl(const Position& pos)
@@ -335,8 +614,8 @@ namespace Eval
 
 #endif
 
-		int i, j;
-		BonaPiece k0, k1, l0, l1;
+		int i;
+		BonaPiece k0, k1;
 
 		// 評価値の合計
 		EvalSum sum;
@@ -352,16 +631,45 @@ namespace Eval
 		// KK
 		sum.p[2] = kk[sq_bk][sq_wk];
 
+#if defined(USE_CPU_DISPATCH)
+		// 実行時に選んだ命令セットによる実装
+		sum.p[0] = kpp_triangle_sum(ppkppb, list_fb);
+		sum.p[1] = kpp_triangle_sum(ppkppw, list_fw);
+
+		// KKP
+		for (i = 0; i < PIECE_NUMBER_KING; ++i)
+			sum.p[2] += kkp[sq_bk][sq_wk][list_fb[i]];
+#elif defined(USE_AVX2)
+		// AVX2/AVX-512による実装
+		KppSumVec sum_b0, sum_b1, sum_w0, sum_w1;
+		sum_b0 = sum_b1 = sum_w0 = sum_w1 = kpp_sum_zero();
+
+		for (i = 0; i < PIECE_NUMBER_KING; ++i)
+		{
+			k0 = list_fb[i];
+			k1 = list_fw[i];
+			add_kpp_row(ppkppb[k0], list_fb, i, sum_b0, sum_b1);
+			add_kpp_row(ppkppw[k1], list_fw, i, sum_w0, sum_w1);
+
+			// KKP
+			sum.p[2] += kkp[sq_bk][sq_wk][k0];
+		}
+
+		sum.p[0][0] = hsum_epi32(sum_b0);
+		sum.p[0][1] = hsum_epi32(sum_b1);
+		sum.p[1][0] = hsum_epi32(sum_w0);
+		sum.p[1][1] = hsum_epi32(sum_w1);
+#else
 		for (i = 0; i < PIECE_NUMBER_KING; ++i)
 		{
 			k0 = list_fb[i];
 			k1 = list_fw[i];
 			const auto* pkppb = ppkppb[k0];
 			const auto* pkppw = ppkppw[k1];
-			for (j = 0; j < i; ++j)
+			for (int j = 0; j < i; ++j)
 			{
-				l0 = list_fb[j];
-				l1 = list_fw[j];
+				BonaPiece l0 = list_fb[j];
+				BonaPiece l1 = list_fw[j];
 
 				// KPP
 #if defined(USE_SSE41)
@@ -382,6 +690,7 @@ namespace Eval
 			// KKP
 			sum.p[2] += kkp[sq_bk][sq_wk][k0];
 		}
+#endif
 
 		auto st = pos.state();
 		sum.p[2][0] += st->materialValue * FV_SCALE;
@@ -405,12 +714,20 @@ namespace Eval
 		const auto* list0 = pos.eval_list()->piece_list_fb();
 
 		const auto* pkppb = kpp[sq_bk][ebp.fb];
+#if defined(USE_CPU_DISPATCH)
+		return kpp_row_sum(pkppb, list0, PIECE_NUMBER_KING);
+#elif defined(USE_AVX2)
+		KppSumVec sum0 = kpp_sum_zero(), sum1 = kpp_sum_zero();
+		add_kpp_row(pkppb, list0, PIECE_NUMBER_KING, sum0, sum1);
+		return std::array<s32, 2> { { hsum_epi32(sum0), hsum_epi32(sum1) } };
+#else
 		std::array<s32, 2> sum = { { pkppb[list0[0]][0], pkppb[list0[0]][1] } };
 		for (int i = 1; i < PIECE_NUMBER_KING; ++i) {
 			sum[0] += pkppb[list0[i]][0];
 			sum[1] += pkppb[list0[i]][1];
 		}
 		return sum;
+#endif
 	}
 
 	// 先手玉が移動したときの後手玉に対する差分
@@ -419,12 +736,20 @@ namespace Eval
 		const auto* list1 = pos.eval_list()->piece_list_fw();
 
 		const auto* pkppw = kpp[Inv(sq_wk)][ebp.fw];
+#if defined(USE_CPU_DISPATCH)
+		return kpp_row_sum(pkppw, list1, PIECE_NUMBER_KING);
+#elif defined(USE_AVX2)
+		KppSumVec sum0 = kpp_sum_zero(), sum1 = kpp_sum_zero();
+		add_kpp_row(pkppw, list1, PIECE_NUMBER_KING, sum0, sum1);
+		return std::array<s32, 2> { { hsum_epi32(sum0), hsum_epi32(sum1) } };
+#else
 		std::array<s32, 2> sum = { { pkppw[list1[0]][0], pkppw[list1[0]][1] } };
 		for (int i = 1; i < PIECE_NUMBER_KING; ++i) {
 			sum[0] += pkppw[list1[i]][0];
 			sum[1] += pkppw[list1[i]][1];
 		}
 		return sum;
+#endif
 	}
 
 	// 玉以外の駒が移動したときの差分
@@ -456,10 +781,22 @@ namespace Eval
 		const auto* pkppb = kpp[sq_bk     ][ebp.fb];
 		const auto* pkppw = kpp[Inv(sq_wk)][ebp.fw];
 
-		// ここ、AVX512なら、_mm512_i32gather_epi32()が使える。
-		// 気が向いたらコード書く。
+#if defined (USE_CPU_DISPATCH)
+
+		sum.p[0] = kpp_row_sum(pkppb, list0, PIECE_NUMBER_KING);
+		sum.p[1] = kpp_row_sum(pkppw, list1, PIECE_NUMBER_KING);
 
-#if defined (USE_AVX2)
+#elif defined (USE_AVX512)
+
+		KppSumVec sum_b0 = kpp_sum_zero(), sum_b1 = kpp_sum_zero(), sum_w0 = kpp_sum_zero(), sum_w1 = kpp_sum_zero();
+		add_kpp_row(pkppb, list0, PIECE_NUMBER_KING, sum_b0, sum_b1);
+		add_kpp_row(pkppw, list1, PIECE_NUMBER_KING, sum_w0, sum_w1);
+		sum.p[0][0] = hsum_epi32(sum_b0);
+		sum.p[0][1] = hsum_epi32(sum_b1);
+		sum.p[1][0] = hsum_epi32(sum_w0);
+		sum.p[1][1] = hsum_epi32(sum_w1);
+
+#elif defined (USE_AVX2)
 		
 		__m256i zero = _mm256_setzero_si256();
 		__m256i sum0 = zero;
@@ -619,7 +956,26 @@ namespace Eval
 				diff.p[1][0] = 0;
 				diff.p[1][1] = 0;
 
-#if defined(USE_AVX2)
+#if defined(USE_CPU_DISPATCH)
+
+				// KKPは先手から見た計算でやる。(AVX2の場合のコメント参照)
+				for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+					diff.p[2] += kkp[sq_bk][sq_wk][list0[i]];
+				diff.p[1] = kpp_triangle_sum(ppkppw, list1);
+
+#elif defined(USE_AVX512)
+
+				KppSumVec sum0 = kpp_sum_zero(), sum1 = kpp_sum_zero();
+				for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+				{
+					// KKPは先手から見た計算でやる。(AVX2の場合のコメント参照)
+					diff.p[2] += kkp[sq_bk][sq_wk][list0[i]];
+					add_kpp_row(ppkppw[list1[i]], list1, i, sum0, sum1);
+				}
+				diff.p[1][0] = hsum_epi32(sum0);
+				diff.p[1][1] = hsum_epi32(sum1);
+
+#elif defined(USE_AVX2)
 				
 				__m256i zero = _mm256_setzero_si256();
 				__m256i diffp1 = zero;
@@ -717,7 +1073,28 @@ namespace Eval
 				diff.p[0][0] = 0;
 				diff.p[0][1] = 0;
 
-#if defined(USE_AVX2)
+#if defined(USE_CPU_DISPATCH)
+
+				// KKP
+				for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+					diff.p[2] += kkp[sq_bk][sq_wk][list0[i]];
+				diff.p[0] = kpp_triangle_sum(ppkppb, list0);
+
+#elif defined(USE_AVX512)
+
+				KppSumVec sum0 = kpp_sum_zero(), sum1 = kpp_sum_zero();
+				for (int i = 0; i < PIECE_NUMBER_KING; ++i)
+				{
+					const int k0 = list0[i];
+
+					// KKP
+					diff.p[2] += kkp[sq_bk][sq_wk][k0];
+					add_kpp_row(ppkppb[k0], list0, i, sum0, sum1);
+				}
+				diff.p[0][0] = hsum_epi32(sum0);
+				diff.p[0][1] = hsum_epi32(sum1);
+
+#elif defined(USE_AVX2)
 
 				__m256i zero = _mm256_setzero_si256();
 				__m256i diffp0 = zero;
@@ -886,6 +1263,7 @@ namespace Eval
 		//		cout << "EvalSum " << hex << g_evalTable[keyExcludeTurn] << endl;
 		EvalSum entry = *g_evalTable[keyExcludeTurn];   // atomic にデータを取得する必要がある。
 		entry.decode();
+		count_evalhash(pos, entry.key == keyExcludeTurn, entry.key != 0);
 		if (entry.key == keyExcludeTurn)
 		{
 			//	dbg_hit_on(true);
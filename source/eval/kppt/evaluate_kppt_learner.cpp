@@ -78,6 +78,10 @@ namespace Eval
 	// 直列化してあるので1次元配列
 	std::vector<Weight2> weights;
 
+	// 前回のupdate_weights()以降に勾配が加算されたindex(直列化したindex)の記録
+	// update_weights()では、ここに記録されているindexだけを処理する。
+	GradDirtyMap grad_dirty;
+
 	// 学習のときの勾配配列の初期化
 	// 引数のetaは、AdaGradのときの定数η(eta)。
 	void init_grad(double eta1, u64 eta1_epoch, double eta2, u64 eta2_epoch, double eta3)
@@ -93,6 +97,9 @@ namespace Eval
 		weights.resize(size); // 確保できるかは知らん。確保できる環境で動かしてちょうだい。
 		memset(&weights[0], 0, sizeof(Weight2) * weights.size());
 
+		// 勾配が加算されたindexの記録用
+		grad_dirty.resize(KPP::max_index());
+
 		// 学習率の設定
 		Weight::init_eta(eta1, eta2, eta3, eta1_epoch, eta2_epoch);
 	}
@@ -127,6 +134,9 @@ namespace Eval
 		// 180度盤面を回転させた位置関係に対する勾配
 		std::array<LearnFloatType,2> g_flip = { -g[0] , g[1] };
 
+		// 勾配を加算して、そのindexをgrad_dirtyに記録する。
+		auto add_weight = [&](const auto& x, const auto& g_) { u64 index = x.toIndex(); weights[index].add_grad(g_); grad_dirty.set(index); };
+
 		Square sq_bk = pos.king_square(BLACK);
 		Square sq_wk = pos.king_square(WHITE);
 
@@ -154,7 +164,7 @@ namespace Eval
 #endif
 
 		// KK
-		weights[KK(sq_bk,sq_wk).toIndex()].add_grad(g);
+		add_weight(KK(sq_bk,sq_wk), g);
 
 		for (int i = 0; i < PIECE_NUMBER_KING; ++i)
 		{
@@ -171,13 +181,13 @@ namespace Eval
 					BonaPiece l0 = list_fb[j];
 					BonaPiece l1 = list_fw[j];
 
-					weights[KPP(sq_bk     , k0, l0).toIndex()].add_grad(g);
-					weights[KPP(Inv(sq_wk), k1, l1).toIndex()].add_grad(g_flip);
+					add_weight(KPP(sq_bk     , k0, l0), g);
+					add_weight(KPP(Inv(sq_wk), k1, l1), g_flip);
 				}
 			}
 
 			// KKP
-			weights[KKP(sq_bk, sq_wk, k0).toIndex()].add_grad(g);
+			add_weight(KKP(sq_bk, sq_wk, k0), g);
 		}
 	}
 
@@ -195,6 +205,10 @@ namespace Eval
 		if (freeze_kpp)
 			vector_length = KKP::max_index();
 
+		// 勾配が加算されたindexの記録を取り出す。
+		// これ以降に(async_updateで)加算された勾配は、次回のupdate_weights()で処理される。
+		grad_dirty.swap();
+
 		// epochに応じたetaを設定してやる。
 		Weight::calc_eta(epoch);
 
@@ -213,13 +227,19 @@ namespace Eval
 			WinProcGroup::bindThisThread(thread_index);
 #endif
 
-#pragma omp for schedule(dynamic,20000)
-			for (s64 index_ = 0; index_ < (s64)vector_length; ++index_)
+#pragma omp for schedule(dynamic,64)
+			for (s64 word_ = 0; word_ < (s64)grad_dirty.word_count(); ++word_)
+			for (u64 bits = grad_dirty.word((u64)word_); bits; )
 			{
 				// OpenMPではループ変数は符号型変数でなければならないが、さすがに使いにくい。
 				// ※　この制限はOpenMP 2.5までの制限で、OpenMP 3.0では解除されている。
 				//   Visual C++ 2017はOpenMP 3.0に対応していない。PPLを推奨している模様。
-				u64 index = (u64)index_;
+				u64 index = (u64)word_ * 64 + pop_lsb(bits);
+
+				// 前回のupdate_weights()以降に勾配が加算されたindexだけを処理する。
+				// 次元下げしたもののうち、処理すべきindex(min_index_flagが立っているほう)に変換する。
+				if (!grad_dirty.to_update_index(index) || index >= vector_length)
+					continue;
 
 				// 自分が更新すべきやつか？
 				// 次元下げしたときのindexの小さいほうが自分でないならこの更新は行わない。
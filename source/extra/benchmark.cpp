@@ -4,6 +4,9 @@
 #include "../tt.h"
 #include "../search.h"
 #include "../thread.h"
+#if defined(USE_CPU_DISPATCH)
+#include "cpu_info.h"
+#endif
 
 using namespace std;
 
@@ -30,6 +33,89 @@ static const char* BenchSfen[] = {
 	"l6nl/5+P1gk/2np1S3/p1p4Pp/3P2Sp1/1PPb2P1P/P5GS1/R8/LN4bKL w RGgsn5p 1",
 };
 
+// ----------------------------------
+//  "bench effect" : 遠方駒の利きの計算方式ごとのベンチマーク
+// ----------------------------------
+
+// pextを用いる方式と用いない方式(NO_PEXTのときの方式)の角・飛車の横の利きの計算速度を比較する。
+// 実際の局面(BenchSfen)とランダムなoccupied bitboardに対して、盤上のすべての升から利きを求める。
+// 両方式の結果が一致することも確認する。
+// 例) bench effect 100000
+static void bench_effect(istringstream& is)
+{
+	string token;
+	const u64 loops = (is >> token) ? stoull(token) : 100000;
+
+	// Position::set()で評価関数を呼び出すので、先に読み込んでおく必要がある。
+	is_ready();
+
+	vector<Bitboard> occupied;
+	Position pos;
+	for (auto sfen : BenchSfen)
+	{
+		pos.set(sfen, Threads.main());
+		occupied.push_back(pos.pieces());
+	}
+	// 駒の密度が25%ぐらいのランダムな局面
+	PRNG prng(20171111);
+	while (occupied.size() < 64)
+		occupied.push_back(Bitboard(prng.rand<u64>() & prng.rand<u64>(), prng.rand<u64>() & prng.rand<u64>()) & ALL_BB);
+
+#if defined(USE_CPU_DISPATCH)
+	// pext命令そのものを用いるので、pextの使えないCPUではpextを用いる方式は計測できない。
+	const bool has_pext = CpuInfo::detect() >= CpuInfo::LEVEL_AVX2;
+#else
+	const bool has_pext = true;
+#endif
+
+	// 結果の検証
+	u64 mismatch = 0;
+	if (has_pext)
+		for (auto& occ : occupied)
+			for (auto sq : SQ)
+			{
+				mismatch += (bishopEffect0_pext(sq, occ) != bishopEffect0_magic(sq, occ));
+				mismatch += (bishopEffect1_pext(sq, occ) != bishopEffect1_magic(sq, occ));
+				mismatch += (rookRankEffect_pext(sq, occ) != rookRankEffect_mul(sq, occ));
+			}
+
+	const u64 calls = loops * occupied.size() * (u64)SQ_NB;
+
+	// 計測本体。結果を捨てると最適化で消されるのでxorしておく。
+	auto measure = [&](const char* name, auto f)
+	{
+		Bitboard sum = ZERO_BB;
+		Timer time;
+		time.reset();
+		for (u64 i = 0; i < loops; ++i)
+			for (auto& occ : occupied)
+				for (auto sq : SQ)
+					sum ^= f(sq, occ);
+		auto elapsed = time.elapsed() + 1; // 0除算の回避のため
+		cout << name << " : " << elapsed << " ms , " << calls / elapsed / 1000 << " Mcalls/s (" << (sum.pop_count() & 1) << ")" << endl;
+	};
+
+	cout << "effect benchmark : loops = " << loops << " , boards = " << occupied.size()
+		<< " , calls = " << calls << " , target = " << TARGET_CPU
+#if defined(NO_PEXT)
+		<< " (NO_PEXT)"
+#endif
+#if defined(USE_CPU_DISPATCH)
+		<< " (dispatch : " << (UsePext ? "pext" : "magic") << ")"
+#endif
+		<< endl;
+
+	if (has_pext)
+		measure("bishopEffect   pext ", [](Square sq, const Bitboard& occ) { return bishopEffect0_pext(sq, occ) | bishopEffect1_pext(sq, occ); });
+	measure("bishopEffect   magic", [](Square sq, const Bitboard& occ) { return bishopEffect0_magic(sq, occ) | bishopEffect1_magic(sq, occ); });
+	if (has_pext)
+		measure("rookRankEffect pext ", [](Square sq, const Bitboard& occ) { return rookRankEffect_pext(sq, occ); });
+	measure("rookRankEffect mul  ", [](Square sq, const Bitboard& occ) { return rookRankEffect_mul(sq, occ); });
+
+	if (has_pext)
+		cout << "verify : " << (mismatch == 0 ? "ok" : "NG , mismatch = " + to_string(mismatch)) << endl;
+}
+
 void bench_cmd(Position& current, istringstream& is)
 {
 	// Optionsを書き換えるのであとで復元する。
@@ -42,6 +128,12 @@ void bench_cmd(Position& current, istringstream& is)
 	// →　デフォルト1024にしておかないと置換表あふれるな。
 	std::string ttSize = (is >> token) ? token : "1024";
 
+	if (ttSize == "effect")
+	{
+		bench_effect(is);
+		return;
+	}
+
 	string threads = (is >> token) ? token : "1";
 	string limit = (is >> token) ? token : "17";
 
@@ -70,6 +162,9 @@ void bench_cmd(Position& current, istringstream& is)
 	else
 		limits.depth = stoi(limit);
 
+	// スレッドの生成からisreadyの完了(readyokを返せる状態になる)までの時間を計測する。
+	TimePoint ready_start = now();
+
 	Options["Hash"] = ttSize;
 	Options["Threads"] = threads;
 
@@ -98,12 +193,24 @@ void bench_cmd(Position& current, istringstream& is)
 	// 評価関数の読み込み等
 	is_ready();
 
+	TimePoint ready_time = now() - ready_start;
+
 	// トータルの探索したノード数
 	int64_t nodes = 0;
 
 	// main threadが探索したノード数
 	int64_t nodes_main = 0;
 
+#if defined(USE_EVAL_HASH)
+	// eval hashの統計
+	u64 eval_hash_probes = 0, eval_hash_hits = 0, eval_hash_collisions = 0;
+#endif
+
+#if defined(USE_TT_FALSE_HIT_STATS)
+	// 置換表でfalse hitした回数
+	u64 tt_false_hits = 0;
+#endif
+
 	// ベンチの計測用タイマー
 	Timer time;
 	time.reset();
@@ -126,11 +233,20 @@ void bench_cmd(Position& current, istringstream& is)
 
 		nodes += Threads.nodes_searched();
 		nodes_main += Threads.main()->nodes.load(std::memory_order_relaxed);
+#if defined(USE_EVAL_HASH_STATS)
+		eval_hash_probes += Threads.eval_hash_probes();
+		eval_hash_hits += Threads.eval_hash_hits();
+		eval_hash_collisions += Threads.eval_hash_collisions();
+#endif
+#if defined(USE_TT_FALSE_HIT_STATS)
+		tt_false_hits += Threads.tt_false_hits();
+#endif
 	}
 
 	auto elapsed = time.elapsed() + 1; // 0除算の回避のため
 
 	sync_cout << "\n==========================="
+		<< "\nReadyok (ms)    : " << ready_time
 		<< "\nTotal time (ms) : " << elapsed
 		<< "\nNodes searched  : " << nodes
 		<< "\nNodes/second    : " << 1000 * nodes / elapsed;
@@ -140,8 +256,16 @@ void bench_cmd(Position& current, istringstream& is)
 		<< "\nNodes searched(main thread) : " << nodes_main
 		<< "\nNodes/second  (main thread) : " << 1000 * nodes_main / elapsed;
 
+#if defined(USE_TT_FALSE_HIT_STATS)
+	cout << "\nTT false hits   : " << tt_false_hits;
+#endif
+
 	cout << sync_endl;
 
+#if defined(USE_EVAL_HASH)
+	Eval::print_evalhash_stats(eval_hash_probes, eval_hash_hits, eval_hash_collisions);
+#endif
+
 	// Optionsを書き換えたので復元。
 	// 値を代入しないとハンドラが起動しないのでこうやって復元する。
 	for (auto& s : oldOptions)
@@ -14,9 +14,9 @@
 //   include intrinsic header
 // ----------------------------
 
-#if defined(USE_AVX512)
-#include <zmmintrin.h>
-#elif defined(USE_AVX2)
+#if defined(USE_AVX2) || defined(USE_CPU_DISPATCH)
+// AVX-512の命令もimmintrin.hでincludeされる。(gccにはzmmintrin.hを直接includeできない)
+// USE_CPU_DISPATCHのときは、実行時に切り替えるAVX2/AVX-512用のコードのために必要。
 #include <immintrin.h>
 #elif defined(USE_SSE42)
 #include <nmmintrin.h>
@@ -92,6 +92,22 @@ inline uint64_t PEXT64(uint64_t a, uint64_t b) { return pext(a, b); }
 
 #endif
 
+#if defined(USE_CPU_DISPATCH)
+// pext命令そのもの。USE_CPU_DISPATCHのときは上のPEXT64()はsoftware emulationになるので、
+// 遠方駒の利きの計算では、pextの使えるCPUであることを起動時に確認したうえでこちらを用いる。(bitboard.hのUsePext)
+// gcc/clangでは-mbmi2なしでもpext命令を生成できるようにinline asmで書く。
+inline uint64_t PEXT64_BMI2(uint64_t a, uint64_t b)
+{
+#if defined(_MSC_VER)
+	return _pext_u64(a, b);
+#else
+	uint64_t r;
+	__asm__("pextq %2, %1, %0" : "=r"(r) : "r"(a), "rm"(b));
+	return r;
+#endif
+}
+#endif
+
 // ----------------------------
 //     POPCNT(SSE4.2の命令)
 // ----------------------------
@@ -12,6 +12,9 @@
 #include <sstream>
 #include <unordered_set>
 #include <iomanip>
+#include <queue>
+#include <cerrno>
+#include <sys/stat.h>
 
 using namespace std;
 using std::cout;
@@ -39,6 +42,100 @@ namespace Book
 	// USI拡張コマンド "makebook"(定跡作成)
 	// ----------------------------------
 
+	// --- 定跡ファイルの1局面単位での読み書き
+	// makebookの各コマンドで、定跡ファイルをメモリに丸読みせずに扱うときに用いる。
+
+	// 1局面分の定跡データ
+	struct BookRecord
+	{
+		string sfen;
+		PosMoveList move_list;
+	};
+
+	// テキスト形式の定跡ファイルから1局面分ずつ読み込む。
+	struct BookRecordReader
+	{
+		bool open(const string& filename)
+		{
+			fs.open(filename, ios::in);
+			next_sfen.clear();
+			return !fs.fail();
+		}
+
+		// 1局面分読み込む。指し手のない局面は読み飛ばす。(read_book()でも登録されないので)
+		// 読み込めなければfalseが返る。
+		bool read(BookRecord& r)
+		{
+			string line;
+			while (true)
+			{
+				if (next_sfen.empty())
+				{
+					// "sfen "で始まる行を探す。
+					while (getline(fs, line))
+						if (line.length() >= 5 && line.substr(0, 5) == "sfen ")
+						{
+							next_sfen = line.substr(5);
+							break;
+						}
+					if (next_sfen.empty())
+						return false;
+				}
+
+				r.sfen = next_sfen;
+				r.move_list.clear();
+				next_sfen.clear();
+
+				while (getline(fs, line))
+				{
+					// バージョン識別文字列とコメント行は読み飛ばす。
+					if ((line.length() >= 1 && line[0] == '#') || (line.length() >= 2 && line.substr(0, 2) == "//"))
+						continue;
+
+					// 次の局面に到達した。
+					if (line.length() >= 5 && line.substr(0, 5) == "sfen ")
+					{
+						next_sfen = line.substr(5);
+						break;
+					}
+
+					istringstream is(line);
+					string bestMove, nextMove;
+					int value = 0, depth = 0;
+					uint64_t num = 0;
+					is >> bestMove >> nextMove >> value >> depth >> num;
+					if (bestMove == "")
+						continue;
+
+					Move best = (bestMove == "none" || bestMove == "resign") ? MOVE_NONE : move_from_usi(bestMove);
+					Move next = (nextMove == "none" || nextMove == "resign") ? MOVE_NONE : move_from_usi(nextMove);
+
+					// 同じ指し手はMemoryBook::insert()と同じ規則で統合する。
+					insert_book_pos(r.move_list, BookPos(best, next, value, depth, num));
+				}
+
+				if (r.move_list.size() != 0)
+					return true;
+			}
+		}
+
+	private:
+		fstream fs;
+
+		// 先読みしてしまった次の局面のsfen文字列
+		string next_sfen;
+	};
+
+	// 1局面分を書き出す。write_book()と同じく、採択回数でソートしてから書き出す。
+	void write_book_record(fstream& fs, BookRecord& r)
+	{
+		std::stable_sort(r.move_list.begin(), r.move_list.end());
+
+		fs << "sfen " << r.sfen << endl;
+		for (auto& bp : r.move_list)
+			fs << bp.bestMove << ' ' << bp.nextMove << ' ' << bp.value << " " << bp.depth << " " << bp.num << endl;
+	}
+
 	// 局面を与えて、その局面で思考させるために、やねうら王2017Earlyが必要。
 #if defined(EVAL_LEARN) && defined(YANEURAOU_2017_EARLY_ENGINE)
 
@@ -60,6 +157,10 @@ namespace Book
 
 		// 前回から新たな指し手が追加されたかどうかのフラグ。
 		bool appended;
+
+		// 思考結果を1局面ごとに追記していくファイル。(openされていれば)
+		// 中断したときに、次回起動時にここから思考結果を復元して続きから再開する。
+		fstream journal;
 	};
 
 
@@ -111,13 +212,445 @@ namespace Book
 
 				// 新たなエントリーを追加したのでフラグを立てておく。
 				appended = true;
+
+				// 思考結果をjournalに追記しておく。
+				if (journal.is_open())
+				{
+					BookRecord r{ sfen, *move_list };
+					write_book_record(journal, r);
+					journal.flush();
+				}
 			}
 
 			// 1局面思考するごとに'.'をひとつ出力する。
 			cout << '.' << flush;
 		}
 	}
+
+	// makebook thinkを複数のPC(プロセス)で分担するための作業キュー。
+	// 共有ディレクトリ上に、思考対象局面をunitという単位に分けたファイルを置き、それをrename()で奪い合う。
+	// rename()はatomicなので、同じunitを2つのプロセスが同時に確保することはない。
+	// ・units.txt      : unitの数。init.lockを作成できたプロセスが、すべてのunitを作ったあとに書き出す。
+	// ・todo_N.sfen    : 未着手のunit
+	// ・doing_N.sfen   : 思考中のunit。owner_N.txtにそのworker名が書かれていて、heartbeat()で定期的に更新される。
+	// ・doing_N.sfen.<worker> : unitを確保しようとしているworkerが一時的に付ける名前。
+	// 　　　　　　　　　owner_N.txtを書き込むまでこの名前にしておくので、その間に他のworkerが同じunitを確保することはない。
+	// ・done_N.db      : 思考済みのunit。定跡ファイルと同じ形式。
+	// 速いPCほど多くのunitを処理することになる。また、heartbeatが途絶えたunitは他のPCが奪って処理する。
+	struct BookWorkQueue
+	{
+		BookWorkQueue(const string& dir_, const string& worker_, u64 timeout_seconds_)
+			: dir(dir_), worker(worker_), timeout_seconds(timeout_seconds_), unit_count(0) {}
+
+		// unitがまだ作られていなければsfensをunit_size局面ずつに分けて作る。
+		// 他のプロセスが作成中であれば、それが終わるのを待つ。
+		bool init(const vector<string>& sfens, u64 unit_size)
+		{
+			FILE* lock = fopen(path("init.lock").c_str(), "wx");
+			if (lock != nullptr)
+			{
+				fclose(lock);
+
+				u64 n = 0;
+				for (u64 i = 0; i < sfens.size(); i += unit_size, ++n)
+				{
+					vector<string> unit(sfens.begin() + i, sfens.begin() + std::min(i + unit_size, (u64)sfens.size()));
+					if (!write_lines(path("todo", n, ".sfen"), unit))
+						return false;
+				}
+				if (!write_lines(path("units.txt"), vector<string>{ to_string(n) }))
+					return false;
+
+				cout << "create " << n << " units in " << dir << endl;
+			}
+			else if (errno != EEXIST)
+			{
+				cout << "Error! : can't create " << path("init.lock") << endl;
+				return false;
+			}
+
+			for (int i = 0; ; ++i)
+			{
+				vector<string> lines;
+				if (read_all_lines(path("units.txt"), lines) == 0 && lines.size() != 0)
+				{
+					unit_count = stoull(lines[0]);
+					break;
+				}
+				if (i == 0)
+					cout << "wait for units.txt.. (delete " << path("init.lock") << " if nobody is creating units)" << endl;
+				sleep(1000);
+			}
+
+			cout << "work queue : " << dir << " , " << unit_count << " units , worker = " << worker << endl;
+			return true;
+		}
+
+		// 思考するunitを1つ確保する。確保できればtrueが返り、そのunitの番号と局面がid,sfensに返る。
+		// 1) 前回中断した自分のunit 2) 未着手のunit 3) heartbeatが途絶えたunit の順に探す。
+		bool claim(u64& id, vector<string>& sfens)
+		{
+			for (int pass = 0; pass < 3; ++pass)
+				for (u64 i = 0; i < unit_count; ++i)
+				{
+					if (exists(path("done", i, ".db")))
+						continue;
+
+					auto doing = path("doing", i, ".sfen");
+					if (pass == 0)
+					{
+						if (!exists(doing) || owner(i) != worker)
+							continue;
+						cout << "resume unit " << i << endl;
+						write_owner(i);
+					}
+					else
+					{
+						// 奪い合いになるので、いったん自分専用の名前にrename()できたプロセスだけが確保できる。
+						// 自分専用の名前にしたまま、ownerを書き込んでからdoingに戻す。
+						// (doingがあるのにownerが古いままである瞬間があると、他のプロセスにそれを奪われてしまう)
+						auto mine = doing + "." + worker;
+						if (pass == 1)
+						{
+							if (rename(path("todo", i, ".sfen").c_str(), mine.c_str()) != 0)
+								continue;
+						}
+						else
+						{
+							if (!exists(doing) || elapsed_seconds(path("owner", i, ".txt")) < timeout_seconds)
+								continue;
+							if (rename(doing.c_str(), mine.c_str()) != 0)
+								continue;
+
+							// 調べてからrename()するまでの間に、他のプロセスが奪っていたならheartbeatは更新されている。
+							// そのときは元に戻して諦める。
+							auto prev_owner = owner(i);
+							if (elapsed_seconds(path("owner", i, ".txt")) < timeout_seconds)
+							{
+								rename(mine.c_str(), doing.c_str());
+								continue;
+							}
+							cout << "take over unit " << i << " from " << prev_owner << endl;
+						}
+
+						if (!write_owner(i) || rename(mine.c_str(), doing.c_str()) != 0)
+						{
+							cout << "Error! : can't claim unit " << i << endl;
+							return false;
+						}
+					}
+
+					sfens.clear();
+					read_all_lines(doing, sfens);
+					id = i;
+					return true;
+				}
+			return false;
+		}
+
+		// unit idを思考中であることを他のプロセスに知らせる。
+		// heartbeatが途絶えている間に他のプロセスにunitを奪われていたならfalseを返す。
+		// (このとき、そのunitの思考は打ち切って良い。奪ったプロセスが最後まで思考する)
+		bool heartbeat(u64 id)
+		{
+			auto o = owner(id);
+			if (o != "" && o != worker)
+				return false;
+			write_owner(id);
+			return true;
+		}
+
+		// unit idの思考が終わったので、bookからそのunitの局面の思考結果を書き出す。
+		bool done(u64 id, const MemoryBook& book, const vector<string>& sfens)
+		{
+			auto tmp = path("done", id, "." + worker);
+			{
+				fstream fs(tmp, ios::out);
+				fs << "#YANEURAOU-DB2016 1.00" << endl;
+				for (auto& sfen : sfens)
+				{
+					auto it = book.book_body.find(sfen);
+					if (it == book.book_body.end())
+						continue;
+					BookRecord r{ sfen, *it->second };
+					write_book_record(fs, r);
+				}
+				fs.close();
+				if (fs.fail())
+					return false;
+			}
+
+			// 他のプロセスが先に書き出していることもある。そのときは、そちらを採用する。
+			if (rename(tmp.c_str(), path("done", id, ".db").c_str()) != 0)
+				std::remove(tmp.c_str());
+			std::remove(path("doing", id, ".sfen").c_str());
+			std::remove(path("owner", id, ".txt").c_str());
+			return true;
+		}
+
+		// 思考済みのunitの思考結果をbookに反映させる。まだ終わっていないunitの数を返す。
+		u64 merge_done(MemoryBook& book)
+		{
+			u64 unfinished = 0;
+			for (u64 i = 0; i < unit_count; ++i)
+			{
+				BookRecordReader reader;
+				if (!reader.open(path("done", i, ".db")))
+				{
+					++unfinished;
+					continue;
+				}
+				BookRecord r;
+				while (reader.read(r))
+					book.book_body[r.sfen] = PosMoveListPtr(new PosMoveList(r.move_list));
+			}
+			return unfinished;
+		}
+
+	private:
+		string path(const string& name) const { return dir + "/" + name; }
+		string path(const string& name, u64 id, const string& ext) const { return path(name + "_" + to_string(id) + ext); }
+
+		static bool exists(const string& filename) { return ifstream(filename).good(); }
+
+		// 最終更新からの経過時間[秒]。ファイルがなければ十分大きな値を返す。
+		static u64 elapsed_seconds(const string& filename)
+		{
+			struct stat st;
+			if (stat(filename.c_str(), &st) != 0)
+				return UINT64_MAX;
+			auto t = time(nullptr);
+			return t > st.st_mtime ? u64(t - st.st_mtime) : 0;
+		}
+
+		// unit idのownerとして自分のworker名を書き込む。
+		bool write_owner(u64 id)
+		{
+			return write_lines(path("owner", id, ".txt"), vector<string>{ worker });
+		}
+
+		string owner(u64 id) const
+		{
+			vector<string> lines;
+			read_all_lines(path("owner", id, ".txt"), lines);
+			return lines.size() ? lines[0] : "";
+		}
+
+		// 一時ファイルに書き出してからrename()する。(書き出し途中のファイルを他のプロセスが読まないように)
+		bool write_lines(const string& filename, const vector<string>& lines)
+		{
+			auto tmp = filename + "." + worker;
+			fstream fs(tmp, ios::out);
+			for (auto& line : lines)
+				fs << line << endl;
+			fs.close();
+
+			// Windowsではrename()先が存在すると失敗するので先に削除しておく。
+			// POSIXのrename()は既存のファイルをatomicに置き換えるので削除しない。(削除すると、そのあいだ
+			// ownerやheartbeatのファイルが存在しない瞬間ができて、他のプロセスにunitを奪われかねない)
+#if defined(_WIN32)
+			std::remove(filename.c_str());
 #endif
+			if (fs.fail() || rename(tmp.c_str(), filename.c_str()) != 0)
+			{
+				cout << "Error! : can't write " << filename << endl;
+				return false;
+			}
+			return true;
+		}
+
+		// 共有ディレクトリ
+		string dir;
+
+		// このプロセスの名前
+		string worker;
+
+		// この秒数の間heartbeatが途絶えたunitは奪って良い。
+		u64 timeout_seconds;
+
+		// unitの数
+		u64 unit_count;
+	};
+#endif
+
+	// ----------------------------------
+	//  定跡ファイルの外部ソート
+	// ----------------------------------
+
+	// makebook sort/mergeで、定跡ファイルをメモリに丸読みせずに処理するためのもの。
+	// 定跡ファイルをchunk_size局面ずつ読み込み、それぞれをsortして一時ファイルに書き出し(これはスレッド並列)、
+	// 最後に一時ファイルをk-way mergeする。
+	// 出力は、read_book()してwrite_book(filename, true)したものとは次の点で異なる。
+	// ・手駒の表記などの違いで別のsfen文字列になっていても、正規化すると同じ局面になるものは1つのレコードに統合する。
+	// 　(write_book()では別々のレコードのまま書き出され、std::sort()は安定ではないので、その順番も不定であった)
+
+	// src_filenameの定跡ファイルを外部ソートしてdst_filenameに書き出す。
+	// ・sfen文字列はwrite_book()でsortするときと同じく、Position::sfen()で正規化する。
+	// ・同じ局面が複数回出現した場合、read_book()と同じ規則で指し手を統合する。
+	// ・chunk_size = 1度にメモリに読み込む局面数。これをスレッドの数だけ並列にsortする。
+	// ・返し値は正常終了なら0。さもなくば非0。
+	int sort_book_file(const string& src_filename, const string& dst_filename, u64 chunk_size)
+	{
+		BookRecordReader reader;
+		if (!reader.open(src_filename))
+		{
+			cout << "Error! : can't read " << src_filename << endl;
+			return 1;
+		}
+
+		// Position::set()で評価関数の読み込みが必要。
+		is_ready();
+
+		// 同じ局面の指し手を統合する。rhsの指し手をlhsに追加する。
+		// read_book()では局面ごとに採択回数でsortしながら追加していくので、それと同じ順番になるようにここでもsortする。
+		auto merge_record = [](BookRecord& lhs, const BookRecord& rhs)
+		{
+			for (auto& bp : rhs.move_list)
+				insert_book_pos(lhs.move_list, bp);
+			std::stable_sort(lhs.move_list.begin(), lhs.move_list.end());
+		};
+
+		// chunkをsortして一時ファイルに書き出す。
+		// 同一局面はここでは統合せずに、ファイル上の出現順のまま書き出す。(最後のmergeのときに順番に統合する)
+		auto sort_chunk = [](vector<BookRecord>* chunk, string tmp_filename)
+		{
+			Position pos;
+			for (auto& r : *chunk)
+			{
+				pos.set(r.sfen, Threads.main());
+				r.sfen = pos.sfen();
+			}
+
+			std::stable_sort(chunk->begin(), chunk->end(),
+				[](const BookRecord& lhs, const BookRecord& rhs) { return lhs.sfen < rhs.sfen; });
+
+			fstream fs(tmp_filename, ios::out);
+			for (auto& r : *chunk)
+				write_book_record(fs, r);
+			fs.close();
+			delete chunk;
+		};
+
+		// --- 1) chunkごとにsortして一時ファイルに書き出す。
+
+		cout << "sort chunks..";
+
+		vector<string> tmp_filenames;
+		vector<std::thread> workers;
+		size_t max_workers = std::max(size_t(1), Threads.size());
+		u64 total = 0;
+
+		while (true)
+		{
+			auto chunk = new vector<BookRecord>();
+			BookRecord r;
+			while (chunk->size() < chunk_size && reader.read(r))
+				chunk->push_back(r);
+
+			if (chunk->size() == 0)
+			{
+				delete chunk;
+				break;
+			}
+			total += chunk->size();
+
+			// スレッドを使い切っていれば、古いものから終了を待つ。
+			// (待たずに読み込むとchunkがメモリ上に溜まる一方なので)
+			if (workers.size() >= max_workers)
+			{
+				workers.front().join();
+				workers.erase(workers.begin());
+			}
+
+			auto tmp_filename = dst_filename + ".tmp" + to_string(tmp_filenames.size());
+			tmp_filenames.push_back(tmp_filename);
+			workers.emplace_back(sort_chunk, chunk, tmp_filename);
+			cout << '.' << flush;
+		}
+		for (auto& th : workers)
+			th.join();
+
+		cout << "done. " << total << " positions in " << tmp_filenames.size() << " chunks." << endl;
+
+		// --- 2) 一時ファイルをk-way mergeして書き出す。
+
+		cout << "merge chunks..";
+
+		vector<BookRecordReader> readers(tmp_filenames.size());
+		vector<BookRecord> heads(tmp_filenames.size());
+
+		// (sfen , chunkの番号)の小さい順に取り出すpriority queue。
+		// 同じ局面はchunkの番号順、すなわち元のファイル上での出現順に統合される。
+		// (同じchunk内の同一局面は連続して並んでいて、1つ取り出すごとに次をpushするので、その順番に取り出される)
+		typedef pair<string, size_t> QueueItem;
+		priority_queue<QueueItem, vector<QueueItem>, greater<QueueItem>> queue;
+
+		for (size_t i = 0; i < tmp_filenames.size(); ++i)
+		{
+			if (!readers[i].open(tmp_filenames[i]))
+			{
+				cout << "Error! : can't read " << tmp_filenames[i] << endl;
+				return 1;
+			}
+			if (readers[i].read(heads[i]))
+				queue.push(QueueItem(heads[i].sfen, i));
+		}
+
+		fstream fs(dst_filename, ios::out);
+		if (fs.fail())
+		{
+			cout << "Error! : can't write " << dst_filename << endl;
+			return 1;
+		}
+
+		// バージョン識別用文字列
+		fs << "#YANEURAOU-DB2016 1.00" << endl;
+
+		u64 written = 0;
+		while (!queue.empty())
+		{
+			auto i = queue.top().second;
+			queue.pop();
+
+			BookRecord r = std::move(heads[i]);
+			if (readers[i].read(heads[i]))
+				queue.push(QueueItem(heads[i].sfen, i));
+
+			// 同じ局面が他のchunkにもあれば統合する。
+			while (!queue.empty() && queue.top().first == r.sfen)
+			{
+				auto j = queue.top().second;
+				queue.pop();
+				merge_record(r, heads[j]);
+				if (readers[j].read(heads[j]))
+					queue.push(QueueItem(heads[j].sfen, j));
+			}
+
+			write_book_record(fs, r);
+			++written;
+		}
+		fs.close();
+
+		readers.clear();
+		for (auto& f : tmp_filenames)
+			std::remove(f.c_str());
+
+		cout << "done. " << written << " positions." << endl;
+
+		return 0;
+	}
+
+	// makebook sort/mergeのオプションの"chunk N"を読み込む。
+	// 外部ソートのときに1度にメモリに読み込む局面数。(これがスレッドの数だけ同時にメモリ上に存在する)
+	u64 read_chunk_size(istringstream& is)
+	{
+		u64 chunk_size = 1000000;
+		string token;
+		while (is >> token)
+			if (token == "chunk")
+				is >> chunk_size;
+		return std::max(chunk_size, u64(1));
+	}
 
 	// フォーマット等についてはdoc/解説.txt を見ること。
 	void makebook_cmd(Position& pos, istringstream& is)
@@ -135,6 +668,8 @@ namespace Book
 		bool book_sort = token == "sort";
 		// 定跡の変換
 		bool convert_from_apery = token == "convert_from_apery";
+		// バイナリ形式の定跡ファイルへの変換
+		bool convert_to_bin = token == "convert_to_bin";
 
 #if !defined(EVAL_LEARN) || !defined(YANEURAOU_2017_EARLY_ENGINE)
 		if (from_thinking)
@@ -189,6 +724,16 @@ namespace Book
 			int cluster_id = 1;
 			int cluster_num = 1;
 
+			// 共有ディレクトリを介して分散生成する用。(clusterより優先される)
+			// workdir  = 共有ディレクトリ。ここに作業単位(unit)のファイルを置いて各PCで奪い合う。
+			// worker   = このPC(プロセス)の名前。中断後、同じ名前で再開すると思考中だったunitから再開する。
+			// unit     = 1つのunitの局面数
+			// timeout  = この時間[分]以上heartbeatが途絶えたunitは、他のPCが奪って思考する。
+			string workdir;
+			string worker_name;
+			u64 unit_size = 500;
+			u64 timeout_minutes = 30;
+
 			while (true)
 			{
 				token = "";
@@ -203,6 +748,14 @@ namespace Book
 					is >> start_moves;
 				else if (from_thinking && token == "cluster")
 					is >> cluster_id >> cluster_num;
+				else if (from_thinking && token == "workdir")
+					is >> workdir;
+				else if (from_thinking && token == "worker")
+					is >> worker_name;
+				else if (from_thinking && token == "unit")
+					is >> unit_size;
+				else if (from_thinking && token == "timeout")
+					is >> timeout_minutes;
 				else
 				{
 					cout << "Error! : Illigal token = " << token << endl;
@@ -268,6 +821,21 @@ namespace Book
 				}
 				else
 					cout << "..done" << endl;
+
+				// 前回中断したときのjournalがあれば、その思考結果を反映させる。
+				// これにより、思考済みの局面は↓の判定で思考対象から外れて、続きから再開することになる。
+				BookRecordReader journal;
+				if (journal.open(book_name + ".journal"))
+				{
+					BookRecord r;
+					u64 n = 0;
+					while (journal.read(r))
+					{
+						book.book_body[r.sfen] = PosMoveListPtr(new PosMoveList(r.move_list));
+						++n;
+					}
+					cout << "resume " << n << " nodes from " << book_name << ".journal" << endl;
+				}
 			}
 
 			// この時点で評価関数を読み込まないとKPPTはPositionのset()が出来ないので…。
@@ -441,25 +1009,24 @@ namespace Book
 				// 思考する局面をsfensに突っ込んで、この局面数をg_loop_maxに代入しておき、この回数だけ思考する。
 				MultiThinkBook multi_think(depth, book);
 
-				auto& sfens_ = multi_think.sfens;
-				for (auto& s : thinking_sfens)
+				// この局面のいま格納されているデータを比較して、この局面を再考すべきか判断する。
+				auto need_thinking = [&](const string& s)
 				{
-
-					// この局面のいま格納されているデータを比較して、この局面を再考すべきか判断する。
 					auto it = book.book_body.find(s);
 
 					// MemoryBookにエントリーが存在しないなら無条件で、この局面について思考して良い。
 					if (it == book.book_body.end())
+						return true;
+
+					auto& bp = *(it->second);
+					return bp[0].depth < depth // 今回の探索depthのほうが深い
+						|| (bp[0].depth == depth && bp.size() < multi_pv); // 探索深さは同じだが今回のMultiPVのほうが大きい
+				};
+
+				auto& sfens_ = multi_think.sfens;
+				for (auto& s : thinking_sfens)
+					if (need_thinking(s))
 						sfens_.push_back(s);
-					else
-					{
-						auto& bp = *(it->second);
-						if (bp[0].depth < depth // 今回の探索depthのほうが深い
-							|| (bp[0].depth == depth && bp.size() < multi_pv) // 探索深さは同じだが今回のMultiPVのほうが大きい
-							)
-							sfens_.push_back(s);
-					}
-				}
 
 #if 0
 				// 思考対象局面が求まったので、sfenを表示させてみる。
@@ -471,33 +1038,55 @@ namespace Book
 				// 思考対象node数の出力。
 				cout << "total " << sfens_.size() << " nodes " << endl;
 
-				// クラスターの指定に従い、間引く。
-				if (cluster_id != 1 || cluster_num != 1)
+				// 思考結果は1局面ごとにjournalに追記していく。
+				// 定跡ファイルに保存するたびに、journalは空にする。
+				auto journal_name = book_name + ".journal";
+				multi_think.journal.open(journal_name, ios::out | ios::app);
+
+				// 定跡ファイルに保存する。
+				// 書き出しの途中で落ちると定跡ファイルが壊れるので、一時ファイルに書き出してからrenameする。
+				auto save_book = [&]()
 				{
-					vector<string> a;
-					for (int i = 0; i < (int)sfens_.size(); ++i)
-					{
-						if ((i % cluster_num) == cluster_id - 1)
-							a.push_back(sfens_[i]);
-					}
-					sfens_ = a;
+					auto tmp_name = book_name + ".tmp";
+					book.write_book(tmp_name);
+					std::remove(book_name.c_str());
+					rename(tmp_name.c_str(), book_name.c_str());
 
-					// このPCに割り振られたnode数を表示する。
-					cout << "for my PC : " << sfens_.size() << " nodes " << endl;
-				}
+					multi_think.journal.close();
+					multi_think.journal.open(journal_name, ios::out | ios::trunc);
+				};
+
+				// 共有ディレクトリを介して分散生成するときの作業キューと、そこで確保しているunitの番号
+				unique_ptr<BookWorkQueue> work_queue;
+				u64 unit_id = 0;
 
-				multi_think.set_loop_max(sfens_.size());
+				// 確保していたunitを他のPCに奪われたか。(heartbeatが途絶えていた場合)
+				bool unit_lost = false;
 
 				// 30分ごとに保存
 				// (ファイルが大きくなってくると保存の時間も馬鹿にならないのでこれくらいの間隔で妥協)
-				multi_think.callback_seconds = 30 * 60;
+				// 分散生成のときは、確保しているunitのheartbeatを1分ごとに更新する。
+				u64 callback_count = 0;
+				multi_think.callback_seconds = 60;
 				multi_think.callback_func = [&]()
 				{
 					std::unique_lock<Mutex> lk(multi_think.io_mutex);
+
+					// unitを奪われていたら、このunitの思考は打ち切る。(思考済みの局面はbookに反映される)
+					if (work_queue && !unit_lost && !work_queue->heartbeat(unit_id))
+					{
+						cout << "unit " << unit_id << " was taken over by another worker." << endl;
+						unit_lost = true;
+						multi_think.set_loop_max(0);
+					}
+
+					if (++callback_count % 30 != 0)
+						return;
+
 					// 前回書き出し時からレコードが追加された？
 					if (multi_think.appended)
 					{
-						book.write_book(book_name);
+						save_book();
 						cout << 'S' << endl;
 						multi_think.appended = false;
 					}
@@ -511,7 +1100,81 @@ namespace Book
 					TT.new_search();
 				};
 
-				multi_think.go_think();
+				if (workdir != "")
+				{
+					// 共有ディレクトリ上のunitを1つずつ確保して思考する。
+					if (worker_name == "")
+					{
+						// 名前が指定されていなければ乱数で決める。中断後に再開するときは同じ名前を指定すること。
+						stringstream ss;
+						ss << "worker" << hex << (PRNG().rand<u64>() & 0xffffffff);
+						worker_name = ss.str();
+					}
+					work_queue.reset(new BookWorkQueue(workdir, worker_name, timeout_minutes * 60));
+					if (!work_queue->init(sfens_, std::max(unit_size, u64(1))))
+						return;
+
+					vector<string> unit_sfens;
+					while (work_queue->claim(unit_id, unit_sfens))
+					{
+						// このunitの局面のうち、まだ思考していないものだけ思考する。(中断したunitを再開するとき)
+						sfens_.clear();
+						for (auto& s : unit_sfens)
+							if (need_thinking(s))
+								sfens_.push_back(s);
+
+						cout << "unit " << unit_id << " : " << sfens_.size() << " / " << unit_sfens.size() << " nodes" << endl;
+
+						unit_lost = false;
+						multi_think.set_loop_max(sfens_.size());
+						multi_think.go_think();
+
+						if (unit_lost)
+							continue;
+
+						if (!work_queue->done(unit_id, book, unit_sfens))
+						{
+							cout << "Error! : can't write the result of unit " << unit_id << endl;
+							return;
+						}
+					}
+
+					// 他のPCが思考したunitの結果も反映させる。
+					auto unfinished = work_queue->merge_done(book);
+					if (unfinished)
+						cout << unfinished << " units are not finished yet. run this command again later to collect them." << endl;
+					else
+						cout << "all units are finished." << endl;
+
+					work_queue.reset();
+				}
+				else
+				{
+					// クラスターの指定に従い、間引く。
+					if (cluster_id != 1 || cluster_num != 1)
+					{
+						vector<string> a;
+						for (int i = 0; i < (int)sfens_.size(); ++i)
+						{
+							if ((i % cluster_num) == cluster_id - 1)
+								a.push_back(sfens_[i]);
+						}
+						sfens_ = a;
+
+						// このPCに割り振られたnode数を表示する。
+						cout << "for my PC : " << sfens_.size() << " nodes " << endl;
+					}
+
+					multi_think.set_loop_max(sfens_.size());
+					multi_think.go_think();
+				}
+
+				cout << "write..";
+				save_book();
+				multi_think.journal.close();
+				std::remove(journal_name.c_str());
+				cout << "finished." << endl;
+				return;
 
 			}
 
@@ -525,7 +1188,8 @@ namespace Book
 		else if (book_merge) {
 
 			// 定跡のマージ
-			MemoryBook book[3];
+			// それぞれの定跡ファイルを外部ソートしてから、sfen文字列の順に突き合わせる。
+			// メモリに丸読みしないので、メモリに載らないような巨大な定跡でもマージできる。
 			string book_name[3];
 			is >> book_name[0] >> book_name[1] >> book_name[2];
 			if (book_name[2] == "")
@@ -533,87 +1197,95 @@ namespace Book
 				cout << "Error! book name is empty." << endl;
 				return;
 			}
+			u64 chunk_size = read_chunk_size(is);
 			cout << "book merge from " << book_name[0] << " and " << book_name[1] << " to " << book_name[2] << endl;
+
+			string sorted_name[2] = { book_name[2] + ".sorted0" , book_name[2] + ".sorted1" };
 			for (int i = 0; i < 2; ++i)
 			{
-				if (book[i].read_book(book_name[i]) != 0)
+				if (sort_book_file(book_name[i], sorted_name[i], chunk_size) != 0)
 					return;
 			}
 
-			// 読み込めたので合体させる。
+			// sortできたので合体させる。
 			cout << "merge..";
 
+			BookRecordReader reader[2];
+			for (int i = 0; i < 2; ++i)
+				reader[i].open(sorted_name[i]);
+
+			fstream fs(book_name[2], ios::out);
+			fs << "#YANEURAOU-DB2016 1.00" << endl;
+
 			// 同一nodeと非同一nodeの統計用
 			// diffrent_nodes1 = book0側にのみあったnodeの数
 			// diffrent_nodes2 = book1側にのみあったnodeの数
 			u64 same_nodes = 0;
 			u64 diffrent_nodes1 = 0, diffrent_nodes2 = 0;
 
-			// 1) 探索が深いほうを採用。
-			// 2) 同じ探索深さであれば、MultiPVの大きいほうを採用。
-			for (auto& it0 : book[0].book_body)
+			BookRecord r0, r1;
+			bool has0 = reader[0].read(r0);
+			bool has1 = reader[1].read(r1);
+
+			while (has0 || has1)
 			{
-				auto sfen = it0.first;
-				// このエントリーがbook1のほうにないかを調べる。
-				auto it1_ = book[1].book_body.find(sfen);
-				auto& it1 = *it1_;
-				if (it1_ != book[1].book_body.end())
+				if (has0 && (!has1 || r0.sfen < r1.sfen))
 				{
+					// book0側にしかないので無条件で書き出す。
+					write_book_record(fs, r0);
+					diffrent_nodes1++;
+					has0 = reader[0].read(r0);
+				}
+				else if (!has0 || r1.sfen < r0.sfen)
+				{
+					// book1側にしかないので無条件で書き出す。
+					write_book_record(fs, r1);
+					diffrent_nodes2++;
+					has1 = reader[1].read(r1);
+				}
+				else {
 					same_nodes++;
 
-					// あったので、良いほうをbook2に突っ込む。
-					// 1) 登録されている候補手の数がゼロならこれは無効なのでもう片方を登録
-					// 2) depthが深いほう
-					// 3) depthが同じならmulti pvが大きいほう(登録されている候補手が多いほう)
-					if (it0.second->size() == 0)
-						book[2].book_body.insert(it1);
-					else if (it1.second->size() == 0)
-						book[2].book_body.insert(it0);
-					else if (it0.second->at(0).depth > it1.second->at(0).depth)
-						book[2].book_body.insert(it0);
-					else if (it0.second->at(0).depth < it1.second->at(0).depth)
-						book[2].book_body.insert(it1);
-					else if (it0.second->size() >= it1.second->size())
-						book[2].book_body.insert(it0);
+					// 両方にあったので、良いほうを書き出す。(指し手のない局面はsort_book_file()で除外されている)
+					// 1) depthが深いほう
+					// 2) depthが同じならmulti pvが大きいほう(登録されている候補手が多いほう)
+					if (r0.move_list[0].depth > r1.move_list[0].depth)
+						write_book_record(fs, r0);
+					else if (r0.move_list[0].depth < r1.move_list[0].depth)
+						write_book_record(fs, r1);
+					else if (r0.move_list.size() >= r1.move_list.size())
+						write_book_record(fs, r0);
 					else
-						book[2].book_body.insert(it1);
-				}
-				else {
-					// なかったので無条件でbook2に突っ込む。
-					book[2].book_body.insert(it0);
-					diffrent_nodes1++;
+						write_book_record(fs, r1);
+
+					has0 = reader[0].read(r0);
+					has1 = reader[1].read(r1);
 				}
 			}
-			// book0の精査が終わったので、book1側で、まだ突っ込んでいないnodeを探して、それをbook2に突っ込む
-			for (auto& it1 : book[1].book_body)
+			fs.close();
+
+			for (int i = 0; i < 2; ++i)
 			{
-				if (book[2].book_body.find(it1.first) == book[2].book_body.end())
-				{
-					book[2].book_body.insert(it1);
-					diffrent_nodes2++;
-				}
+				reader[i] = BookRecordReader();
+				std::remove(sorted_name[i].c_str());
 			}
+
 			cout << "..done" << endl;
 
 			cout << "same nodes = " << same_nodes
 				<< " , different nodes =  " << diffrent_nodes1 << " + " << diffrent_nodes2 << endl;
 
-			cout << "write..";
-			book[2].write_book(book_name[2]);
-			cout << "..done!" << endl;
-
 		}
 		else if (book_sort) {
 			// 定跡のsort
-			MemoryBook book;
+			// 外部ソートするので、メモリに載らないような巨大な定跡でもsortできる。
 			string book_src, book_dst;
 			is >> book_src >> book_dst;
+			u64 chunk_size = read_chunk_size(is);
 			cout << "book sort from " << book_src << " , write to " << book_dst << endl;
-			book.read_book(book_src);
 
-			cout << "write..";
-			book.write_book(book_dst, true);
-			cout << "..done!" << endl;
+			if (sort_book_file(book_src, book_dst, chunk_size) == 0)
+				cout << "..done!" << endl;
 
 		}
 		else if (convert_from_apery) {
@@ -627,14 +1299,37 @@ namespace Book
 			book.write_book(book_dst, true);
 			cout << "..done!" << endl;
 
+		}
+		else if (convert_to_bin) {
+			MemoryBook book;
+			string book_src, book_dst;
+			is >> book_src >> book_dst;
+			if (book_dst == "")
+			{
+				cout << "Error! book name is empty." << endl;
+				return;
+			}
+			cout << "convert book from " << book_src << " , write to " << book_dst << endl;
+			if (book.read_book(book_src) != 0)
+				return;
+
+			cout << "write..";
+			if (book.write_book_bin(book_dst) != 0)
+			{
+				cout << "Error! : can't write " << book_dst << endl;
+				return;
+			}
+			cout << "..done!" << endl;
+
 		}
 		else {
 			cout << "usage" << endl;
 			cout << "> makebook from_sfen book.sfen book.db moves 24" << endl;
 			cout << "> makebook think book.sfen book.db moves 16 depth 18" << endl;
-			cout << "> makebook merge book_src1.db book_src2.db book_merged.db" << endl;
-			cout << "> makebook sort book_src.db book_sorted.db" << endl;
+			cout << "> makebook merge book_src1.db book_src2.db book_merged.db [chunk 1000000]" << endl;
+			cout << "> makebook sort book_src.db book_sorted.db [chunk 1000000]" << endl;
 			cout << "> makebook convert_from_apery book_src.bin book_converted.db" << endl;
+			cout << "> makebook convert_to_bin book_src.db book_converted.ybk" << endl;
 		}
 	}
 #endif
@@ -662,6 +1357,51 @@ namespace Book
 		return s;
 	}
 
+	// FileReaderの任意の位置から1行ずつ読み込むためのhelper。
+	// MemoryBook::find()のなかでlocalに生成して使うので、find()自体は複数スレッドから同時に呼び出して良い。
+	struct BookLineReader
+	{
+		BookLineReader(const FileReader& file_, u64 offset) : file(file_), buf_pos(offset), len(0), cur(0) {}
+
+		// 1行読み込む。(改行文字は含まない) ファイルの終端に達していて読み込めなければfalseが返る。
+		bool getline(string& line)
+		{
+			line.clear();
+			while (true)
+			{
+				// bufferを使い切ったので次を読み込む。
+				if (cur == len)
+				{
+					buf_pos += len;
+					cur = 0;
+					len = file.read(buf_pos, buf, sizeof(buf));
+					if (len == 0)
+						return !line.empty();
+				}
+
+				auto p = (const char*)memchr(buf + cur, '\n', len - cur);
+				size_t end = p ? size_t(p - buf) : len;
+				line.append(buf + cur, end - cur);
+				cur = end;
+				if (p)
+				{
+					cur++;
+					return true;
+				}
+			}
+		}
+
+		// 次に読み込むファイル上の位置
+		u64 tell() const { return buf_pos + cur; }
+
+	private:
+		const FileReader& file;
+		char buf[4096];
+		u64 buf_pos;  // buf[0]のファイル上の位置
+		size_t len;   // bufに読み込まれているバイト数
+		size_t cur;   // buf上の次に読み込む位置
+	};
+
 	static std::unique_ptr<AperyBook> apery_book;
 	static const constexpr char* kAperyBookName = "book/book.bin";
 
@@ -682,6 +1422,10 @@ namespace Book
 		// 別のファイルを開こうとしているので前回メモリに丸読みした定跡をクリアしておかないといけない。
 		book_body.clear();
 		this->on_the_fly = false;
+		book_file.close();
+		bin_memory.free();
+		bin_entries = nullptr;
+		bin_entry_count = 0;
 
 		// 読み込み済み、もしくは定跡を用いない(no_book)であるなら正常終了。
 		if (filename == "book/no_book")
@@ -697,16 +1441,22 @@ namespace Book
 			apery_book = std::unique_ptr<AperyBook>(new AperyBook(kAperyBookName));
 		}
 		else {
+			// バイナリ形式の定跡データベースであるなら、mapするだけで良い。
+			switch (read_book_bin(filename))
+			{
+			case 0: book_name = filename; return 0;
+			case 1: break; // バイナリ形式ではなかった。
+			default:
+				cout << "info string Error! : broken book file " + filename << endl;
+				return 1;
+			}
+
 			// やねうら王定跡データベースを読み込む
 
 			// ファイルだけオープンして読み込んだことにする。
 			if (on_the_fly_)
 			{
-				if (fs.is_open())
-					fs.close();
-
-				fs.open(filename, ios::in);
-				if (fs.fail())
+				if (!book_file.open(filename))
 				{
 					cout << "info string Error! : can't read " + filename << endl;
 					return 1;
@@ -868,6 +1618,106 @@ namespace Book
 		return 0;
 	}
 
+	// バイナリ形式の定跡ファイルの識別文字列とversion
+	static const char BookBinMagic[16] = "YANEURAOU-BOOK";
+	static const u64 BookBinVersion = 1;
+
+	// バイナリ形式の定跡ファイルの書き出し
+	int MemoryBook::write_book_bin(const std::string& filename) const
+	{
+		vector<BookBinEntry> entries;
+
+		{
+			// Position::set()で評価関数の読み込みが必要。
+			is_ready();
+			Position pos;
+
+			for (auto& it : book_body)
+			{
+				pos.set(it.first, Threads.main());
+				Key key = pos.state()->key();
+
+				// 採択回数の降順に並べて書き出す。
+				PosMoveList move_list = *it.second;
+				std::stable_sort(move_list.begin(), move_list.end());
+
+				for (auto& bp : move_list)
+				{
+					BookBinEntry e;
+					e.key = key;
+					e.move = (u16)bp.bestMove;
+					e.next_move = (u16)bp.nextMove;
+					e.value = (s16)std::min(std::max(bp.value, (int)INT16_MIN), (int)INT16_MAX);
+					e.depth = (s16)std::min(std::max(bp.depth, (int)INT16_MIN), (int)INT16_MAX);
+					e.num = bp.num;
+					entries.push_back(e);
+				}
+			}
+		}
+
+		// keyでsortする。同じkeyの中では↑で並べた採択回数の降順を維持したいのでstable_sort。
+		std::stable_sort(entries.begin(), entries.end(),
+			[](const BookBinEntry& lhs, const BookBinEntry& rhs) { return lhs.key < rhs.key; });
+
+		BookBinHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, BookBinMagic, sizeof(header.magic));
+		header.version = BookBinVersion;
+		header.entry_size = sizeof(BookBinEntry);
+		header.entry_count = entries.size();
+		header.zobrist_check = (Key)DepthHash(1);
+
+		fstream fs(filename, ios::out | ios::binary);
+		if (!fs)
+			return 1;
+
+		fs.write((const char*)&header, sizeof(header));
+
+		// 巨大なファイルになりうるので1GBずつ書き出す。
+		const u64 block = 1024 * 1024 * 1024 / sizeof(BookBinEntry);
+		for (u64 start = 0; start < entries.size(); start += block)
+		{
+			u64 n = std::min(block, (u64)entries.size() - start);
+			fs.write((const char*)&entries[(size_t)start], n * sizeof(BookBinEntry));
+		}
+
+		return fs.fail() ? 1 : 0;
+	}
+
+	// バイナリ形式の定跡ファイルの読み込み
+	int MemoryBook::read_book_bin(const std::string& filename)
+	{
+		// まずヘッダーだけ読み込んで、バイナリ形式であるかを判定する。
+		BookBinHeader header;
+		{
+			fstream fs(filename, ios::in | ios::binary);
+			if (!fs)
+				return 1;
+			fs.read((char*)&header, sizeof(header));
+			if (fs.gcount() != sizeof(header) || memcmp(header.magic, BookBinMagic, sizeof(header.magic)) != 0)
+				return 1;
+		}
+
+		// 異なるZobrist keyで書き出されたものであれば、keyが一致しないので使えない。
+		if (header.version != BookBinVersion
+			|| header.entry_size != sizeof(BookBinEntry)
+			|| header.zobrist_check != (Key)DepthHash(1))
+			return 2;
+
+		size_t size;
+		auto p = (u8*)bin_memory.map_file(filename, size);
+		if (p == nullptr || size != sizeof(BookBinHeader) + header.entry_count * sizeof(BookBinEntry))
+		{
+			bin_memory.free();
+			return 2;
+		}
+
+		bin_entries = (const BookBinEntry*)(p + sizeof(BookBinHeader));
+		bin_entry_count = header.entry_count;
+
+		return 0;
+	}
+
 	void MemoryBook::insert(const std::string sfen, const BookPos& bp)
 	{
 		auto it = book_body.find(sfen);
@@ -898,7 +1748,7 @@ namespace Book
 		}
 	}
 
-	PosMoveListPtr MemoryBook::find(const Position& pos)
+	PosMoveListPtr MemoryBook::find(const Position& pos) const
 	{
 		// "no_book"は定跡なしという意味なので定跡の指し手が見つからなかったことにする。
 		if (book_name == "no_book")
@@ -923,6 +1773,36 @@ namespace Book
 
 			return 	pml_entry;
 		}
+		else if (bin_entries) {
+			// バイナリ形式の定跡データベースを用いて指し手を選択する
+			// mapしたメモリは読み出すだけなので、複数スレッドから同時に呼び出しても問題ない。
+
+			Key key = pos.state()->key();
+			auto end = bin_entries + bin_entry_count;
+			auto it = std::lower_bound(bin_entries, end, key,
+				[](const BookBinEntry& e, Key k) { return e.key < k; });
+
+			if (it == end || it->key != key)
+				return PosMoveListPtr();
+
+			PosMoveListPtr pml_entry(new PosMoveList());
+			uint64_t num_sum = 0;
+			for (; it != end && it->key == key; ++it)
+			{
+				// 定跡のMoveは16bitであり、rootMovesは32bitのMoveであるからこのタイミングで補正する。
+				BookPos bp(pos.move16_to_move((Move)it->move), (Move)it->next_move, it->value, it->depth, it->num);
+				insert_book_pos(pml_entry, bp);
+				num_sum += it->num;
+			}
+
+			auto& move_list = *pml_entry;
+			std::stable_sort(move_list.begin(), move_list.end());
+			num_sum = std::max(num_sum, UINT64_C(1)); // ゼロ除算対策
+			for (auto& bp : move_list)
+				bp.prob = float(bp.num) / num_sum;
+
+			return pml_entry;
+		}
 		else {
 			// やねうら王定跡データベースを用いて指し手を選択する
 
@@ -931,7 +1811,6 @@ namespace Book
 				return PosMoveListPtr();
 
 			auto sfen = pos.sfen();
-			BookType::iterator it;
 
 			if (on_the_fly)
 			{
@@ -942,45 +1821,38 @@ namespace Book
 				// read_book()で取り除くと、そのあと書き出すときに手数が消失するのでまずい。(気がする)
 				sfen = trim_sfen(sfen);
 
-				// ファイル自体はオープンされてして、ファイルハンドルはfsだと仮定して良い。
-
-				// ファイルサイズ取得
-				// C++的には未定義動作だが、これのためにsys/stat.hをincludeしたくない。
-				// ここでfs.clear()を呼ばないとeof()のあと、tellg()が失敗する。
-				fs.clear();
-				fs.seekg(0, std::ios::end);
-				auto file_end = fs.tellg();
-
-				fs.clear();
-				fs.seekg(0, std::ios::beg);
-				auto file_start = fs.tellg();
-
-				auto file_size = u64(file_end - file_start);
+				// ファイル自体はオープンされていて、book_fileから読み込めると仮定して良い。
+				// ファイルポインタは使わず、以下のBookLineReaderを都度生成して読み込むので、
+				// 複数スレッドから同時にfind()を呼び出しても問題ない。
+				auto file_size = book_file.size();
 
 				// 与えられたseek位置から"sfen"文字列を探し、それを返す。どこまでもなければ""が返る。
+				// next_posには、見つかった"sfen"の行の次の行の位置が返る。
 				// hackとして、seek位置は-2しておく。(1行読み捨てるので、seek_fromぴったりのところに
 				// "sfen"から始まる文字列があるとそこを読み捨ててしまうため。-2してあれば、そこに
 				// CR+LFがあるはずだから、ここを読み捨てても大丈夫。)
-				auto next_sfen = [&](u64 seek_from)
+				auto next_sfen = [&](u64 seek_from, u64& next_pos)
 				{
 					string line;
 
-					fs.seekg(max(s64(0), (s64)seek_from - 2), fstream::beg);
+					BookLineReader reader(book_file, (u64)max(s64(0), (s64)seek_from - 2));
 
 					// --- 1行読み捨てる
 
 					// seek_from == 0の場合も、ここで1行読み捨てられるが、1行目は
 					// ヘッダ行であり、問題ない。
-					getline(fs, line);
+					reader.getline(line);
 
-					// getlineはeof()を正しく反映させないのでgetline()の返し値を用いる必要がある。
-					while (getline(fs, line))
+					while (reader.getline(line))
 					{
 						if (!line.compare(0, 4, "sfen"))
+						{
+							next_pos = reader.tell();
 							return trim_sfen(line.substr(5));
+						}
 						// "sfen"という文字列は取り除いたものを返す。
 						// 手数の表記も取り除いて比較したほうがいい。
-						// ios::binaryつけているので末尾に'\R'が付与されている。禿げそう。
+						// 改行コードがCR+LFのファイルだと末尾に'\r'が付与されている。禿げそう。
 					}
 					return string();
 				};
@@ -990,18 +1862,21 @@ namespace Book
 
 				u64 s = 0, e = file_size, m;
 
+				// 見つかった"sfen"の行の次の行の位置
+				u64 next_pos = 0;
+
 				while (true)
 				{
 					m = (s + e) / 2;
 
-					auto sfen2 = next_sfen(m);
+					auto sfen2 = next_sfen(m, next_pos);
 					if (sfen2 == "" || sfen < sfen2)
 					{ // 左(それより小さいところ)を探す
 						e = m;
 					}
 					else if (sfen > sfen2)
 					{ // 右(それより大きいところ)を探す
-						s = u64(fs.tellg() - file_start);
+						s = next_pos;
 					}
 					else {
 						// 見つかった！
@@ -1014,7 +1889,7 @@ namespace Book
 					{
 						// ただしs = 0のままだと先頭要素が探索されていないということなので
 						// このケースに限り先頭要素を再探索
-						if (s == 0 && next_sfen(s) == sfen)
+						if (s == 0 && next_sfen(s, next_pos) == sfen)
 							break;
 
 						// 見つからなかった
@@ -1037,14 +1912,13 @@ namespace Book
 					num_sum = 0;
 				};
 
-				// sfen文字列が合致したところまでは確定しており、そこまでfileのseekは完了している。
+				// sfen文字列が合致したところまでは確定しており、その次の行の位置がnext_posに入っている。
 				// その直後に指し手が書かれているのでそれをgetline()で読み込めば良い。
 
-				while (!fs.eof())
+				BookLineReader reader(book_file, next_pos);
+				string line;
+				while (reader.getline(line))
 				{
-					string line;
-					getline(fs, line);
-
 					// バージョン識別文字列(とりあえず読み飛ばす)
 					if (line.length() >= 1 && line[0] == '#')
 						continue;
@@ -1092,15 +1966,17 @@ namespace Book
 			else {
 
 				// on the flyではない場合
-				it = book_body.find(sfen);
+				auto it = book_body.find(sfen);
 				if (it != book_body.end())
 				{
+					// book_body側を書き換えると複数スレッドから呼び出したときに競合するので、コピーを返す。
+					PosMoveListPtr pml_entry(new PosMoveList(*it->second));
+
 					// 定跡のMoveは16bitであり、rootMovesは32bitのMoveであるからこのタイミングで補正する。
-					for (auto& m : *it->second)
+					for (auto& m : *pml_entry)
 						m.bestMove = pos.move16_to_move(m.bestMove);
 
-					// メモリ上に丸読みしてあるので参照透明だと思って良い。
-					return PosMoveListPtr(it->second);
+					return pml_entry;
 				}
 
 				// 空のentryを返す。
@@ -1216,10 +2092,11 @@ namespace Book
 		//  user_book2.db    ユーザー定跡2
 		//  user_book3.db    ユーザー定跡3
 		//  book.bin         Apery型の定跡DB
+		//  user_book1.ybk   バイナリ形式のユーザー定跡(makebook convert_to_binで作成する)
 
 		std::vector<std::string> book_list = { "no_book" , "standard_book.db"
 			, "yaneura_book1.db" , "yaneura_book2.db" , "yaneura_book3.db", "yaneura_book4.db"
-			, "user_book1.db", "user_book2.db", "user_book3.db", "book.bin" };
+			, "user_book1.db", "user_book2.db", "user_book3.db", "book.bin", "user_book1.ybk" };
 
 		o["BookFile"] << Option(book_list, book_list[1], [&](const Option& o){ this->book_name = string(o); });
 		book_name = book_list[1];
@@ -1430,8 +2307,11 @@ namespace Book
 
 	void insert_book_pos(PosMoveListPtr ptr, const BookPos& bp)
 	{
-		// この局面での指し手のリスト
-		auto& move_list = *ptr;
+		insert_book_pos(*ptr, bp);
+	}
+
+	void insert_book_pos(PosMoveList& move_list, const BookPos& bp)
+	{
 		// すでに格納されているかも知れないので同じ指し手がないかをチェックして、なければ追加
 		for (auto& b : move_list)
 			if (b == bp)
@@ -37,9 +37,38 @@ namespace Book
 	// sfen文字列からPosMoveListへの写像。(これが定跡データがメモリ上に存在するときの構造)
 	typedef std::unordered_map<std::string /* sfen */, PosMoveListPtr > BookType;
 
+	// バイナリ形式の定跡ファイルの1レコード。
+	// ・局面はsfen文字列ではなく64bitのhash key(Position::state()->key())で表現する。
+	// 　これはHASH_KEY_BITSによらず同じ値になる。(256bit hash keyの下位64bitと一致するように作ってある)
+	// ・ファイル上ではkeyの昇順に並んでいて、同じ局面の指し手は採択回数の降順に連続して並ぶ。
+	// ・固定長なので、mmapしたファイル上でそのままバイナリサーチできる。
+	struct BookBinEntry
+	{
+		Key key;         // 局面のhash key
+		u16 move;        // この局面での指し手(16bit)
+		u16 next_move;   // その指し手を指したときの予想される相手の指し手(16bit)
+		s16 value;       // 評価値
+		s16 depth;       // 探索深さ
+		u64 num;         // 採択回数
+	};
+	static_assert(sizeof(BookBinEntry) == 24, "sizeof(BookBinEntry) must be 24");
+
+	// バイナリ形式の定跡ファイルのヘッダー。ファイル先頭に置き、この直後からBookBinEntryが並ぶ。
+	struct BookBinHeader
+	{
+		char magic[16];    // "YANEURAOU-BOOK"
+		u64 version;       // フォーマットのversion
+		u64 entry_size;    // sizeof(BookBinEntry)
+		u64 entry_count;   // BookBinEntryの数
+		Key zobrist_check; // 書き出したときのZobrist keyの検証用。(DepthHash(1)の下位64bit)
+		u64 reserved[2];
+	};
+	static_assert(sizeof(BookBinHeader) == 64, "sizeof(BookBinHeader) must be 64");
+
 	// PosMoveListPtrに対してBookPosを一つ追加するヘルパー関数。
 	// (その局面ですでに同じbestMoveの指し手が登録されている場合は上書き動作となる)
 	extern void insert_book_pos(PosMoveListPtr ptr, const BookPos& bp);
+	extern void insert_book_pos(PosMoveList& move_list, const BookPos& bp);
 
 	// メモリ上にある定跡ファイル
 	// ・sfen文字列をkeyとして、局面の指し手へ変換するのが主な役割。(このとき重複した指し手は除外するものとする)
@@ -50,11 +79,15 @@ namespace Book
 		// ・見つからなかった場合、nullptrが返る。
 		// ・read_book()のときにon_the_flyが指定されていれば実際にはメモリ上には定跡データが存在しないので
 		// ファイルを調べに行き、PosMoveListをメモリ上に作って、それをくるんだPosMoveListPtrを返す。
-		PosMoveListPtr find(const Position& pos);
+		// ・返されるPosMoveListは呼び出し元専用のコピーなので、書き換えても良い。
+		// ・read_book()したあとは、on_the_flyであっても複数スレッドから同時に呼び出して良い。
+		PosMoveListPtr find(const Position& pos) const;
 
 		// 定跡を内部に読み込む。
 		// ・Aperyの定跡ファイルは"book/book.bin"だと仮定。(これはon the fly読み込みに非対応なので丸読みする)
 		// ・やねうら王の定跡ファイルは、on_the_flyが指定されているとメモリに丸読みしない。
+		// ・バイナリ形式の定跡ファイル(先頭が"YANEURAOU-BOOK")は、on_the_flyの値によらずmmapするだけなので
+		// 　読み込みは一瞬で終わる。この場合、book_bodyは空のままである。
 		//      Options["BookOnTheFly"]がtrueのときはon the flyで読み込むのでそれ用。
 		// 　　定跡作成時などはこれをtrueにしてはいけない。(メモリに読み込まれないため)
 		// ・同じファイルを二度目は読み込み動作をskipする。
@@ -68,6 +101,11 @@ namespace Book
 		// ・返し値は正常終了なら0。さもなくば非0。
 		int write_book(const std::string& filename, bool sort = false) const;
 
+		// 定跡ファイルをバイナリ形式で書き出す。
+		// ・book_bodyの各局面のsfen文字列からhash keyを求めるので、事前にis_ready()が必要。(内部で呼び出す)
+		// ・返し値は正常終了なら0。さもなくば非0。
+		int write_book_bin(const std::string& filename) const;
+
 		// Aperyの定跡ファイルを読み込む
 		// ・この関数はread_bookの下請けとして存在する。外部から直接呼び出すのは定跡のコンバートの時ぐらい。
 		// ・返し値は正常終了なら0。さもなくば非0。
@@ -91,14 +129,27 @@ namespace Book
 		// このフラグがtrueのときは、定跡ファイルのopen自体には成功していることが保証される。
 		bool on_the_fly = false;
 
-		// 上のon_the_fly == trueのときに、開いている定跡ファイルのファイルハンドル
-		std::fstream fs;
+		// 上のon_the_fly == trueのときに、開いている定跡ファイル
+		// 位置を指定して読み込むのでファイルポインタを持たず、find()から複数スレッドで同時に読み込んで良い。
+		FileReader book_file;
 
 		// read_book()のときに読み込んだbookの名前
 		// ・on_the_fly == trueのときは、読み込む予定のファイルの名前。
 		// ・二度目のread_book()の呼び出しのときにすでに読み込んである(or ファイルをopenしてある)かどうかの
 		// 判定のためにファイル名を内部的に保持してある。
 		std::string book_name;
+
+		// バイナリ形式の定跡ファイルを読み込む。read_book()の下請け。
+		// ・ファイルがバイナリ形式でなければ1、形式は合っているが中身が壊れていれば2を返す。
+		int read_book_bin(const std::string& filename);
+
+		// バイナリ形式の定跡ファイルをmapしたメモリ
+		LargeMemory bin_memory;
+
+		// ↑のうち、BookBinEntryの並んでいる部分とその数。バイナリ形式の定跡を読み込んでいなければnullptr。
+		// mapしたあとは書き換えないので、find()から複数スレッドで同時に参照して良い。
+		const BookBinEntry* bin_entries = nullptr;
+		u64 bin_entry_count = 0;
 	};
 
 #ifdef ENABLE_MAKEBOOK_CMD
@@ -129,8 +180,7 @@ namespace Book
 		// ・ただしrootMoves[0].pv[1]が合法手である保証はない。合法手でなければGUI側が弾くと思う。
 		// ・limit.silent == falseのときには画面に何故その指し手が選ばれたのか理由を出力する。
 		// ・この関数自体はthread safeなのでread_book()したあとは非同期に呼び出して問題ない。
-		// 　ただし、on_the_flyのときは、ディスクアクセスが必要で、その部分がthread safeではないので
-		//   on_the_fly == falseでなければ、非同期にこの関数を呼び出してはならない。
+		// 　on_the_flyのときもファイルは位置を指定して読み込むので、同様に非同期に呼び出して良い。
 		bool probe(Thread& th , Search::LimitsType& limit);
 
 		// 現在の局面が定跡に登録されているかを調べる。
@@ -139,8 +189,7 @@ namespace Book
 		// ・定跡にhitしなかった場合はMOVE_NONEが返る。
 		// ・画面には何も表示しない。
 		// ・この関数自体はthread safeなのでread_book()したあとは非同期に呼び出して問題ない。
-		// 　ただし、on_the_flyのときは、ディスクアクセスが必要で、その部分がthread safeではないので
-		//   on_the_fly == falseでなければ、非同期にこの関数を呼び出してはならない。
+		// 　on_the_flyのときもファイルは位置を指定して読み込むので、同様に非同期に呼び出して良い。
 		Move probe(Position& pos);
 
 	protected:
@@ -9,6 +9,7 @@
 
 #if !defined(USE_MAKEFILE)
 
+// USE_AVX512VNNI : AVX-512 VNNI(Ice Lake以降)でサポートされた命令を使うか。vpdpwssdなど。
 // USE_AVX512 : AVX-512(サーバー向けSkylake以降)でサポートされた命令を使うか。
 // USE_AVX2   : AVX2(Haswell以降)でサポートされた命令を使うか。pextなど。
 // USE_SSE42  : SSE4.2でサポートされた命令を使うか。popcnt命令など。
@@ -16,13 +17,14 @@
 // USE_SSE2   : SSE2  でサポートされた命令を使うか。
 // NO_SSE     : SSEは使用しない。
 // (Windowsの64bit環境だと自動的にSSE2は使えるはず)
-// noSSE ⊂ SSE2 ⊂ SSE4.1 ⊂ SSE4.2 ⊂ AVX2 ⊂  AVX-512
+// noSSE ⊂ SSE2 ⊂ SSE4.1 ⊂ SSE4.2 ⊂ AVX2 ⊂  AVX-512 ⊂ AVX-512 VNNI
 
 // Visual Studioのプロジェクト設定で「構成のプロパティ」→「C / C++」→「コード生成」→「拡張命令セットを有効にする」
 // のところの設定の変更も忘れずに。
 
 // ターゲットCPUのところだけdefineしてください。(残りは自動的にdefineされます。)
 
+//#define USE_AVX512VNNI
 //#define USE_AVX512
 #define USE_AVX2
 //#define USE_SSE42
@@ -30,11 +32,24 @@
 //#define USE_SSE2
 //#define NO_SSE
 
+// NO_PEXT    : 遠方駒の利きを求めるのにpext命令を使わない。(AVX2未満のCPUでは自動的にdefineされる)
+//              ZEN/ZEN2ではpextがmicrocodeで実装されていて非常に遅いので、AVX2でbuildするときもこれをdefineしたほうが速い。
+//              どちらが速いかは"bench effect"で確認できる。
+//#define NO_PEXT
+
+// USE_CPU_DISPATCH : 評価関数(KPPT/KPP_KKPT)のKPPの計算と遠方駒の利きの計算だけ、起動時にCPUを判定して
+//                    AVX-512 VNNI/AVX-512/AVX2(pext)用のコードに切り替える。それ以外の部分は上で選んだターゲットCPU用となる。
+//                    USE_SSE42と一緒にdefineすれば、一つの実行ファイルでSSE4.2以降のどのCPUでもそれなりの速度で動く。
+//                    Visual Studioでは「拡張命令セットを有効にする」はSSE4.2用の設定のままで良い。
+//#define USE_CPU_DISPATCH
+
 #else
 
 // Makefileを使ってbuildするときは、
 // $ make avx2
 // のようにしてビルドすれば自動的にAVX2用がビルドされます。
+// ZEN/ZEN2用には、$ make zen2 とすればNO_PEXTをdefineしたAVX2用がビルドされます。
+// USE_CPU_DISPATCHをdefineしたSSE4.2用は、$ make dispatch でビルドされます。
 
 #endif
 
@@ -179,10 +194,27 @@
 // 評価関数を計算したときに、それをHashTableに記憶しておく機能。KPPT評価関数においてのみサポート。
 // #define USE_EVAL_HASH
 
+// eval hashを調べた回数、hitした回数、衝突した回数をスレッドごとに数えて、benchコマンドの最後に表示する。
+// evaluate()のたびにカウンターを加算するので、そのぶん遅くなる。EvalHashのサイズを決めるときなどに用いる。
+// (USE_EVAL_HASHがdefineされていないと有効にはならない。FOR_TOURNAMENTのときは無効。)
+// #define USE_EVAL_HASH_STATS
+
 // sfenを256bitにpackする機能、unpackする機能を有効にする。
 // これをdefineするとPosition::packe_sfen(),unpack_sfen()が使えるようになる。
 // #define USE_SFEN_PACKER
 
+// 置換表のTTEntryをlockless hashing(keyとデータ部をxorしたものを格納する)で読み書きする。
+// 多数のスレッドで探索するときに、他のスレッドが書き込み中で壊れているTTEntryにhitするのを防ぐ。
+// (TT.probe()は検証済みのentryのコピーを返すので、探索部が壊れたデータを読むことはない)
+// probe()が少し遅くなるので、スレッド数が少ないときは不要。
+// 壊れたTTEntryにhitした回数は、USE_TT_FALSE_HIT_STATSをdefineすればbenchコマンドで確認できる。
+// #define USE_TT_XOR_VERIFY
+
+// 置換表にhitしたのに、その指し手がpseudo_legalではなかった回数(壊れたTTEntryや16bitのkeyの衝突によるfalse hit)を
+// スレッドごとに数えて、benchコマンドの最後に表示する。USE_TT_XOR_VERIFYの効果を確かめるときなどに用いる。
+// 置換表にhitするたびにpseudo_legal()を呼び出すので、そのぶん遅くなる。(FOR_TOURNAMENTのときは無効)
+// #define USE_TT_FALSE_HIT_STATS
+
 // 置換表のprobeに必ず失敗する設定
 // 自己生成棋譜からの学習でqsearch()のPVが欲しいときに
 // 置換表にhitして枝刈りされたときにPVが得られないの悔しいので
@@ -190,7 +222,8 @@
 
 // 評価関数パラメーターを共有メモリを用いて他プロセスのものと共有する。
 // 少ないメモリのマシンで思考エンジンを何十個も立ち上げようとしたときにメモリ不足になるので
-// 評価関数をshared memoryを用いて他のプロセスと共有する機能。(対応しているのはいまのところKPPT評価関数のみ。かつWindows限定)
+// 評価関数をshared memoryを用いて他のプロセスと共有する機能。(KPPT系の評価関数のみ対応)
+// WindowsではCreateFileMapping()、それ以外の環境ではPOSIXのshm_open()を用いる。
 // #define USE_SHARED_MEMORY_IN_EVAL
 
 // USIプロトコルでgameoverコマンドが送られてきたときに gameover_handler()を呼び出す。
@@ -198,6 +231,7 @@
 
 // EVAL_HASHで使用するメモリとして大きなメモリを確保するか。
 // これをONすると数%高速化する代わりに、メモリ使用量が1GBほど増える。
+// (EVAL_HASHのサイズは"EvalHash"オプションで変更できる。これをdefineするとそのデフォルト値が128MBから1024MBになる)
 // #define USE_LARGE_EVAL_HASH
 
 // GlobalOptionという、EVAL_HASHを有効/無効を切り替えたり、置換表の有効/無効を切り替えたりする
@@ -254,7 +288,7 @@
 
 // 定跡生成絡み
 #define ENABLE_MAKEBOOK_CMD
-// 評価関数を共用して複数プロセス立ち上げたときのメモリを節約。(いまのところWindows限定)
+// 評価関数を共用して複数プロセス立ち上げたときのメモリを節約。
 #define USE_SHARED_MEMORY_IN_EVAL
 // パラメーターの自動調整絡み
 #define USE_GAMEOVER_HANDLER
@@ -314,7 +348,7 @@
 
 // 定跡生成絡み
 #define ENABLE_MAKEBOOK_CMD
-// 評価関数を共用して複数プロセス立ち上げたときのメモリを節約。(いまのところWindows限定)
+// 評価関数を共用して複数プロセス立ち上げたときのメモリを節約。
 #define USE_SHARED_MEMORY_IN_EVAL
 // パラメーターの自動調整絡み
 #define USE_GAMEOVER_HANDLER
@@ -379,6 +413,8 @@
 #undef ENABLE_TEST_CMD
 #define USE_LARGE_EVAL_HASH
 #undef USE_GLOBAL_OPTIONS
+#undef USE_EVAL_HASH_STATS
+#undef USE_TT_FALSE_HIT_STATS
 #endif
 
 // --------------------
@@ -584,7 +620,14 @@ const bool Is64Bit = true;
 const bool Is64Bit = false;
 #endif
 
-#if defined(USE_AVX512)
+// 実行時のCPUの判定による切り替え(USE_CPU_DISPATCH)は、x86-64のときだけ。
+#if defined(USE_CPU_DISPATCH) && !defined(IS_64BIT)
+#undef USE_CPU_DISPATCH
+#endif
+
+#if defined(USE_AVX512VNNI)
+#define TARGET_CPU "AVX-512VNNI"
+#elif defined(USE_AVX512)
 #define TARGET_CPU "AVX-512"
 #elif defined(USE_AVX2)
 #define TARGET_CPU "AVX2"
@@ -600,6 +643,10 @@ const bool Is64Bit = false;
 
 // 上位のCPUをターゲットとするなら、その下位CPUの命令はすべて使えるはずなので…。
 
+#ifdef USE_AVX512VNNI
+#define USE_AVX512
+#endif
+
 #ifdef USE_AVX512
 #define USE_AVX2
 #endif
@@ -616,6 +663,25 @@ const bool Is64Bit = false;
 #define USE_SSE2
 #endif
 
+// AVX2未満だとpextはsoftware emulationになって遅いので、pextを使わない利きの計算を用いる。
+// USE_CPU_DISPATCHのときは、どちらを用いるかを起動時に決める。(bitboard.hのUsePext)
+#if !defined(USE_AVX2) && !defined(NO_PEXT) && !defined(USE_CPU_DISPATCH)
+#define NO_PEXT
+#endif
+
+// USE_CPU_DISPATCHのときに、ターゲットCPUより上位の命令セットを使う関数に付ける属性。
+// gcc/clangでは関数ごとに命令セットを指定しないとその命令のintrinsicsが使えない。MSVCは指定なしで使える。
+// この属性の付いた関数は、そのCPUであることを実行時に確認してから呼び出すこと。
+#if defined(USE_CPU_DISPATCH) && defined(__GNUC__)
+#define TARGET_AVX2       __attribute__((target("popcnt,sse4.2,avx2,bmi,bmi2")))
+#define TARGET_AVX512     __attribute__((target("popcnt,sse4.2,avx2,bmi,bmi2,avx512f,avx512bw,avx512dq,avx512vl")))
+#define TARGET_AVX512VNNI __attribute__((target("popcnt,sse4.2,avx2,bmi,bmi2,avx512f,avx512bw,avx512dq,avx512vl,avx512vnni")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#define TARGET_AVX512VNNI
+#endif
+
 // --------------------
 //    for 32bit OS
 // --------------------
@@ -633,6 +699,10 @@ const bool Is64Bit = false;
 
 #endif
 
+#if !defined(USE_EVAL_HASH)
+#undef USE_EVAL_HASH_STATS
+#endif
+
 // ----------------------------
 //     mutex wrapper
 // ----------------------------
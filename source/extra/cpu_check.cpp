@@ -0,0 +1,40 @@
+﻿// このbuildが対象としている命令セットを実行中のCPUが備えているかを、起動直後に調べる。
+// 備えていないなら、不正命令で落ちる前にその旨を出力して終了する。
+//
+// 他の翻訳単位は-mavx2などを指定してcompileされていて、大域変数のコンストラクタの時点で
+// それらの命令が使われることがある。そこで、
+// ・このファイルは命令セットを指定するオプションなしで、LTOもせずにcompileする。(Makefileを参照のこと)
+// ・gcc/clangではconstructor属性の優先度、MSVCではinit_seg(compiler)によって、
+// 　他の大域変数のコンストラクタより先に呼び出されるようにする。
+// ・この時点ではまだstd::coutが初期化されていないかも知れないので、出力にはstdioを用いる。
+// 命令セットの指定なしでcompileできるように、shogi.hではなくconfig.hだけをincludeする。
+
+#include "config.h"
+#include "cpu_info.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+	void check_cpu()
+	{
+		auto cpu = CpuInfo::detect();
+		if (cpu < CpuInfo::this_build())
+		{
+			printf("info string Error! : this binary is built for %s , but this CPU supports only %s.\n", TARGET_CPU, CpuInfo::name(cpu));
+			fflush(stdout);
+			exit(1);
+		}
+	}
+
+#if defined(_MSC_VER)
+#pragma warning(disable : 4073) // init_seg(compiler)を使うと出る警告
+#pragma init_seg(compiler)
+	struct CpuCheck { CpuCheck() { check_cpu(); } } cpu_check;
+#else
+	// 101はユーザーが使える最も高い優先度
+	__attribute__((constructor(101))) void cpu_check() { check_cpu(); }
+#endif
+
+}
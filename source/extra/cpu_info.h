@@ -0,0 +1,150 @@
+﻿#ifndef _CPU_INFO_H_
+#define _CPU_INFO_H_
+
+// 実行中のCPUが対応している命令セットをcpuid命令で判定する。
+// 起動時のCPUのチェック(extra/cpu_check.cpp)と、USE_CPU_DISPATCHのときに評価関数や遠方駒の利きの計算に
+// 用いるコードを実行時に選ぶのに用いる。
+// cpu_check.cppは命令セットの指定なしでcompileするので、shogi.h等には依存しない。
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CPU_INFO_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace CpuInfo
+{
+	// 命令セットの水準。config.hのUSE_AVX512VNNI～NO_SSEに対応する。
+	enum Level { LEVEL_NO_SSE, LEVEL_SSE2, LEVEL_SSE41, LEVEL_SSE42, LEVEL_AVX2, LEVEL_AVX512, LEVEL_AVX512VNNI, LEVEL_NB };
+
+	// config.hのTARGET_CPUと同じ表記
+	inline const char* name(Level l)
+	{
+		static const char* names[LEVEL_NB] = { "noSSE", "SSE2", "SSE4.1", "SSE4.2", "AVX2", "AVX-512", "AVX-512VNNI" };
+		return names[l];
+	}
+
+#if defined(CPU_INFO_X86)
+	// cpuid(leaf,subleaf)の結果をr[0..3] = eax,ebx,ecx,edxに返す。
+	inline void cpuid(unsigned leaf, unsigned subleaf, unsigned r[4])
+	{
+#if defined(_MSC_VER)
+		int x[4];
+		__cpuidex(x, (int)leaf, (int)subleaf);
+		for (int i = 0; i < 4; ++i)
+			r[i] = (unsigned)x[i];
+#else
+		r[0] = r[1] = r[2] = r[3] = 0;
+		__get_cpuid_count(leaf, subleaf, &r[0], &r[1], &r[2], &r[3]);
+#endif
+	}
+
+	// OSがどのレジスタの退避に対応しているか(XCR0)
+	inline unsigned long long xgetbv0()
+	{
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		unsigned eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return ((unsigned long long)edx << 32) | eax;
+#endif
+	}
+#endif
+
+	// 実行中のCPU(とOS)で使える最上位の命令セットを返す。
+	inline Level detect()
+	{
+#if defined(CPU_INFO_X86)
+		unsigned r[4];
+		cpuid(0, 0, r);
+		const unsigned max_leaf = r[0];
+
+		cpuid(1, 0, r);
+		const unsigned ecx1 = r[2], edx1 = r[3];
+
+		const bool sse2   = (edx1 >> 26) & 1;
+		const bool sse41  = (ecx1 >> 19) & 1;
+		const bool sse42  = ((ecx1 >> 20) & 1) && ((ecx1 >> 23) & 1); // popcntも使う
+		const bool osxsave = (ecx1 >> 27) & 1;
+		const bool avx    = (ecx1 >> 28) & 1;
+
+		const unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+		const bool os_ymm = (xcr0 & 0x06) == 0x06;
+		const bool os_zmm = (xcr0 & 0xe6) == 0xe6;
+
+		unsigned ebx7 = 0, ecx7 = 0;
+		if (max_leaf >= 7)
+		{
+			cpuid(7, 0, r);
+			ebx7 = r[1];
+			ecx7 = r[2];
+		}
+
+		// AVX2のbuildではBMI1/BMI2(pext)も使う。
+		const bool avx2   = avx && os_ymm && ((ebx7 >> 5) & 1) && ((ebx7 >> 3) & 1) && ((ebx7 >> 8) & 1);
+		// AVX-512F/DQ/BW/VL
+		const bool avx512 = avx2 && os_zmm && ((ebx7 >> 16) & 1) && ((ebx7 >> 17) & 1) && ((ebx7 >> 30) & 1) && ((ebx7 >> 31) & 1);
+		const bool vnni   = avx512 && ((ecx7 >> 11) & 1);
+
+		return vnni ? LEVEL_AVX512VNNI
+			: avx512 ? LEVEL_AVX512
+			: avx2 ? LEVEL_AVX2
+			: sse42 ? LEVEL_SSE42
+			: sse41 ? LEVEL_SSE41
+			: sse2 ? LEVEL_SSE2
+			: LEVEL_NO_SSE;
+#else
+		return LEVEL_NO_SSE;
+#endif
+	}
+
+	// pext命令がmicrocodeで実装されていて遅いCPUであるか。
+	// AMDのZEN3(family 19h)より前のCPU(Excavator , ZEN , ZEN+ , ZEN2)が該当する。
+	inline bool slow_pext()
+	{
+#if defined(CPU_INFO_X86)
+		unsigned r[4];
+		cpuid(0, 0, r);
+		// vendor ID "AuthenticAMD"は、ebx,edx,ecxの順に格納されている。
+		const bool amd = r[1] == 0x68747541 && r[3] == 0x69746e65 && r[2] == 0x444d4163;
+		if (!amd)
+			return false;
+
+		cpuid(1, 0, r);
+		unsigned family = (r[0] >> 8) & 0xf;
+		if (family == 0xf)
+			family += (r[0] >> 20) & 0xff;
+		return family < 0x19;
+#else
+		return false;
+#endif
+	}
+
+	// このbuildが対象としている命令セット
+	// (config.hのUSE_XXXが定義されている状態でincludeしたときのみ意味を持つ)
+	inline Level this_build()
+	{
+#if defined(USE_AVX512VNNI)
+		return LEVEL_AVX512VNNI;
+#elif defined(USE_AVX512)
+		return LEVEL_AVX512;
+#elif defined(USE_AVX2)
+		return LEVEL_AVX2;
+#elif defined(USE_SSE42)
+		return LEVEL_SSE42;
+#elif defined(USE_SSE41)
+		return LEVEL_SSE41;
+#elif defined(USE_SSE2)
+		return LEVEL_SSE2;
+#else
+		return LEVEL_NO_SSE;
+#endif
+	}
+}
+
+#endif // _CPU_INFO_H_
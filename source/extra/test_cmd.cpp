@@ -2093,9 +2093,7 @@ void test_mate_engine_cmd(Position& pos, istringstream& is) {
 	time.reset();
 
 	for (const char* sfen : TestMateEngineSfen) {
-		Search::StateStackPtr st;
-		auto states = Search::StateStackPtr(new aligned_stack<StateInfo>);
-		states->push(StateInfo());
+		auto st = StateListPtr(new StateList(1));
 
 		Position pos;
 		pos.set(sfen, Threads.main());
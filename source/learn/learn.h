@@ -129,6 +129,25 @@ typedef float LearnFloatType;
 //#define V_FRACTION_BITS 32
 //#define V_FRACTION_BITS 64
 
+// ----------------------
+//  AdaGradのg2の格納形式
+// ----------------------
+
+// Weight::g2(勾配の2乗の累積値)をfloatより小さな型で持つことでWeight配列を省メモリ化する。
+// V_FRACTION_BITSを8にするのと併用すると、Weight(手番なし1要素あたり)は10バイトから8～6バイトになる。
+// どれもdefineしなければLearnFloatType(float)で持つ。
+//
+// LEARN_G2_FLOAT16  : IEEE 754の半精度浮動小数(2バイト)。F16C命令が使えるならそれで変換する。
+//                     65504を超える値は65504に飽和する。
+// LEARN_G2_BFLOAT16 : floatの上位16bit(2バイト)。floatと同じ範囲を持つが、仮数部は7bitしかない。
+// LEARN_G2_LOG8     : log2(g2)を1/5刻みで量子化したもの(1バイト)。2^-20～2^30程度の範囲を持つ。
+//
+// いずれも、g2に小さな値を加算したときに丸めによって値が変化しなくなるのを防ぐため、丸めは確率的に行なう。
+
+//#define LEARN_G2_FLOAT16
+//#define LEARN_G2_BFLOAT16
+//#define LEARN_G2_LOG8
+
 // ----------------------
 //  省メモリ化
 // ----------------------
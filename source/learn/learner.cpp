@@ -74,6 +74,8 @@
 #include "../extra/book/book.h"
 #include "../tt.h"
 #include "multi_think.h"
+#include "sfen_container.h"
+#include "learning_tools.h"
 
 using namespace std;
 
@@ -102,6 +104,91 @@ namespace Learner
 // 局面の配列 : PSVector は packed sfen vector の略。
 typedef std::vector<PackedSfenValue> PSVector;
 
+// -----------------------------------
+//    教師局面ファイルの読み込み補助
+// -----------------------------------
+
+// mapした教師局面ファイル上の、局面がひと続きに並んでいる範囲
+// 圧縮形式(sfen_container.h)のファイルでは1ブロックを表し、展開するまでdataはnullptr。
+struct SfenSegment
+{
+	const PackedSfenValue* data; // 局面の先頭
+	u64 count;                   // 局面数
+	const u8* block;             // 圧縮形式のファイルなら展開前のブロック。さもなくばnullptr。
+};
+
+// mapした教師局面ファイルbase[0..size-1]のposの位置から、最大max_count局面分の範囲を切り出してsegに返し、posを進める。
+// ・compressed : ファイルが圧縮形式であるか。(check_sfen_block()で判定しておくこと)
+// ・圧縮形式のファイルはブロックの途中では切り出せないので、max_countを超えることがある。
+// ・もう切り出せるものがなければfalseを返す。(壊れたブロック以降や、局面の途中で途切れている端数は読み捨てる)
+bool next_sfen_segment(const u8* base, u64 size, bool compressed, u64 max_count, u64& pos, SfenSegment& seg)
+{
+	if (pos >= size)
+		return false;
+
+	auto p = base + pos;
+	if (compressed)
+	{
+		u32 n;
+		auto block_size = check_sfen_block(p, (size_t)(size - pos), &n);
+		if (block_size == 0)
+		{
+			cout << "Error! : broken block at " << pos << " , skip the rest of the file." << endl;
+			pos = size;
+			return false;
+		}
+		seg = { nullptr, n, p };
+		pos += block_size;
+	}
+	else {
+		auto n = std::min((size - pos) / sizeof(PackedSfenValue), max_count);
+		if (n == 0)
+		{
+			pos = size;
+			return false;
+		}
+		seg = { (const PackedSfenValue*)p, n, nullptr };
+		pos += n * sizeof(PackedSfenValue);
+	}
+	return true;
+}
+
+// segmentsのうち、圧縮されたブロックをthread_num個のスレッドで並列に展開してdecodedに格納し、
+// 各segmentのdata,countを展開後のものに書き換える。decodedはsegmentsと同じindexを用いる。
+// checksumの合わないブロックは読み捨てる。(countが0になる)
+void decode_sfen_segments(std::vector<SfenSegment>& segments, std::vector<PSVector>& decoded, size_t thread_num)
+{
+	if (std::none_of(segments.begin(), segments.end(), [](const SfenSegment& s) { return s.block != nullptr; }))
+		return;
+
+	decoded.resize(segments.size());
+	std::atomic<size_t> next_segment(0);
+	auto decode_worker = [&]()
+	{
+		for (size_t i; (i = next_segment++) < segments.size(); )
+		{
+			auto& seg = segments[i];
+			if (seg.block == nullptr)
+				continue;
+
+			if (!decompress_sfen_block(seg.block, decoded[i]))
+			{
+				cout << "Error! : checksum mismatch , skip the block." << endl;
+				decoded[i].clear();
+			}
+			seg.data = decoded[i].data();
+			seg.count = decoded[i].size();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < thread_num; ++i)
+		threads.push_back(std::thread(decode_worker));
+	decode_worker();
+	for (auto& th : threads)
+		th.join();
+}
+
 // -----------------------------------
 //    局面のファイルへの書き出し
 // -----------------------------------
@@ -110,10 +197,29 @@ typedef std::vector<PackedSfenValue> PSVector;
 struct SfenWriter
 {
 	// 書き出すファイル名と生成するスレッドの数
-	SfenWriter(string filename, int thread_num)
+	// compress == trueなら、sfen_container.hの圧縮形式で書き出す。
+	SfenWriter(string filename, int thread_num, bool compress_ = false)
 	{
 		sfen_buffers_pool.reserve(thread_num * 10);
 		sfen_buffers.resize(thread_num);
+		compress = compress_;
+
+		// 既存のファイルに追記するときは、そのファイルの形式に合わせる。
+		// (圧縮形式と非圧縮形式が混在したファイルは読み込めないので)
+		{
+			ifstream ifs(filename, ios::in | ios::binary);
+			char head[sizeof(PackedSfenBlockHeader)];
+			if (ifs.read(head, sizeof(head)))
+			{
+				bool compressed = check_sfen_block(head, sizeof(head)) != 0;
+				if (compressed != compress)
+				{
+					cout << "Warning! : " << filename << " is " << (compressed ? "" : "not ")
+						 << "compressed. append sfens in the same format." << endl;
+					compress = compressed;
+				}
+			}
+		}
 
 		// 追加学習するとき、評価関数の学習後も生成される教師の質はあまり変わらず、教師局面数を稼ぎたいので
 		// 古い教師も使うのが好ましいのでこういう仕様にしてある。
@@ -219,7 +325,15 @@ struct SfenWriter
 			{
 				for (auto ptr : buffers)
 				{
-					fs.write((const char*)&((*ptr)[0]), sizeof(PackedSfenValue) * ptr->size());
+					if (compress)
+					{
+						// スレッドバッファ1つ分(同じスレッドで生成した連続する局面)を1ブロックとして圧縮する。
+						block.clear();
+						compress_sfen_block(ptr->data(), ptr->size(), block);
+						fs.write((const char*)block.data(), block.size());
+					}
+					else
+						fs.write((const char*)&((*ptr)[0]), sizeof(PackedSfenValue) * ptr->size());
 
 					sfen_write_count += ptr->size();
 
@@ -246,6 +360,12 @@ private:
 
 	fstream fs;
 
+	// 圧縮形式で書き出すのか。
+	bool compress;
+
+	// 圧縮したブロックの書き出し用のバッファ
+	std::vector<u8> block;
+
 	// ファイルに書き込む用のthread
 	std::thread file_worker_thread;
 	// すべてのスレッドが終了したかのフラグ
@@ -812,6 +932,9 @@ void gen_sfen(Position&, istringstream& is)
 	// あとeval hashのhash衝突したときに、変な値の評価値が使われ、それを教師に使うのが気分が悪いというのもある。
 	bool use_eval_hash = false;
 
+	// 教師局面を圧縮形式で書き出すのか。
+	bool compress = false;
+
 	while (true)
 	{
 		token = "";
@@ -853,6 +976,8 @@ void gen_sfen(Position&, istringstream& is)
 			is >> write_maxply;
 		else if (token == "use_eval_hash")
 			is >> use_eval_hash;
+		else if (token == "compress")
+			is >> compress;
 		else
 			cout << "Error! : Illegal token " << token << endl;
 	}
@@ -885,11 +1010,12 @@ void gen_sfen(Position&, istringstream& is)
 		<< "  write_minply           = " << write_minply << endl
 		<< "  write_maxply           = " << write_maxply << endl
 		<< "  output_file_name       = " << output_file_name << endl
-		<< "  use_eval_hash          = " << use_eval_hash << endl;
+		<< "  use_eval_hash          = " << use_eval_hash << endl
+		<< "  compress               = " << compress << endl;
 
 	// Options["Threads"]の数だけスレッドを作って実行。
 	{
-		SfenWriter sw(output_file_name, thread_num);
+		SfenWriter sw(output_file_name, thread_num, compress);
 		MultiThinkGenSfen multi_think(search_depth, search_depth2, sw);
 		multi_think.set_loop_max(loop_max);
 		multi_think.eval_limit = eval_limit;
@@ -1087,12 +1213,20 @@ struct SfenReader
 		save_count = 0;
 		end_of_files = false;
 		no_shuffle = false;
+		stop_file_worker = false;
 
 		hash.resize(READ_SFEN_HASH_SIZE);
 	}
 
 	~SfenReader()
 	{
+		// file workerがpoolの空きを待っているかも知れないので停止させる。
+		{
+			std::unique_lock<Mutex> lk(mutex);
+			stop_file_worker = true;
+		}
+		cv_pool_free.notify_all();
+
 		if (file_worker_thread.joinable())
 			file_worker_thread.join();
 
@@ -1100,6 +1234,8 @@ struct SfenReader
 			delete p;
 		for (auto p : packed_sfens_pool)
 			delete p;
+		for (auto p : free_buffers)
+			delete p;
 	}
 
 	// mseなどの計算用に用いる局面数
@@ -1154,10 +1290,10 @@ struct SfenReader
 		ps = *(thread_ps->rbegin());
 		thread_ps->pop_back();
 		
-		// バッファを使いきったのであれば自らdeleteを呼び出してこのバッファを開放する。
+		// バッファを使いきったのであれば、file workerが再利用できるように返却する。
 		if (thread_ps->size() == 0)
 		{
-			delete thread_ps;
+			release_buffer(thread_ps);
 			thread_ps = nullptr;
 		}
 
@@ -1167,35 +1303,28 @@ struct SfenReader
 	// [ASYNC] スレッドバッファに局面をある程度読み込む。
 	bool read_to_thread_buffer_impl(size_t thread_id)
 	{
-		while (true)
-		{
-			{
-				std::unique_lock<Mutex> lk(mutex);
-				// ファイルバッファから充填できたなら、それで良し。
-				if (packed_sfens_pool.size() != 0)
-				{
-					// 充填可能なようなので充填して終了。
+		std::unique_lock<Mutex> lk(mutex);
 
-					packed_sfens[thread_id] = *packed_sfens_pool.rbegin();
-					packed_sfens_pool.pop_back();
+		// file workerがpacked_sfens_poolに充填してくれるか、ファイルの終端に達するまで待つ。
+		cv_pool_filled.wait(lk, [&] { return packed_sfens_pool.size() != 0 || end_of_files; });
 
-					total_read += THREAD_BUFFER_SIZE;
+		// もうすでに読み込むファイルは無くなっている。もうダメぽ。
+		if (packed_sfens_pool.size() == 0)
+			return false;
 
-					return true;
-				}
-			}
+		// 充填可能なようなので充填して終了。
+		auto ptr = packed_sfens_pool.back();
+		packed_sfens_pool.pop_back();
+		packed_sfens[thread_id] = ptr;
 
-			// もうすでに読み込むファイルは無くなっている。もうダメぽ。
-			if (end_of_files)
-				return false;
+		total_read += ptr->size();
 
-			// file workerがpacked_sfens_poolに充填してくれるのを待っている。
-			// mutexはlockしていないのでいずれ充填してくれるはずだ。
-			sleep(1);
-		}
+		// poolに空きができたのでfile workerを起こす。
+		cv_pool_free.notify_one();
 
+		return true;
 	}
-	
+
 	// 局面ファイルをバックグラウンドで読み込むスレッドを起動する。
 	void start_file_read_worker()
 	{
@@ -1203,85 +1332,148 @@ struct SfenReader
 	}
 
 	// ファイルの読み込み専用スレッド用
+	// ・ファイルはmapして(LargeMemory::map_file())、1局面ずつread()はしない。
+	// ・SFEN_READ_SIZE局面ごとに、コピー先の位置(index)のほうをshuffleしておき、
+	// 　mapしたファイルを先頭から順番に読みながらスレッドバッファに直接書き込む。
+	// 　(局面データそのものを何度もswap/コピーしないため。また、ファイルの読み込みがsequentialになるため。)
+	// ・圧縮形式(sfen_container.h)のファイルは、ブロック単位で並列に展開してから同様に書き込む。
+	// ・スレッドバッファは使い終わったものを再利用する。
 	void file_read_worker()
 	{
+		// 今回のブロックで読み込んでいるファイル。
+		// 末尾のファイルは次のブロックでも続きを読むので残しておく。
+		std::vector<std::unique_ptr<LargeMemory>> files;
+
+		// 今回読み込む局面の範囲
+		std::vector<SfenSegment> segments;
+
+		// 圧縮されたブロックの展開先
+		std::vector<PSVector> decoded;
+
+		// files.back()のサイズ[byte]と、次に読み込む位置[byte]。圧縮形式のファイルであるか。
+		u64 file_size = 0, file_pos = 0;
+		bool file_compressed = false;
+
 		auto open_next_file = [&]()
 		{
-			if (fs.is_open())
-				fs.close();
+			while (true)
+			{
+				// もう無い
+				if (filenames.size() == 0)
+					return false;
 
-			// もう無い
-			if (filenames.size() == 0)
-				return false;
+				// 次のファイル名ひとつ取得。
+				string filename = *filenames.rbegin();
+				filenames.pop_back();
 
-			// 次のファイル名ひとつ取得。
-			string filename = *filenames.rbegin();
-			filenames.pop_back();
+				cout << "open filename = " << filename << endl;
+
+				std::unique_ptr<LargeMemory> mem(new LargeMemory);
+				size_t size;
+				if (mem->map_file(filename, size) == nullptr)
+				{
+					// 読めないファイルは読み飛ばす。
+					cout << "Error! : can't read " << filename << endl;
+					continue;
+				}
 
-			fs.open(filename, ios::in | ios::binary);
-			cout << "open filename = " << filename << endl;
+				file_compressed = check_sfen_block(mem->get(), size) != 0;
+				if (file_compressed)
+					cout << "  (compressed)" << endl;
 
-			return true;
+				files.push_back(std::move(mem));
+				file_size = size;
+				file_pos = 0;
+				return true;
+			}
 		};
 
+		// シャッフル後の位置
+		std::vector<u32> dest;
+
 		while (true)
 		{
 			// バッファが減ってくるのを待つ。
-			// このsize()の読み取りはread onlyなのでlockしなくていいだろう。
-			while (packed_sfens_pool.size() >= SFEN_READ_SIZE / THREAD_BUFFER_SIZE)
-				sleep(100);
-
-			PSVector sfens;
-			sfens.reserve(SFEN_READ_SIZE);
+			{
+				std::unique_lock<Mutex> lk(mutex);
+				cv_pool_free.wait(lk, [&] { return packed_sfens_pool.size() < SFEN_READ_SIZE / THREAD_BUFFER_SIZE || stop_file_worker; });
+				if (stop_file_worker)
+					return;
+			}
 
-			// ファイルバッファにファイルから読み込む。
-			while (sfens.size() < SFEN_READ_SIZE)
+			// SFEN_READ_SIZE局面分の範囲を確定させる。
+			// 圧縮されたファイルはブロックの途中では切れないので、少しだけSFEN_READ_SIZEを超えることがある。
+			segments.clear();
+			u64 total = 0;
+			bool eof = false;
+			while (total < SFEN_READ_SIZE)
 			{
-				PackedSfenValue p;
-				if (fs.read((char*)&p, sizeof(PackedSfenValue)))
+				if (file_pos == file_size)
 				{
-					sfens.push_back(p);
-				} else
-				{
-					// 読み込み失敗
 					if (!open_next_file())
 					{
 						// 次のファイルもなかった。あぼーん。
-						cout << "..end of files." << endl;
-						end_of_files = true;
-						return;
+						eof = true;
+						break;
 					}
+					continue;
+				}
+
+				SfenSegment seg;
+				if (next_sfen_segment((const u8*)files.back()->get(), file_size, file_compressed, (u64)SFEN_READ_SIZE - total, file_pos, seg))
+				{
+					segments.push_back(seg);
+					total += seg.count;
 				}
 			}
 
+			// 圧縮されたブロックを、学習に用いるスレッド数だけのスレッドで並列に展開する。
+			decode_sfen_segments(segments, decoded, packed_sfens.size());
+			total = 0;
+			for (auto& seg : segments)
+				total += seg.count;
+
 			// この読み込んだ局面データをshuffleする。
-			// random shuffle by Fisher-Yates algorithm
+			// 局面データではなく、コピー先の位置のほうをrandom shuffle by Fisher-Yates algorithm
+
+			dest.resize((size_t)total);
+			for (size_t i = 0; i < dest.size(); ++i)
+				dest[i] = (u32)i;
 
 			if (!no_shuffle)
 			{
-				auto size = sfens.size();
+				auto size = dest.size();
 				for (size_t i = 0; i < size; ++i)
-					swap(sfens[i], sfens[(size_t)(prng.rand((u64)size - i) + i)]);
+					swap(dest[i], dest[(size_t)(prng.rand((u64)size - i) + i)]);
 			}
 
-			// これをTHREAD_BUFFER_SIZEごとの細切れにする。それがsize個あるはず。
-			// SFEN_READ_SIZEはTHREAD_BUFFER_SIZEの倍数であるものとする。
-			ASSERT_LV3((SFEN_READ_SIZE % THREAD_BUFFER_SIZE)==0);
-
-			auto size = size_t(SFEN_READ_SIZE / THREAD_BUFFER_SIZE);
+			// これをTHREAD_BUFFER_SIZEごとの細切れにする。
+			// ファイルの終端では、最後の1つはTHREAD_BUFFER_SIZEより小さくなる。
 			std::vector<PSVector*> ptrs;
-			ptrs.reserve(size);
-
-			for (size_t i = 0; i < size; ++i)
+			for (u64 i = 0; i < total; i += THREAD_BUFFER_SIZE)
 			{
-				// このポインターのdeleteは、受け側で行なう。
-				PSVector* ptr = new PSVector();
-				ptr->resize(THREAD_BUFFER_SIZE);
-				memcpy(&((*ptr)[0]), &sfens[i * THREAD_BUFFER_SIZE], sizeof(PackedSfenValue) * THREAD_BUFFER_SIZE);
-
+				auto ptr = acquire_buffer();
+				ptr->resize((size_t)std::min((u64)THREAD_BUFFER_SIZE, total - i));
 				ptrs.push_back(ptr);
 			}
 
+			// mapしたファイルを先頭から順番に読みながら、shuffle後の位置に書き込む。
+			size_t k = 0;
+			for (auto& seg : segments)
+				for (u64 i = 0; i < seg.count; ++i, ++k)
+				{
+					auto d = dest[k];
+					(*ptrs[d / THREAD_BUFFER_SIZE])[d % THREAD_BUFFER_SIZE] = seg.data[i];
+				}
+
+			// 展開したブロックはもう不要。(capacityは次回のために残す)
+			for (auto& v : decoded)
+				v.clear();
+
+			// 読み終わったファイルは解放する。
+			if (files.size() > 1)
+				files.erase(files.begin(), files.end() - 1);
+
 			// sfensの用意が出来たので、折を見てコピー
 			{
 				std::unique_lock<Mutex> lk(mutex);
@@ -1289,10 +1481,44 @@ struct SfenReader
 				// ポインタをコピーするだけなのでこの時間は無視できるはず…。
 				// packed_sfens_poolの内容を変更するのでmutexのlockが必要。
 
-				for (size_t i = 0; i < size; ++i)
-					packed_sfens_pool.push_back(ptrs[i]);
+				for (auto ptr : ptrs)
+					packed_sfens_pool.push_back(ptr);
+
+				if (eof)
+					end_of_files = true;
+			}
+			cv_pool_filled.notify_all();
+
+			if (eof)
+			{
+				cout << "..end of files." << endl;
+				return;
+			}
+		}
+	}
+
+	// スレッドバッファを1つ確保する。使い終わったものがあればそれを再利用する。
+	PSVector* acquire_buffer()
+	{
+		{
+			std::unique_lock<Mutex> lk(mutex);
+			if (free_buffers.size() != 0)
+			{
+				auto ptr = free_buffers.back();
+				free_buffers.pop_back();
+				return ptr;
 			}
 		}
+		auto ptr = new PSVector();
+		ptr->reserve(THREAD_BUFFER_SIZE);
+		return ptr;
+	}
+
+	// 使い終わったスレッドバッファを返却する。
+	void release_buffer(PSVector* ptr)
+	{
+		std::unique_lock<Mutex> lk(mutex);
+		free_buffers.push_back(ptr);
 	}
 
 	// sfenファイル群
@@ -1308,7 +1534,8 @@ struct SfenReader
 	u64 last_done;
 
 	// total_readがこの値を超えたらupdate_weights()してmseの計算をする。
-	u64 next_update_weights;
+	// thread 0が更新し、他のスレッドからも参照するのでatomicにしておく。
+	atomic<u64> next_update_weights;
 
 	u64 save_count;
 
@@ -1342,22 +1569,31 @@ protected:
 	// ファイル群を読み込んでいき、最後まで到達したか。
 	atomic<bool> end_of_files;
 
-
-	// sfenファイルのハンドル
-	std::fstream fs;
+	// デストラクタでfile workerを停止させるためのフラグ。mutexをlockしてアクセスすること。
+	bool stop_file_worker;
 
 	// 各スレッド用のsfen
-	// (使いきったときにスレッドが自らdeleteを呼び出して開放すべし。)
+	// (使いきったときにスレッドが自らrelease_buffer()を呼び出してfree_buffersに返却すべし。)
 	std::vector<PSVector*> packed_sfens;
 
-	// packed_sfens_poolにアクセスするときのmutex
+	// packed_sfens_pool , free_buffersにアクセスするときのmutex
 	Mutex mutex;
 
+	// packed_sfens_poolに補充されたか、end_of_filesになったときに通知される。
+	ConditionVariable cv_pool_filled;
+
+	// packed_sfens_poolから取り出されて空きができたときに通知される。
+	ConditionVariable cv_pool_free;
+
 	// sfenのpool。fileから読み込むworker threadはここに補充する。
 	// 各worker threadはここから自分のpacked_sfens[thread_id]に充填する。
 	// ※　mutexをlockしてアクセスすること。
 	std::vector<PSVector*> packed_sfens_pool;
 
+	// 使い終わったスレッドバッファ。newしなおさずにfile workerが再利用する。
+	// ※　mutexをlockしてアクセスすること。
+	std::vector<PSVector*> free_buffers;
+
 	// mse計算用の局面を学習に用いないためにhash keyを保持しておく。
 	std::unordered_set<Key> sfen_for_mse_hash;
 };
@@ -1365,7 +1601,7 @@ protected:
 // 複数スレッドでsfenを生成するためのクラス
 struct LearnerThink: public MultiThink
 {
-	LearnerThink(SfenReader& sr_):sr(sr_),stop_flag(false), save_only_once(false)
+	LearnerThink(SfenReader& sr_):sr(sr_),stop_flag(false), save_only_once(false), async_update(false), pause_workers(false)
 	{
 #if defined ( LOSS_FUNCTION_IS_ELMO_METHOD )
 		learn_sum_cross_entropy_eval = 0.0;
@@ -1405,6 +1641,18 @@ struct LearnerThink: public MultiThink
 	// trueだとフォルダを掘らない。
 	bool save_only_once;
 
+	// thread 0がupdate_weights()している間も、他のスレッドは勾配の計算を続けるのか。(learnコマンドのasync_updateオプション)
+	// ・Weight::gへの加算はatomicではないので、update_weights()で勾配を読み出してからクリアするまでの間に
+	// 　加算されたものは失われる。また、評価関数の計算中に評価関数テーブルが書き換えられるので、
+	// 　更新途中の値を読むことがある。(Hogwild!的。そのぶん学習結果は非同期でないときとは変わる)
+	// ・ただし、勾配が古くなりすぎないように、次のmini-batchの分まで溜まったらupdate_weights()の完了を待つ。
+	// ・falseなら、従来通りupdate_weights()の間は他のスレッドを停止させる。(デフォルト)
+	bool async_update;
+
+	// async_updateのときに、thread 0が他のスレッドを一時的に停止させたいときにtrueにする。
+	// (評価関数の保存中と、lossの計算中。lossの計算は他のスレッドにもtaskとして手伝ってもらう)
+	atomic<bool> pause_workers;
+
 	// --- lossの計算
 
 #if defined ( LOSS_FUNCTION_IS_ELMO_METHOD )
@@ -1595,18 +1843,24 @@ void LearnerThink::thread_worker(size_t thread_id)
 	{
 		// mseの表示(これはthread 0のみときどき行う)
 		// ファイルから読み込んだ直後とかでいいような…。
-		if (sr.next_update_weights <= sr.total_done)
+		if (sr.next_update_weights <= sr.total_done || pause_workers)
 		{
 			if (thread_id != 0)
 			{
 				// thread_id == 0以外は、待機。
+				// ただしasync_updateなら、次のmini-batchの分まで勾配が溜まるか、
+				// thread 0から停止を求められるまでは待機せずに勾配の計算を続ける。
+				if (!async_update
+					|| sr.next_update_weights + mini_batch_size <= sr.total_done
+					|| pause_workers)
+				{
+					if (stop_flag)
+						break;
 
-				if (stop_flag)
-					break;
-
-				// rmseの計算などを並列化したいのでtask()が積まれていればそれを処理する。
-				task_dispatcher.on_idle(thread_id);
-				continue;
+					// rmseの計算などを並列化したいのでtask()が積まれていればそれを処理する。
+					task_dispatcher.on_idle(thread_id);
+					continue;
+				}
 			}
 			else
 			{
@@ -1637,7 +1891,9 @@ void LearnerThink::thread_worker(size_t thread_id)
 					sr.save_count = 0;
 
 					// この間、gradientの計算が進むと値が大きくなりすぎて困る気がするので他のスレッドを停止させる。
+					pause_workers = true;
 					save();
+					pause_workers = false;
 				}
 
 				// rmseを計算する。1万局面のサンプルに対して行う。
@@ -1650,7 +1906,10 @@ void LearnerThink::thread_worker(size_t thread_id)
 					u64 done = sr.total_done - sr.last_done;
 
 					// lossの計算
+					// 他のスレッドにもtaskを処理してもらうので、その間は勾配の計算を止めてもらう。
+					pause_workers = true;
 					calc_loss(thread_id , done);
+					pause_workers = false;
 
 					// どこまで集計したかを記録しておく。
 					sr.last_done = sr.total_done;
@@ -1661,6 +1920,8 @@ void LearnerThink::thread_worker(size_t thread_id)
 
 				// main thread以外は、このsr.next_update_weightsの更新を待っていたので
 				// この値が更新されると再度動き始める。
+				// (async_updateのときは、この間に次のmini-batchの分の勾配が溜まっていれば、
+				// 　thread 0は次のループですぐにまたupdate_weights()を行なう)
 			}
 		}
 
@@ -1849,7 +2110,7 @@ void LearnerThink::save()
 	}
 }
 
-// shuffle_files() , shuffle_files_quick()の下請けで、書き出し部分。
+// shuffle_files_quick()の下請けで、書き出し部分。
 // output_file_name : 書き出すファイル名
 // prng : 乱数
 // afs  : それぞれの教師局面ファイルのfstream
@@ -1884,6 +2145,12 @@ void shuffle_write(const string& output_file_name , PRNG& prng , vector<fstream>
 	for (auto c : a_count)
 		sum += c;
 
+	// それぞれのファイルの読み込み用のバッファと、その読み込み位置。書き出し用のバッファ。
+	const size_t read_buf_size = 4096;
+	vector<PSVector> read_buf(afs.size());
+	vector<size_t> read_pos(afs.size());
+	PSVector write_buf;
+
 	while (sum != 0)
 	{
 		auto r = prng.rand(sum);
@@ -1902,96 +2169,417 @@ void shuffle_write(const string& output_file_name , PRNG& prng , vector<fstream>
 		--a_count[n];
 		--sum;
 
-		PackedSfenValue psv;
-		// これ、パフォーマンスあんまりよくないまでまとめて読み書きしたほうが良いのだが…。
-		if (afs[n].read((char*)&psv, sizeof(PackedSfenValue)))
+		// 1局面ずつread()/write()するとパフォーマンスが悪いので、ファイルごとにまとめて読み込んでおき、
+		// 書き出しもまとめて行なう。
+		auto& buf = read_buf[n];
+		if (read_pos[n] == buf.size())
+		{
+			buf.resize(read_buf_size);
+			afs[n].read((char*)buf.data(), sizeof(PackedSfenValue) * buf.size());
+			buf.resize((size_t)(afs[n].gcount() / sizeof(PackedSfenValue)));
+			read_pos[n] = 0;
+			if (buf.size() == 0)
+				continue;
+		}
+
+		write_buf.push_back(buf[read_pos[n]++]);
+		if (write_buf.size() == read_buf_size)
 		{
-			fs.write((char*)&psv, sizeof(PackedSfenValue));
-			++write_sfen_count;
-			print_status();
+			fs.write((char*)write_buf.data(), sizeof(PackedSfenValue) * write_buf.size());
+			write_buf.clear();
 		}
+		++write_sfen_count;
+		print_status();
 	}
+	fs.write((char*)write_buf.data(), sizeof(PackedSfenValue) * write_buf.size());
 	print_status();
 	fs.close();
 	cout << "done!" << endl;
 }
 
+// thread_num個のスレッドでf(thread_id)を並列に実行する。shuffle_files()の下請け。
+template <typename F>
+void run_threads(size_t thread_num, F f)
+{
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < thread_num; ++t)
+		threads.push_back(std::thread([&f, t] { f(t); }));
+	f(0);
+	for (auto& th : threads)
+		th.join();
+}
+
+// in[]をシャッフルしてout[]に書き出す。shuffle_files()の下請け。
+// 各局面をランダムにthread_num個の区画に振り分けて、各区画の中をスレッドごとにFisher-Yatesでシャッフルする。
+// (振り分けが一様ランダムなので、これで全体が一様にシャッフルされたことになる)
+// in[]の内容は破壊される。
+void parallel_shuffle(PSVector& in, PSVector& out, vector<PRNG>& prngs)
+{
+	const size_t thread_num = prngs.size();
+	const u64 size = in.size();
+
+	// 1スレッドなら振り分ける必要はない。
+	if (thread_num == 1)
+	{
+		out.swap(in);
+		for (u64 i = 0; i < size; ++i)
+			swap(out[i], out[(u64)(prngs[0].rand(size - i) + i)]);
+		return;
+	}
+
+	out.resize(in.size());
+
+	// 各局面の振り分け先と、スレッドごと区画ごとの局面数
+	vector<u16> part(in.size());
+	vector<vector<u64>> count(thread_num, vector<u64>(thread_num));
+	auto begin_of = [&](size_t t) { return size * t / thread_num; };
+
+	run_threads(thread_num, [&](size_t t) {
+		for (u64 i = begin_of(t); i < begin_of(t + 1); ++i)
+		{
+			auto j = (u16)prngs[t].rand(thread_num);
+			part[i] = j;
+			++count[t][j];
+		}
+	});
+
+	// 区画jの先頭と、スレッドtが区画jに書き込む位置
+	vector<u64> part_begin(thread_num + 1);
+	vector<vector<u64>> offset(thread_num, vector<u64>(thread_num));
+	u64 sum = 0;
+	for (size_t j = 0; j < thread_num; ++j)
+	{
+		part_begin[j] = sum;
+		for (size_t t = 0; t < thread_num; ++t)
+		{
+			offset[t][j] = sum;
+			sum += count[t][j];
+		}
+	}
+	part_begin[thread_num] = sum;
+
+	run_threads(thread_num, [&](size_t t) {
+		auto& off = offset[t];
+		for (u64 i = begin_of(t); i < begin_of(t + 1); ++i)
+			out[off[part[i]]++] = in[i];
+	});
+
+	run_threads(thread_num, [&](size_t j) {
+		auto p = &out[part_begin[j]];
+		u64 n = part_begin[j + 1] - part_begin[j];
+		for (u64 i = 0; i < n; ++i)
+			swap(p[i], p[(u64)(prngs[j].rand(n - i) + i)]);
+	});
+}
+
 // 教師局面のシャッフル "learn shuffle"コマンドの下請け。
+// 局面がメモリに収まらなくとも良いように、2passでシャッフルする。
+// ・1pass目 : 各局面を一様ランダムにbucket(一時ファイル)に振り分ける。
+// ・2pass目 : bucketを1つずつメモリに読み込み、シャッフルしてから出力ファイルに追記していく。
+// 　各局面のbucketは一様ランダムに選ばれているので、これで全体が一様にシャッフルされたことになる。
+// bucketの数が同時にopenできるファイル数(max_open_buckets)を超えるときは、1pass目ではmax_open_buckets個の
+// bucketに振り分けておき、それぞれを一様ランダムにさらに小さなbucketに分割してから2pass目を行なう。
+// どちらのpassもOptions["Threads"]の数のスレッドで行なう。
+// 
 // output_file_name : シャッフルされた教師局面が書き出される出力ファイル名
-void shuffle_files(const vector<string>& filenames , const string& output_file_name , u64 buffer_size )
+// buffer_size : 1つのbucketの局面数の目安。2pass目ではこの2倍強(1局面あたり82byte)のメモリを使う。
+// tmp_dirs : 一時ファイルを書き出すフォルダ。複数指定すると、bucketを順番に振り分ける。
+// 　　　　　 別々のディスク上のフォルダを指定すれば、I/Oが分散する。
+void shuffle_files(const vector<string>& filenames , const string& output_file_name , u64 buffer_size , const vector<string>& tmp_dirs)
 {
-	// 出力先のフォルダは
-	// tmp/               一時書き出し用
+	const size_t thread_num = std::max((size_t)1, (size_t)(int)Options["Threads"]);
 
-	// テンポラリファイルはbuffer_size局面ずつtmp/フォルダにいったん書き出す。
-	// 例えば、buffer_size = 20Mならば 20M*40bytes = 800MBのバッファが必要。
-	// メモリが少ないPCでは、ここを減らすと良いと思う。
-	// ただし、あまりファイル数が増えるとOSの制限などから同時にopen出来なくなる。
-	// Windowsだと1プロセス512という制約があったはずなので、ここでopen出来るのが500として、
-	// 現在の設定で500ファイル×20M = 10G = 100億局面が限度。
+	// シャッフルするための乱数。スレッドごとに持つ。
+	PRNG prng;
+	vector<PRNG> prngs;
+	for (size_t t = 0; t < thread_num; ++t)
+		prngs.emplace_back(prng.rand<u64>() | 1);
 
-	PSVector buf;
-	buf.resize(buffer_size);
-	// ↑のバッファ、どこまで使ったかを示すマーカー
-	u64 buf_write_marker = 0;
+	// 教師局面の総数を数えて、bucketの数を決める。
+	// 圧縮形式のファイルは、ブロックのヘッダーだけを辿って数える。
+	u64 total_sfen_count = 0;
+	for (auto filename : filenames)
+	{
+		FileReader fr;
+		if (!fr.open(filename))
+			continue;
+
+		PackedSfenBlockHeader h;
+		u64 count = 0;
+		if (fr.read(0, &h, sizeof(h)) == sizeof(h) && check_sfen_block(&h, (size_t)fr.size()) != 0)
+		{
+			for (u64 pos = 0; fr.read(pos, &h, sizeof(h)) == sizeof(h); )
+			{
+				u32 n;
+				auto block_size = check_sfen_block(&h, (size_t)(fr.size() - pos), &n);
+				if (block_size == 0)
+					break;
+				count += n;
+				pos += block_size;
+			}
+		}
+		else
+			count = fr.size() / sizeof(PackedSfenValue);
 
-	// 書き出すファイル名(連番なのでインクリメンタルカウンター)
-	u64 write_file_count = 0;
+		cout << filename << " = " << count << " sfens." << endl;
+		total_sfen_count += count;
+	}
 
-	// シャッフルするための乱数
-	PRNG prng;
+	// 同時にopenしておくbucketのファイルの数の上限。
+	// Linuxのulimit -nの既定値は1024、WindowsのCRTのFILE*は512個までなので、それより十分少なくしておく。
+	const u64 max_open_buckets = 256;
+
+	// 1pass目で振り分けるbucketの数(bucket_count)と、2pass目の前にそれぞれのbucketをさらに分割する数(split_count)
+	// 分割したあとのbucketの局面数がbuffer_size程度になるようにする。
+	buffer_size = std::max(buffer_size, (u64)1);
+	const u64 needed_buckets = std::max((total_sfen_count + buffer_size - 1) / buffer_size, (u64)1);
+	const u64 bucket_count = std::min(needed_buckets, max_open_buckets);
+	const u64 split_count = std::min((needed_buckets + bucket_count - 1) / bucket_count, max_open_buckets);
+	cout << "total " << total_sfen_count << " sfens , " << bucket_count * split_count << " buckets";
+	if (split_count > 1)
+		cout << " (" << bucket_count << " x " << split_count << ")";
+	cout << "." << endl;
 
 	// テンポラリファイルの名前を生成する
-	auto make_filename = [](u64 i)
+	for (auto& dir : tmp_dirs)
+		MKDIR(dir);
+	auto make_filename = [&](u64 i)
+	{
+		return path_combine(tmp_dirs[i % tmp_dirs.size()], to_string(i) + ".bin");
+	};
+	auto make_split_filename = [&](u64 i, u64 j)
 	{
-		return "tmp/" + to_string(i) + ".bin";
+		return path_combine(tmp_dirs[(i * split_count + j) % tmp_dirs.size()], to_string(i) + "_" + to_string(j) + ".bin");
 	};
 
-	// 書き出したtmp/フォルダのファイル、それぞれに格納されている教師局面の数
-	vector<u64> a_count;
+	// --- 1pass目
 
-	auto write_buffer = [&](u64 size)
+	// 各bucketのファイル。
+	// 複数のスレッドから追記するので、書き出すときはbucketごとにlockする。
+	vector<FILE*> bucket_files(bucket_count);
+	vector<Mutex> bucket_mutex(bucket_count);
+	for (u64 i = 0; i < bucket_count; ++i)
 	{
-		// buf[0]～buf[size-1]までをshuffle
-		for (u64 i = 0; i < size; ++i)
-			swap(buf[i], buf[(u64)(prng.rand(size - i) + i)]);
+		bucket_files[i] = fopen(make_filename(i).c_str(), "wb");
+		if (bucket_files[i] == nullptr)
+		{
+			cout << "Error! : can't create " << make_filename(i) << endl;
+			for (u64 j = 0; j < i; ++j)
+				fclose(bucket_files[j]);
+			return;
+		}
+	}
 
-		// ファイルに書き出す
-		fstream fs;
-		fs.open(make_filename(write_file_count++), ios::out | ios::binary);
-		fs.write((char*)&buf[0], size * sizeof(PackedSfenValue));
-		fs.close();
-		a_count.push_back(size);
+	// 1つのスレッドが一度に振り分ける局面数
+	const u64 chunk_size = 1000000;
 
-		buf_write_marker = 0;
-		cout << ".";
-	};
+	// 入力ファイルは1つずつmapして、chunk_size局面ずつスレッドに割り振る。
+	// 各スレッドは、(圧縮されていれば展開して、)局面をbucketごとに並び替えてから、各bucketのファイルに追記する。
+	for (auto filename : filenames)
+	{
+		LargeMemory mem;
+		size_t size;
+		if (mem.map_file(filename, size) == nullptr)
+		{
+			cout << "Error! : can't read " << filename << endl;
+			continue;
+		}
+		cout << "read : " << filename << endl;
 
-	MKDIR("tmp");
+		auto base = (const u8*)mem.get();
+		bool compressed = check_sfen_block(base, size) != 0;
 
-	// 10M局面の細切れファイルとしてシャッフルして書き出す。
-	for (auto filename : filenames)
+		// chunk_size局面ずつに区切る。
+		vector<vector<SfenSegment>> chunks;
+		for (u64 pos = 0; pos < size; )
+		{
+			vector<SfenSegment> chunk;
+			SfenSegment seg;
+			u64 n = 0;
+			while (n < chunk_size && next_sfen_segment(base, size, compressed, chunk_size - n, pos, seg))
+			{
+				chunk.push_back(seg);
+				n += seg.count;
+			}
+			if (chunk.empty())
+				break;
+			chunks.push_back(std::move(chunk));
+		}
+
+		std::atomic<size_t> next_chunk(0);
+		run_threads(thread_num, [&](size_t t) {
+			vector<PSVector> decoded;
+			PSVector sorted;
+			vector<u32> bucket;
+			vector<u64> count(bucket_count + 1);
+
+			for (size_t c; (c = next_chunk++) < chunks.size(); )
+			{
+				auto& segments = chunks[c];
+				decode_sfen_segments(segments, decoded, 1);
+
+				// 振り分け先のbucketを決めて、bucketごとに並び替える。(counting sort)
+				bucket.clear();
+				std::fill(count.begin(), count.end(), 0);
+				for (auto& s : segments)
+					for (u64 i = 0; i < s.count; ++i)
+					{
+						auto b = (u32)prngs[t].rand(bucket_count);
+						bucket.push_back(b);
+						++count[b + 1];
+					}
+				for (u64 b = 0; b < bucket_count; ++b)
+					count[b + 1] += count[b];
+
+				sorted.resize(bucket.size());
+				auto offset = count;
+				size_t k = 0;
+				for (auto& s : segments)
+					for (u64 i = 0; i < s.count; ++i)
+						sorted[offset[bucket[k++]]++] = s.data[i];
+
+				for (u64 b = 0; b < bucket_count; ++b)
+				{
+					auto m = count[b + 1] - count[b];
+					if (m == 0)
+						continue;
+
+					std::unique_lock<Mutex> lk(bucket_mutex[b]);
+					fwrite(&sorted[count[b]], sizeof(PackedSfenValue), (size_t)m, bucket_files[b]);
+				}
+				cout << ".";
+			}
+		});
+		cout << endl;
+	}
+
+	for (auto fp : bucket_files)
+		fclose(fp);
+
+	// 2pass目で読み込むbucketのファイル名
+	vector<string> final_filenames;
+
+	if (split_count == 1)
 	{
-		fstream fs(filename, ios::in | ios::binary);
-		while (fs.read((char*)&buf[buf_write_marker], sizeof(PackedSfenValue)))
-			if (++buf_write_marker == buffer_size)
-				write_buffer(buffer_size);
+		for (u64 i = 0; i < bucket_count; ++i)
+			final_filenames.push_back(make_filename(i));
 	}
+	else {
 
-	// バッファにまだ残っている分があるならそれも書き出す。
-	if (buf_write_marker != 0)
-		write_buffer(buf_write_marker);
+		// --- 1pass目で振り分けたbucketを、それぞれsplit_count個のbucketに分割する。
+		// 1つずつbuffer_size局面ごとに読み込み、1pass目と同じくbucketごとに並び替えてから追記する。
+		// 同時にopenしておくのは、分割先のsplit_count個のファイルだけ。
 
-	// シャッフルされたファイルがwrite_file_count個だけ書き出された。
-	// 2pass目として、これをすべて同時にオープンし、ランダムに1つずつ選択して1局面ずつ読み込めば
-	// これにてシャッフルされたことになる。
+		PSVector buf, sorted;
+		vector<u32> bucket;
+		vector<u64> count(split_count + 1);
+		vector<FILE*> split_files(split_count);
 
-	vector<fstream> afs;
-	for (u64 i = 0; i < write_file_count; ++i)
-		afs.emplace_back(fstream(make_filename(i),ios::in | ios::binary));
+		for (u64 i = 0; i < bucket_count; ++i)
+		{
+			auto filename = make_filename(i);
+			FILE* in_fp = fopen(filename.c_str(), "rb");
+			if (in_fp == nullptr)
+			{
+				cout << "Error! : can't read " << filename << endl;
+				return;
+			}
+			for (u64 j = 0; j < split_count; ++j)
+			{
+				auto split_filename = make_split_filename(i, j);
+				split_files[j] = fopen(split_filename.c_str(), "wb");
+				if (split_files[j] == nullptr)
+				{
+					cout << "Error! : can't create " << split_filename << endl;
+					for (u64 k = 0; k < j; ++k)
+						fclose(split_files[k]);
+					fclose(in_fp);
+					return;
+				}
+				final_filenames.push_back(split_filename);
+			}
 
-	// 下請け関数に丸投げして終わり。
-	shuffle_write(output_file_name, prng, afs, a_count);
+			buf.resize((size_t)buffer_size);
+			size_t n;
+			while ((n = fread(buf.data(), sizeof(PackedSfenValue), buf.size(), in_fp)) != 0)
+			{
+				bucket.resize(n);
+				std::fill(count.begin(), count.end(), 0);
+				for (size_t k = 0; k < n; ++k)
+				{
+					auto b = (u32)prngs[0].rand(split_count);
+					bucket[k] = b;
+					++count[b + 1];
+				}
+				for (u64 b = 0; b < split_count; ++b)
+					count[b + 1] += count[b];
+
+				sorted.resize(n);
+				auto offset = count;
+				for (size_t k = 0; k < n; ++k)
+					sorted[offset[bucket[k]]++] = buf[k];
+
+				for (u64 b = 0; b < split_count; ++b)
+				{
+					auto m = count[b + 1] - count[b];
+					if (m != 0)
+						fwrite(&sorted[count[b]], sizeof(PackedSfenValue), (size_t)m, split_files[b]);
+				}
+			}
+
+			for (auto fp : split_files)
+				fclose(fp);
+			fclose(in_fp);
+			remove(filename.c_str());
+			cout << "split : " << filename << endl;
+		}
+	}
+
+	// --- 2pass目
+
+	// bucketの読み込みとシャッフル後の書き出しは別スレッドで並行して行なう。
+	// (bucket i をシャッフルしたものを書き出している間に、bucket i+1 を読み込む)
+
+	std::cout << "write : " << output_file_name << endl;
+	fstream fs(output_file_name, ios::out | ios::binary);
+
+	PSVector in, out;
+	auto load_bucket = [&](u64 i)
+	{
+		auto& filename = final_filenames[i];
+		in.clear();
+		read_file_to_memory(filename, [&](u64 size) {
+			in.resize((size_t)(size / sizeof(PackedSfenValue)));
+			return (void*)in.data();
+		});
+		remove(filename.c_str());
+	};
+
+	u64 write_sfen_count = 0;
+	std::thread write_thread;
+	const u64 final_bucket_count = final_filenames.size();
+	load_bucket(0);
+	for (u64 i = 0; i < final_bucket_count; ++i)
+	{
+		if (write_thread.joinable())
+			write_thread.join();
+
+		parallel_shuffle(in, out, prngs);
+
+		write_thread = std::thread([&] {
+			fs.write((const char*)out.data(), sizeof(PackedSfenValue) * out.size());
+			write_sfen_count += out.size();
+			cout << write_sfen_count << " / " << total_sfen_count << endl;
+		});
+
+		if (i + 1 < final_bucket_count)
+			load_bucket(i + 1);
+	}
+	if (write_thread.joinable())
+		write_thread.join();
+
+	fs.close();
+	cout << "done!" << endl;
 }
 
 // 教師局面のシャッフル "learn shuffleq"コマンドの下請け。
@@ -2116,7 +2704,9 @@ void learn(Position&, istringstream& is)
 
 	// 通常シャッフル
 	bool shuffle_normal = false;
-	u64 buffer_size = 20000000;
+	u64 buffer_size = 10000000;
+	// 通常シャッフルのときに一時ファイルを書き出すフォルダ(複数指定可)
+	vector<string> tmp_dirs;
 	// それぞれのファイルがシャッフルされていると仮定しての高速シャッフル
 	bool shuffle_quick = false;
 	// メモリにファイルを丸読みしてシャッフルする機能。(要、ファイルサイズのメモリ)
@@ -2130,6 +2720,9 @@ void learn(Position&, istringstream& is)
 	// 評価関数ファイルの保存は終了間際の1回に限定するかのフラグ。
 	bool save_only_once = false;
 
+	// update_weights()の間も他のスレッドは勾配の計算を続けるか。
+	bool async_update = false;
+
 	// 教師局面を先読みしている分に関してシャッフルする。(1000万局面単位ぐらいのシャッフル)
 	// 事前にシャッフルされているファイルを渡すならオンにすれば良い。
 	bool no_shuffle = false;
@@ -2203,12 +2796,14 @@ void learn(Position&, istringstream& is)
 		// シャッフル関連
 		else if (option == "shuffle")	shuffle_normal = true;
 		else if (option == "buffer_size") is >> buffer_size;
+		else if (option == "tmpdir") { string dir; is >> dir; tmp_dirs.push_back(dir); }
 		else if (option == "shuffleq")	shuffle_quick = true;
 		else if (option == "shufflem")	shuffle_on_memory = true;
 		else if (option == "output_file_name") is >> output_file_name;
 
 		else if (option == "eval_limit") is >> eval_limit;
 		else if (option == "save_only_once") save_only_once = true;
+		else if (option == "async_update") is >> async_update;
 		else if (option == "no_shuffle") no_shuffle = true;
 
 		// さもなくば、それはファイル名である。
@@ -2277,9 +2872,15 @@ void learn(Position&, istringstream& is)
 	// シャッフルモード
 	if (shuffle_normal)
 	{
+		if (tmp_dirs.empty())
+			tmp_dirs.push_back("tmp");
 		cout << "buffer_size     : " << buffer_size << endl;
+		cout << "tmp dir         : ";
+		for (auto& dir : tmp_dirs)
+			cout << dir << " , ";
+		cout << endl;
 		cout << "shuffle mode.." << endl;
-		shuffle_files(filenames,output_file_name , buffer_size);
+		shuffle_files(filenames,output_file_name , buffer_size , tmp_dirs);
 		return;
 	}
 	if (shuffle_quick)
@@ -2298,6 +2899,7 @@ void learn(Position&, istringstream& is)
 	cout << "loop              : " << loop << endl;
 	cout << "eval_limit        : " << eval_limit << endl;
 	cout << "save_only_once    : " << (save_only_once ? "true" : "false") << endl;
+	cout << "async_update      : " << (async_update ? "true" : "false") << endl;
 	cout << "no_shuffle        : " << (no_shuffle ? "true" : "false") << endl;
 
 	// ループ回数分だけファイル名を突っ込む。
@@ -2307,6 +2909,10 @@ void learn(Position&, istringstream& is)
 			sr.filenames.push_back(path_combine(base_dir, *it));
 
 	cout << "Gradient Method   : " << LEARN_UPDATE      << endl;
+#if defined (ADA_GRAD_UPDATE) || defined(ADA_PROP_UPDATE)
+	cout << "AdaGrad g2 type   : " << LEARN_G2_TYPE_NAME << endl;
+#endif
+	cout << "sizeof(Weight)    : " << sizeof(EvalLearningTools::Weight) << endl;
 	cout << "Loss Function     : " << LOSS_FUNCTION     << endl;
 	cout << "mini-batch size   : " << mini_batch_size   << endl;
 	cout << "learning rate     : " << eta1 << " , " << eta2 << " , " << eta3 << endl;
@@ -2355,6 +2961,7 @@ void learn(Position&, istringstream& is)
 	learn_think.discount_rate = discount_rate;
 	learn_think.eval_limit = eval_limit;
 	learn_think.save_only_once = save_only_once;
+	learn_think.async_update = async_update;
 	learn_think.sr.no_shuffle = no_shuffle;
 	learn_think.freeze = freeze;
 
@@ -375,6 +375,76 @@ namespace EvalLearningTools
 
 	}
 
+	// --- GradDirtyMap
+
+	void GradDirtyMap::resize(u64 size)
+	{
+		u64 words = (size + 63) / 64;
+		bits.reset(new std::atomic<u64>[words]);
+		for (u64 i = 0; i < words; ++i)
+			bits[i] = 0;
+		snapshot.assign(words, 0);
+	}
+
+	void GradDirtyMap::swap()
+	{
+		for (u64 i = 0; i < snapshot.size(); ++i)
+			// 勾配が加算されていないwordがほとんどなので、そこはlock命令を使わずに済ませる。
+			snapshot[i] = bits[i].load(std::memory_order_relaxed) ? bits[i].exchange(0) : 0;
+	}
+
+	bool GradDirtyMap::to_update_index(u64& index) const
+	{
+		// 次元下げしたindexを列挙する。
+		u64 ids[std::max({ KK_LOWER_COUNT , KKP_LOWER_COUNT , KPP_LOWER_COUNT })];
+		int n;
+		if (KK::is_ok(index))
+		{
+			KK a[KK_LOWER_COUNT];
+			KK::fromIndex(index).toLowerDimensions(a);
+			for (n = 0; n < KK_LOWER_COUNT; ++n)
+				ids[n] = a[n].toIndex();
+		}
+		else if (KKP::is_ok(index))
+		{
+			KKP a[KKP_LOWER_COUNT];
+			KKP::fromIndex(index).toLowerDimensions(a);
+			for (n = 0; n < KKP_LOWER_COUNT; ++n)
+				ids[n] = a[n].toIndex();
+		}
+		else if (KPP::is_ok(index))
+		{
+			KPP a[KPP_LOWER_COUNT];
+			KPP::fromIndex(index).toLowerDimensions(a);
+			for (n = 0; n < KPP_LOWER_COUNT; ++n)
+				ids[n] = a[n].toIndex();
+		}
+		else
+			return true;
+
+		// 自分より小さなindexのbitが立っていれば、そちらで処理する。
+		u64 min_index = index;
+		for (int i = 0; i < n; ++i)
+		{
+			if (ids[i] < index && test(ids[i]))
+				return false;
+			min_index = std::min(min_index, ids[i]);
+		}
+		index = min_index;
+		return true;
+	}
+
+	// --- AdaGradのg2を格納する型
+
+	float g2_log8_table[256];
+
+	void init_g2_log8_table()
+	{
+		g2_log8_table[0] = 0;
+		for (int q = 1; q < 256; ++q)
+			g2_log8_table[q] = (float)std::exp2((q - 1) / 5.0 - 20);
+	}
+
 	// このEvalLearningTools全体の初期化
 	void init()
 	{
@@ -397,6 +467,8 @@ namespace EvalLearningTools
 
 			init_min_index_flag();
 
+			init_g2_log8_table();
+
 			std::cout << "done." << std::endl;
 
 			first = false;
@@ -6,6 +6,9 @@
 #include "learn.h"
 #if defined (EVAL_LEARN)
 
+#include <atomic>
+#include <memory>
+
 #if defined(SGD_UPDATE) || defined(USE_KPPP_MIRROR_WRITE)
 #include "../misc.h"  // PRNG , my_insertion_sort
 #endif
@@ -30,6 +33,134 @@ namespace EvalLearningTools
 	// 学習の開始までに必ず一度呼び出すこと。
 	void init();
 
+	// -------------------------------------------------
+	//       AdaGradのg2を格納する型
+	// -------------------------------------------------
+
+	// learn.hのLEARN_G2_*の設定に従う。floatとの相互変換ができれば良い。
+
+	// 確率的丸めに用いる乱数。スレッドごとに持つ。(xorshift32)
+	inline u32 g2_rounding_rand()
+	{
+		static thread_local u32 s = 2463534242UL;
+		s ^= s << 13; s ^= s >> 17; s ^= s << 5;
+		return s;
+	}
+
+	inline u32 float_as_u32(float f) { u32 n; memcpy(&n, &f, sizeof(n)); return n; }
+	inline float u32_as_float(u32 n) { float f; memcpy(&f, &n, sizeof(f)); return f; }
+
+	// IEEE 754の半精度浮動小数。g2 >= 0なので符号は考慮しない。
+	struct G2Float16
+	{
+		operator float() const
+		{
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(USE_AVX2))
+			return _cvtsh_ss(v);
+#else
+			u32 e = (v >> 10) & 0x1f;
+			u32 m = v & 0x3ff;
+			if (e == 0)
+				return (float)m * (1.0f / (1 << 24)); // 非正規化数
+			return u32_as_float(((e - 15 + 127) << 23) | (m << 13));
+#endif
+		}
+
+		G2Float16& operator = (float f)
+		{
+			const float max_value = 65504.0f;
+			if (!(f > 0))
+				v = 0;
+			else if (f >= max_value)
+				v = 0x7bff;
+			else
+			{
+				// 仮数部の切り捨てられる13bitに乱数を足してから切り捨てる。
+				float f2 = (std::min)(u32_as_float(float_as_u32(f) + (g2_rounding_rand() & 0x1fff)), max_value);
+				u32 n = float_as_u32(f2);
+				s32 e = (s32)(n >> 23) - 127 + 15;
+				if (e <= 0)
+					// 非正規化数の範囲。2^-24単位で確率的に丸める。(1024になったときは最小の正規化数と同じbit表現になる)
+					v = (u16)(f * (float)(1 << 24) + (float)(g2_rounding_rand() >> 8) * (1.0f / (1 << 24)));
+				else
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(USE_AVX2))
+					v = _cvtss_sh(f2, _MM_FROUND_TO_ZERO);
+#else
+					v = (u16)((e << 10) | ((n >> 13) & 0x3ff));
+#endif
+			}
+			return *this;
+		}
+
+	private:
+		u16 v;
+	};
+
+	// floatの上位16bit
+	struct G2BFloat16
+	{
+		operator float() const { return u32_as_float((u32)v << 16); }
+
+		G2BFloat16& operator = (float f)
+		{
+			v = (f > 0) ? (u16)((float_as_u32(f) + (g2_rounding_rand() & 0xffff)) >> 16) : 0;
+			return *this;
+		}
+
+	private:
+		u16 v;
+	};
+
+	// log2(g2)を量子化した8bit。0は0を表し、q = 1..255は2^((q-1)/5 - 20)を表す。
+	// 変換テーブルはinit()で初期化される。
+	extern float g2_log8_table[256];
+
+	struct G2Log8
+	{
+		operator float() const { return g2_log8_table[v]; }
+
+		G2Log8& operator = (float f)
+		{
+			// 隣接する2つの値のどちらかに、floatでの期待値が変わらないように確率的に丸める。
+			int q0;
+			if (!(f > g2_log8_table[1]))
+				q0 = 0;
+			else
+			{
+				q0 = (int)(std::log2(f) * 5) + 101;
+				q0 = (std::min)((std::max)(q0, 1), 255);
+				if (f < g2_log8_table[q0]) --q0; // log2()の誤差の補正
+			}
+
+			if (q0 == 255)
+				v = 255;
+			else
+			{
+				float lo = g2_log8_table[q0], hi = g2_log8_table[q0 + 1];
+				float p = (std::max)(f - lo, 0.0f) / (hi - lo);
+				v = (u8)(q0 + ((float)(g2_rounding_rand() >> 8) * (1.0f / (1 << 24)) < p ? 1 : 0));
+			}
+			return *this;
+		}
+
+	private:
+		u8 v;
+	};
+
+#if defined(LEARN_G2_FLOAT16)
+	typedef G2Float16 LearnG2Type;
+#define LEARN_G2_TYPE_NAME "float16"
+#elif defined(LEARN_G2_BFLOAT16)
+	typedef G2BFloat16 LearnG2Type;
+#define LEARN_G2_TYPE_NAME "bfloat16"
+#elif defined(LEARN_G2_LOG8)
+	typedef G2Log8 LearnG2Type;
+#define LEARN_G2_TYPE_NAME "log8"
+#else
+	typedef LearnFloatType LearnG2Type;
+#define LEARN_G2_TYPE_NAME "LearnFloatType"
+#endif
+
 	// -------------------------------------------------
 	//       勾配等を格納している学習用の配列
 	// -------------------------------------------------
@@ -92,7 +223,8 @@ namespace EvalLearningTools
 #if defined (ADA_GRAD_UPDATE) || defined(ADA_PROP_UPDATE)
 
 		// AdaGradのg2
-		LearnFloatType g2;
+		// learn.hの設定によってはfloatより小さな型で持っている。
+		LearnG2Type g2;
 
 		// vの固定小数表現 8-bits。(vをfloatで持つのもったいないのでvの補助bitとして小数部を持つ)
 		// 何bit持つかは、V_FRACTION_BITSの設定で変更できる。
@@ -114,13 +246,15 @@ namespace EvalLearningTools
 			if (g == LearnFloatType(0))
 				return;
 
-			g2 += g * g;
+			// g2はfloatより小さな型で持っていることがあるので、計算はLearnFloatTypeで行なう。
+			LearnFloatType g2_ = (LearnFloatType)g2 + g * g;
 
 #if defined(ADA_PROP_UPDATE)
 			// 少しずつ減衰させることで、学習が硬直するのを防ぐ。
 			// (0.99)^100 ≒ 0.366
-			g2 = LearnFloatType(g2 * 0.99);
+			g2_ = LearnFloatType(g2_ * 0.99);
 #endif
+			g2 = g2_;
 
 			// v8は小数部8bit(V_FRACTION_BITS==8のとき)を含んでいるのでこれを復元する。
 			// 128倍にすると、-1を保持できなくなるので127倍にしておく。
@@ -132,7 +266,7 @@ namespace EvalLearningTools
 
 			double V = v + ((double)v_frac / m);
 
-			V -= eta * (double)g / sqrt((double)g2 + epsilon);
+			V -= eta * (double)g / sqrt((double)g2_ + epsilon);
 
 			// Vの値を型の範囲に収まるように制限する。
 			// ちなみに、windows.hがmin,maxマクロを定義してしまうのでそれを回避するために、
@@ -844,6 +978,59 @@ namespace EvalLearningTools
 		os << "KPPP(" << rhs.king() << "," << rhs.piece0() << "," << rhs.piece1() << "," << rhs.piece2() << ")";
 		return os;
 	}
+
+	// -------------------------------------------------
+	//     勾配が加算されたindexを記録しておくbitmap
+	// -------------------------------------------------
+
+	// update_weights()でWeight配列全体を走査せずに、前回のupdate_weights()以降に
+	// 勾配が加算されたindexだけを処理するためのもの。indexはKK/KKP/KPP(/KPPP)を直列化したindex。
+	// ・add_grad()で勾配を加算するときに、そのindexをset()で記録しておく。
+	// ・update_weights()の開始時にswap()で記録をsnapshotに移し、記録用はクリアする。
+	// 　update_weights()の最中に(learnコマンドのasync_updateで)加算された勾配は、
+	// 　記録用のほうに残るので次回のupdate_weights()で処理される。
+	// ・次元下げしたもののうちどれか1つにでも勾配が加算されていれば、そのなかで一番小さなindexを処理する必要がある。
+	// 　それをちょうど1回だけ処理するために、snapshotで立っているbitのindexをto_update_index()で変換してから用いる。
+	struct GradDirtyMap
+	{
+		// [0,size)のindexを記録できるようにする。記録はクリアされる。
+		void resize(u64 size);
+
+		// indexに勾配を加算したことを記録する。複数スレッドから同時に呼び出して良い。
+		void set(u64 index)
+		{
+			auto& w = bits[index / 64];
+			const u64 mask = 1ULL << (index % 64);
+
+			// すでにbitが立っていることがほとんどなので、そのときはlock命令を使わずに済ませる。
+			if (!(w.load(std::memory_order_relaxed) & mask))
+				w.fetch_or(mask, std::memory_order_relaxed);
+		}
+
+		// 記録をsnapshotに移して、記録用をクリアする。
+		// update_weights()の開始時に1スレッドから呼び出す。
+		void swap();
+
+		// snapshotのword数と、i番目のword(indexが[i*64, i*64+63]のbit)
+		u64 word_count() const { return (u64)snapshot.size(); }
+		u64 word(u64 i) const { return snapshot[i]; }
+
+		// snapshotでindexのbitが立っているか。
+		bool test(u64 index) const { return (snapshot[index / 64] >> (index % 64)) & 1; }
+
+		// snapshotで立っているbitのindexを、update_weights()で処理すべきindexに変換する。
+		// ・indexが、次元下げしたもののうちsnapshotでbitが立っている一番小さなindexであるときだけtrueを返し、
+		// 　indexを次元下げしたもののなかで一番小さなindex(min_index_flagが立っているindex)に書き換える。
+		// ・KPP::max_index()以上のindex(KPPP)は、次元下げをしないのでそのままtrueを返す。
+		bool to_update_index(u64& index) const;
+
+	private:
+		// 記録用
+		std::unique_ptr<std::atomic<u64>[]> bits;
+
+		// swap()した時点の記録
+		std::vector<u64> snapshot;
+	};
 }
 
 #endif // defined (EVAL_LEARN)
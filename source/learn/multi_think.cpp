@@ -27,9 +27,8 @@ void MultiThink::go_think()
 	// あとでOptionsの設定を復元するためにコピーで保持しておく。
 	auto oldOptions = Options;
 
-	// 定跡を用いる場合、on the flyで行なうとすごく時間がかかる＆ファイルアクセスを行なう部分が
-	// thread safeではないので、メモリに丸読みされている状態であることをここで保証する。
-	Options["BookOnTheFly"] = "false";
+	// 定跡をon the flyで用いる場合も、ファイルは位置を指定して読み込むのでthread safeである。
+	// 巨大な定跡をメモリに丸読みせずに済むように、Options["BookOnTheFly"]の設定はそのまま尊重する。
 
 	// 評価関数の読み込み等
 	// learnコマンドの場合、評価関数読み込み後に評価関数の値を補正している可能性があるので、
@@ -0,0 +1,280 @@
+﻿#include "sfen_container.h"
+
+#if defined(EVAL_LEARN)
+
+#include <cstring>
+#include <memory>
+#include <algorithm>
+
+namespace Learner
+{
+	namespace {
+
+		const char BLOCK_MAGIC[8] = { 'Y','P','S','V','B','L','K','1' };
+
+		// -----------------------------------
+		//   PackedSfenValueと差分表現との変換
+		// -----------------------------------
+
+		const int RECORD_SIZE = (int)sizeof(PackedSfenValue);
+		static_assert(sizeof(PackedSfenValue) == 40, "sizeof(PackedSfenValue) must be 40");
+
+		// 符号付きの値を、0に近いほど小さな符号なしの値に写像する。(0,-1,1,-2,2,..→0,1,2,3,4,..)
+		u16 zigzag(s16 v) { return (u16)(((u16)v << 1) ^ (u16)(v >> 15)); }
+		s16 unzigzag(u16 v) { return (s16)((v >> 1) ^ (u16)-(s16)(v & 1)); }
+
+		void store16(u8* p, u16 v) { p[0] = (u8)v; p[1] = (u8)(v >> 8); }
+		u16 load16(const u8* p) { return (u16)(p[0] | (p[1] << 8)); }
+
+		// curを、1つ前の局面prevとの差分を表す40byteの列に変換する。
+		// 同じ対局の連続する局面であれば、ほとんどのbyteが0になる。
+		// ・sfen     : prevとのxor
+		// ・score    : 手番が入れ替わるので、符号を反転させたprevのscoreとの差
+		// ・gamePly  : prevの手数+1との差
+		// ・game_result : 手番が入れ替わるので、符号を反転させたprevの値との差
+		void to_residual(const PackedSfenValue& cur, const PackedSfenValue& prev, u8* r)
+		{
+			for (int i = 0; i < 32; ++i)
+				r[i] = cur.sfen.data[i] ^ prev.sfen.data[i];
+			store16(r + 32, zigzag((s16)(cur.score + prev.score)));
+			store16(r + 34, cur.move);
+			store16(r + 36, zigzag((s16)(cur.gamePly - prev.gamePly - 1)));
+			r[38] = (u8)(cur.game_result + prev.game_result);
+			r[39] = cur.padding ^ prev.padding;
+		}
+
+		// to_residual()の逆変換
+		void from_residual(const u8* r, const PackedSfenValue& prev, PackedSfenValue& cur)
+		{
+			for (int i = 0; i < 32; ++i)
+				cur.sfen.data[i] = r[i] ^ prev.sfen.data[i];
+			cur.score = (s16)(unzigzag(load16(r + 32)) - prev.score);
+			cur.move = load16(r + 34);
+			cur.gamePly = (u16)(unzigzag(load16(r + 36)) + prev.gamePly + 1);
+			cur.game_result = (s8)(r[38] - prev.game_result);
+			cur.padding = r[39] ^ prev.padding;
+		}
+
+		u64 fnv1a(const void* data, size_t size, u64 h = 14695981039346656037ULL)
+		{
+			auto p = (const u8*)data;
+			for (size_t i = 0; i < size; ++i)
+				h = (h ^ p[i]) * 1099511628211ULL;
+			return h;
+		}
+
+		// -----------------------------------
+		//    適応型の二値range coder
+		// -----------------------------------
+
+		// LZMAのものと同じ方式。確率は11bitの固定小数で表現し、1bit符号化するごとに1/32だけ寄せる。
+		const int PROB_BITS = 11;
+		const u16 PROB_INIT = 1 << (PROB_BITS - 1);
+		const int MOVE_BITS = 5;
+		const u32 TOP = 1 << 24;
+
+		// 差分表現の各byteを、そのbyteの位置と、1つ前のbyteが0であったかを文脈として
+		// 8bitのbit treeで符号化するためのモデル
+		struct Model
+		{
+			Model() { std::fill(&probs[0][0][0], &probs[0][0][0] + sizeof(probs) / sizeof(u16), PROB_INIT); }
+			u16* get(int pos, u8 prev_byte) { return probs[pos][prev_byte != 0]; }
+
+			u16 probs[RECORD_SIZE][2][256];
+		};
+
+		struct RangeEncoder
+		{
+			RangeEncoder(std::vector<u8>& out_) : out(out_) {}
+
+			void encode_bit(u16& prob, int bit)
+			{
+				u32 bound = (range >> PROB_BITS) * prob;
+				if (!bit)
+				{
+					range = bound;
+					prob += ((1 << PROB_BITS) - prob) >> MOVE_BITS;
+				}
+				else {
+					low += bound;
+					range -= bound;
+					prob -= prob >> MOVE_BITS;
+				}
+				while (range < TOP)
+				{
+					range <<= 8;
+					shift_low();
+				}
+			}
+
+			void encode_byte(u16* probs, u8 b)
+			{
+				u32 m = 1;
+				for (int i = 7; i >= 0; --i)
+				{
+					int bit = (b >> i) & 1;
+					encode_bit(probs[m], bit);
+					m = (m << 1) | bit;
+				}
+			}
+
+			void flush()
+			{
+				for (int i = 0; i < 5; ++i)
+					shift_low();
+			}
+
+		private:
+			void shift_low()
+			{
+				// 桁上がりが確定するまで0xFFの並びを保留しておく。
+				if ((u32)low < 0xFF000000u || (low >> 32) != 0)
+				{
+					u8 carry = (u8)(low >> 32);
+					u8 temp = cache;
+					do {
+						out.push_back((u8)(temp + carry));
+						temp = 0xFF;
+					} while (--cache_size != 0);
+					cache = (u8)(low >> 24);
+				}
+				cache_size++;
+				low = (low & 0x00FFFFFF) << 8;
+			}
+
+			std::vector<u8>& out;
+			u64 low = 0;
+			u32 range = 0xFFFFFFFF;
+			u8 cache = 0;
+			u64 cache_size = 1;
+		};
+
+		struct RangeDecoder
+		{
+			// 壊れたデータであってもp_end以降は読まない。
+			RangeDecoder(const u8* p_, const u8* p_end_) : p(p_), p_end(p_end_)
+			{
+				for (int i = 0; i < 5; ++i)
+					code = (code << 8) | next();
+			}
+
+			int decode_bit(u16& prob)
+			{
+				u32 bound = (range >> PROB_BITS) * prob;
+				int bit;
+				if (code < bound)
+				{
+					range = bound;
+					prob += ((1 << PROB_BITS) - prob) >> MOVE_BITS;
+					bit = 0;
+				}
+				else {
+					code -= bound;
+					range -= bound;
+					prob -= prob >> MOVE_BITS;
+					bit = 1;
+				}
+				while (range < TOP)
+				{
+					range <<= 8;
+					code = (code << 8) | next();
+				}
+				return bit;
+			}
+
+			u8 decode_byte(u16* probs)
+			{
+				u32 m = 1;
+				for (int i = 0; i < 8; ++i)
+					m = (m << 1) | decode_bit(probs[m]);
+				return (u8)(m - 256);
+			}
+
+		private:
+			u8 next() { return p < p_end ? *p++ : 0; }
+
+			const u8* p;
+			const u8* p_end;
+			u32 range = 0xFFFFFFFF;
+			u32 code = 0;
+		};
+
+	} // namespace
+
+	void compress_sfen_block(const PackedSfenValue* psv, size_t count, std::vector<u8>& out)
+	{
+		ASSERT_LV1(count <= PACKED_SFEN_BLOCK_MAX_RECORDS);
+
+		// ヘッダーの分を先に確保しておき、payloadのサイズが確定してから書き込む。
+		size_t header_pos = out.size();
+		out.resize(header_pos + sizeof(PackedSfenBlockHeader));
+
+		// Modelは40KBほどあるのでstackには置かない。
+		std::unique_ptr<Model> model(new Model);
+		RangeEncoder enc(out);
+
+		PackedSfenValue prev;
+		memset(&prev, 0, sizeof(prev));
+		u8 r[RECORD_SIZE];
+		for (size_t i = 0; i < count; ++i)
+		{
+			to_residual(psv[i], prev, r);
+			for (int j = 0; j < RECORD_SIZE; ++j)
+				enc.encode_byte(model->get(j, j ? r[j - 1] : 0), r[j]);
+			prev = psv[i];
+		}
+		enc.flush();
+
+		PackedSfenBlockHeader h;
+		memcpy(h.magic, BLOCK_MAGIC, sizeof(h.magic));
+		h.record_count = (u32)count;
+		h.payload_size = (u32)(out.size() - header_pos - sizeof(PackedSfenBlockHeader));
+		h.checksum = fnv1a(psv, sizeof(PackedSfenValue) * count);
+		h.reserved = 0;
+		memcpy(&out[header_pos], &h, sizeof(h));
+	}
+
+	size_t check_sfen_block(const void* data, size_t size, u32* record_count)
+	{
+		if (size < sizeof(PackedSfenBlockHeader))
+			return 0;
+
+		PackedSfenBlockHeader h;
+		memcpy(&h, data, sizeof(h));
+		if (memcmp(h.magic, BLOCK_MAGIC, sizeof(h.magic)) != 0
+			|| h.record_count > PACKED_SFEN_BLOCK_MAX_RECORDS
+			|| h.payload_size > size - sizeof(PackedSfenBlockHeader))
+			return 0;
+
+		if (record_count)
+			*record_count = h.record_count;
+		return sizeof(PackedSfenBlockHeader) + h.payload_size;
+	}
+
+	bool decompress_sfen_block(const void* data, std::vector<PackedSfenValue>& out)
+	{
+		PackedSfenBlockHeader h;
+		memcpy(&h, data, sizeof(h));
+
+		auto payload = (const u8*)data + sizeof(PackedSfenBlockHeader);
+		std::unique_ptr<Model> model(new Model);
+		RangeDecoder dec(payload, payload + h.payload_size);
+
+		out.resize(h.record_count);
+
+		PackedSfenValue prev;
+		memset(&prev, 0, sizeof(prev));
+		u8 r[RECORD_SIZE];
+		for (auto& psv : out)
+		{
+			for (int j = 0; j < RECORD_SIZE; ++j)
+				r[j] = dec.decode_byte(model->get(j, j ? r[j - 1] : 0));
+			from_residual(r, prev, psv);
+			prev = psv;
+		}
+
+		return fnv1a(out.data(), sizeof(PackedSfenValue) * out.size()) == h.checksum;
+	}
+}
+
+#endif // defined(EVAL_LEARN)
@@ -0,0 +1,52 @@
+﻿#ifndef _SFEN_CONTAINER_H_
+#define _SFEN_CONTAINER_H_
+
+#include "learn.h"
+
+#if defined(EVAL_LEARN)
+
+#include <vector>
+
+// 教師局面(PackedSfenValue)のファイルを圧縮して保存するためのコンテナ形式
+//
+// ・ファイルはブロックの並びであり、各ブロックは PackedSfenBlockHeader + 圧縮されたデータ から成る。
+// ・ブロックはそれぞれ単独で展開できる。(ブロックごとに符号化のモデルを初期化している)
+// 　ヘッダーに圧縮後のサイズが書いてあるので、ヘッダーだけを辿っていけばブロック単位でrandom accessできる。
+// ・ファイル全体のヘッダーは持たないので、既存のファイルの末尾にブロックを追記していくことが出来る。
+// 　(gensfenは教師局面を既存のファイルに追記する仕様なので)
+// ・圧縮は、1つ前の局面との差分(同じ対局の局面は連続して書き出されるので似ている)を取り、
+// 　それを適応型のrange coderで符号化する。外部のライブラリ(zlib等)には依存しない。
+
+namespace Learner
+{
+	// 圧縮されたブロックのヘッダー。この直後にpayload_sizeバイトの圧縮されたデータが続く。
+	struct PackedSfenBlockHeader
+	{
+		char magic[8];     // "YPSVBLK1"
+		u32 record_count;  // このブロックに含まれる局面数
+		u32 payload_size;  // このヘッダーの直後に続く圧縮データのサイズ[byte]
+		u64 checksum;      // 展開後のPackedSfenValueの配列に対するhash値(FNV-1a)
+		u64 reserved;
+	};
+	static_assert(sizeof(PackedSfenBlockHeader) == 32, "sizeof(PackedSfenBlockHeader) must be 32");
+
+	// 1ブロックに格納できる局面数の上限。壊れたヘッダーを弾くのに用いる。
+	const u32 PACKED_SFEN_BLOCK_MAX_RECORDS = 1024 * 1024;
+
+	// psv[0..count-1]を1ブロックに圧縮してoutの末尾に追加する。(ヘッダーも含めて)
+	extern void compress_sfen_block(const PackedSfenValue* psv, size_t count, std::vector<u8>& out);
+
+	// data[0..size-1]の先頭が正しいブロックのヘッダーであるかを調べる。
+	// ・正しいブロックであれば、ヘッダーを含めたブロック全体のサイズを返す。さもなくば0を返す。
+	// ・record_count != nullptrなら、そこにブロックに含まれる局面数を返す。
+	// ・ファイルの先頭に対して呼び出せば、そのファイルがこの形式で圧縮されているかの判定に使える。
+	extern size_t check_sfen_block(const void* data, size_t size, u32* record_count = nullptr);
+
+	// check_sfen_block()で確認したブロックを展開して、outに格納する。
+	// ・outはrecord_count個にresizeされる。
+	// ・展開後のchecksumが合わなければfalseを返す。
+	extern bool decompress_sfen_block(const void* data, std::vector<PackedSfenValue>& out);
+}
+
+#endif // defined(EVAL_LEARN)
+#endif // _SFEN_CONTAINER_H_
@@ -23,6 +23,25 @@ extern "C" {
 
 #endif
 
+// Linux環境下でのLarge Page、NUMA関係
+#if defined(_LINUX)
+#include <atomic>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -113,6 +132,9 @@ const string engine_info() {
 			<< ENGINE_VERSION << setfill('0')
 			<< (Is64Bit ? " 64" : " 32")
 			<< TARGET_CPU
+#if defined(USE_CPU_DISPATCH)
+			<< " DISPATCH"
+#endif
 #if defined(FOR_TOURNAMENT)
 			<< " TOURNAMENT"
 #endif
@@ -281,6 +303,98 @@ int write_memory_to_file(std::string filename, void *ptr, u64 size)
 	return 0;
 }
 
+#if defined(_WIN32)
+
+bool FileReader::open(const std::string& filename)
+{
+	close();
+
+	HANDLE h = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER sz;
+	if (!GetFileSizeEx(h, &sz))
+	{
+		CloseHandle(h);
+		return false;
+	}
+
+	handle = h;
+	file_size = (u64)sz.QuadPart;
+	return opened = true;
+}
+
+void FileReader::close()
+{
+	if (opened)
+		CloseHandle((HANDLE)handle);
+	handle = nullptr;
+	file_size = 0;
+	opened = false;
+}
+
+size_t FileReader::read(u64 offset, void* buf, size_t size) const
+{
+	if (!opened || offset >= file_size)
+		return 0;
+
+	// 読み込む位置はOVERLAPPEDで指定する。ファイルポインタには依存しないので複数スレッドから呼び出して良い。
+	OVERLAPPED ov = {};
+	ov.Offset = (DWORD)offset;
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+
+	DWORD read_size = 0;
+	if (!ReadFile((HANDLE)handle, buf, (DWORD)std::min(size, (size_t)(file_size - offset)), &read_size, &ov))
+		return 0;
+	return (size_t)read_size;
+}
+
+#else
+
+bool FileReader::open(const std::string& filename)
+{
+	close();
+
+	fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	// 末尾にseekしてファイルサイズを得る。以降、ファイルポインタは使わない。
+	off_t end = lseek(fd, 0, SEEK_END);
+	if (end == (off_t)-1)
+	{
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	file_size = (u64)end;
+	return opened = true;
+}
+
+void FileReader::close()
+{
+	if (opened)
+		::close(fd);
+	fd = -1;
+	file_size = 0;
+	opened = false;
+}
+
+size_t FileReader::read(u64 offset, void* buf, size_t size) const
+{
+	if (!opened || offset >= file_size)
+		return 0;
+
+	// pread()はファイルポインタを変更しないので複数スレッドから呼び出して良い。
+	ssize_t r = pread(fd, buf, std::min(size, (size_t)(file_size - offset)), (off_t)offset);
+	return r < 0 ? 0 : (size_t)r;
+}
+
+#endif
+
 // --------------------
 //       Math
 // --------------------
@@ -343,13 +457,614 @@ void prefetch2(void* addr)
 	prefetch((uint8_t*)addr + 64);
 }
 
+// --------------------
+//  Large Pageの確保
+// --------------------
+
+LargePageMode to_large_page_mode(const std::string& s)
+{
+	return s == "1GB"         ? LARGE_PAGE_1GB
+		 : s == "2MB"         ? LARGE_PAGE_2MB
+		 : s == "Transparent" ? LARGE_PAGE_TRANSPARENT
+		 :                      LARGE_PAGE_NONE;
+}
+
+#if defined(_LINUX)
+
+namespace {
+
+	// sysfsの"0-3,5"のような形式で書かれたリストを読み込んで、番号を列挙する。
+	// ファイルが存在しなければ空のvectorが返る。
+	std::vector<int> read_sysfs_list(const std::string& path)
+	{
+		std::vector<int> list;
+		ifstream ifs(path);
+		string line;
+		if (!ifs || !std::getline(ifs, line))
+			return list;
+
+		istringstream is(line);
+		string range;
+		while (std::getline(is, range, ','))
+		{
+			int from, to;
+			if (sscanf(range.c_str(), "%d-%d", &from, &to) == 2)
+				for (int n = from; n <= to; ++n)
+					list.push_back(n);
+			else if (sscanf(range.c_str(), "%d", &from) == 1)
+				list.push_back(from);
+		}
+		return list;
+	}
+
+	// 現在onlineになっているNUMA nodeの番号を列挙する。
+	std::vector<int> online_numa_nodes() { return read_sysfs_list("/sys/devices/system/node/online"); }
+
+	// [addr, addr + size)の物理メモリをnodesにinterleaveして配置するように指示する。
+	// libnumaに依存したくないのでmbind()のsystem callを直接呼び出す。
+	// 物理メモリの割り当てはfirst touchのときなので、書き込む前に呼び出す必要がある。
+	bool interleave_memory(void* addr, size_t size, const std::vector<int>& nodes)
+	{
+		const int MPOL_INTERLEAVE_ = 3;
+		const size_t bits = sizeof(unsigned long) * 8;
+
+		int max_node = *std::max_element(nodes.begin(), nodes.end());
+		std::vector<unsigned long> mask(max_node / bits + 1);
+		for (int n : nodes)
+			mask[n / bits] |= 1UL << (n % bits);
+
+		return syscall(SYS_mbind, addr, size, MPOL_INTERLEAVE_, mask.data(), mask.size() * bits + 1, 0) == 0;
+	}
+}
+
+void* LargeMemory::alloc(size_t size, size_t align, LargePageMode mode_, bool interleave)
+{
+	free();
+
+	const size_t MB2 = size_t(2) * 1024 * 1024;
+	const size_t GB1 = size_t(1024) * 1024 * 1024;
+
+#if !defined(MAP_HUGETLB)
+	// MAP_HUGETLBが使えない環境では、transparent huge pageまでしか試せない。
+	mode_ = std::min(mode_, LARGE_PAGE_TRANSPARENT);
+#endif
+
+	// 明示的なhuge pageを確保する。確保できなければ下位のモードにfallbackする。
+	// huge pageの確保はOS側で事前に予約(/proc/sys/vm/nr_hugepages等)されていないと失敗する。
+#if defined(MAP_HUGETLB)
+	for (; mode_ >= LARGE_PAGE_2MB; mode_ = (LargePageMode)(mode_ - 1))
+	{
+		const size_t page = mode_ == LARGE_PAGE_1GB ? GB1 : MB2;
+		const int    shift = mode_ == LARGE_PAGE_1GB ? 30 : 21; // MAP_HUGE_SHIFTに指定するlog2(page)
+		const size_t s = (size + page - 1) / page * page;
+
+		void* p = mmap(nullptr, s, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << 26 /* MAP_HUGE_SHIFT */), -1, 0);
+		if (p != MAP_FAILED)
+		{
+			mem = ptr = p;
+			mem_size = s;
+			break;
+		}
+	}
+#endif
+
+	// 通常のページで確保する。transparent huge pageが使えるようにhuge pageのサイズでalignしておく。
+	if (!mem)
+	{
+		const size_t page_align = std::max(align, MB2);
+		const size_t s = size + page_align;
+
+		void* p = mmap(nullptr, s, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return nullptr;
+
+		mem = p;
+		mem_size = s;
+		ptr = (void*)((uintptr_t(p) + page_align - 1) & ~(page_align - 1));
+
+#if defined(MADV_HUGEPAGE)
+		if (mode_ == LARGE_PAGE_TRANSPARENT && (size < MB2 || madvise(ptr, size / MB2 * MB2, MADV_HUGEPAGE) != 0))
+			mode_ = LARGE_PAGE_NONE;
+#else
+		mode_ = LARGE_PAGE_NONE;
+#endif
+		if (mode_ > LARGE_PAGE_TRANSPARENT)
+			mode_ = LARGE_PAGE_NONE;
+	}
+
+	mode = mode_;
+
+	// NUMA nodeが複数あるなら、すべてのnodeにinterleaveする。
+	numa_nodes = 0;
+	if (interleave)
+	{
+		auto nodes = online_numa_nodes();
+		if (nodes.size() >= 2 && interleave_memory(mem, mem_size, nodes))
+			numa_nodes = (int)nodes.size();
+	}
+
+	return ptr;
+}
+
+void* LargeMemory::map_file(const std::string& filename, size_t& size, bool populate, bool read_only)
+{
+	free();
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return nullptr;
+
+#if !defined(MAP_POPULATE)
+	const int MAP_POPULATE = 0;
+#endif
+
+	// 書き込み可能なMAP_PRIVATEのmappingに対してMAP_POPULATEを指定すると、
+	// copy-on-writeを解消するために全ページがコピーされてしまうので、まず読み込み専用でmapする。
+	struct stat st;
+	void* p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+
+	// mapしてしまえばfile descriptorは不要。
+	close(fd);
+
+	if (p == MAP_FAILED)
+		return nullptr;
+
+	if (!read_only && mprotect(p, (size_t)st.st_size, PROT_READ | PROT_WRITE) != 0)
+	{
+		munmap(p, (size_t)st.st_size);
+		return nullptr;
+	}
+
+	// page cacheがhuge pageで持てる環境(tmpfs等)ならそうしてもらう。ダメでも問題はない。
+#if defined(MADV_HUGEPAGE)
+	madvise(p, (size_t)st.st_size, MADV_HUGEPAGE);
+#endif
+	// populateしないときも、アクセスする前に先読みを開始しておいてもらう。
+	if (!populate)
+		madvise(p, (size_t)st.st_size, MADV_WILLNEED);
+
+	mem = ptr = p;
+	size = mem_size = (size_t)st.st_size;
+	mode = LARGE_PAGE_NONE;
+	mapped_file = true;
+	return ptr;
+}
+
+void LargeMemory::free()
+{
+	if (mem)
+		munmap(mem, mem_size);
+	ptr = mem = nullptr;
+	mem_size = 0;
+	numa_nodes = 0;
+	mapped_file = false;
+}
+
+#else
+
+// Linux以外の環境では、Large Pageは使わずに通常のメモリを確保する。
+// (Windowsでは"Lock Pages in Memory"の権限が必要になるので対応していない。)
+
+void* LargeMemory::alloc(size_t size, size_t align, LargePageMode mode_, bool interleave)
+{
+	free();
+
+	// alignする分だけ余分に確保する。callocなのでゼロクリアされている。
+	mem = calloc(size + align - 1, 1);
+	if (!mem)
+		return nullptr;
+
+	mem_size = size + align - 1;
+	ptr = (void*)((uintptr_t(mem) + align - 1) & ~(align - 1));
+	mode = LARGE_PAGE_NONE;
+	numa_nodes = 0;
+	return ptr;
+}
+
+#if defined(_WIN32)
+
+// Windowsでは、copy-on-write(PAGE_WRITECOPY)のfile mappingのviewとしてmapする。
+// Linuxのmmap(MAP_PRIVATE)と同じく、ページは実際にアクセスしたときに読み込まれる。
+void* LargeMemory::map_file(const std::string& filename, size_t& size, bool populate, bool read_only)
+{
+	free();
+
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	// サイズが0のファイルや、アドレス空間に収まらないファイルはmapできない。
+	LARGE_INTEGER file_size;
+	HANDLE map = NULL;
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 && (u64)file_size.QuadPart <= (u64)SIZE_MAX)
+		map = CreateFileMapping(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+	void* p = map ? MapViewOfFile(map, read_only ? FILE_MAP_READ : FILE_MAP_COPY, 0, 0, 0) : nullptr;
+
+	// viewを作ってしまえばhandleは不要。(viewがunmapされるまでfile mappingは残る)
+	if (map)
+		CloseHandle(map);
+	CloseHandle(file);
+
+	if (!p)
+		return nullptr;
+
+	mem = ptr = p;
+	size = mem_size = (size_t)file_size.QuadPart;
+	mode = LARGE_PAGE_NONE;
+	mapped_file = true;
+
+	// populateが指定されていれば、すべてのページに触れて読み込んでおく。
+	if (populate)
+	{
+		volatile const u8* q = (const u8*)p;
+		for (size_t i = 0; i < size; i += 4096)
+			(void)q[i];
+	}
+
+	return ptr;
+}
+
+#else
+
+// Linux、Windows以外の環境では、単にファイルを丸読みする。
+void* LargeMemory::map_file(const std::string& filename, size_t& size, bool populate, bool read_only)
+{
+	free();
+
+	u64 file_size = 0;
+	if (read_file_to_memory(filename, [&](u64 s) { file_size = s; return mem = calloc((size_t)s, 1); }) != 0)
+	{
+		free();
+		return nullptr;
+	}
+
+	ptr = mem;
+	size = mem_size = (size_t)file_size;
+	mode = LARGE_PAGE_NONE;
+	mapped_file = true;
+	return ptr;
+}
+
+#endif
+
+void LargeMemory::free()
+{
+#if defined(_WIN32)
+	if (mapped_file)
+		UnmapViewOfFile(mem);
+	else
+#endif
+		::free(mem);
+	ptr = mem = nullptr;
+	mem_size = 0;
+	numa_nodes = 0;
+	mapped_file = false;
+}
+
+#endif
+
+std::string LargeMemory::info() const
+{
+	if (mapped_file)
+		return "file mapping";
+
+	stringstream ss;
+	ss << (mode == LARGE_PAGE_1GB ? "1GB huge pages"
+		: mode == LARGE_PAGE_2MB ? "2MB huge pages"
+		: mode == LARGE_PAGE_TRANSPARENT ? "transparent huge pages"
+		: "normal pages");
+
+	if (numa_nodes)
+		ss << ", interleaved across " << numa_nodes << " NUMA nodes";
+
+	return ss.str();
+}
+
+// --------------------
+//  プロセス間の共有メモリ
+// --------------------
+
+#if defined(_LINUX)
+
+// shared memoryの先頭のページに置く管理用の情報。
+// shm_open()で新規に作られたときはゼロクリアされている。
+struct SharedMemory::Header
+{
+	// 下位2bitが状態(0 : 未初期化 , 1 : 初期化中 , 2 : 初期化済み)、それより上位が初期化中のプロセスのpid。
+	// 初期化中のプロセスが落ちたかを判定するのに、状態とpidを1回のCASで書き換えられるようにまとめてある。
+	std::atomic<u64> state;
+
+	// 初期化したプロセスがattach()で指定したサイズ。同じ名前で異なるサイズのものが要求されたときの検出用。
+	std::atomic<u64> size;
+};
+
+// fdのshared memoryをattachしているプロセスが他にいなければ(共有ロックを持っているプロセスがいなければ)削除する。
+// 自分が共有ロックを持っていたなら、それは外れる。
+static bool unlink_if_unused(int fd, const std::string& name)
+{
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+		return false;
+
+	shm_unlink(name.c_str());
+	return true;
+}
+
+void* SharedMemory::attach(const std::string& name, size_t size, const std::function<void(void*)>& init, bool read_only)
+{
+	detach();
+
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	static_assert(sizeof(Header) <= 4096, "");
+
+	fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+	if (fd == -1)
+		return nullptr;
+	shm_name = name;
+
+	// attachしている間は共有ロックを持っておく。
+	// ロックはプロセスが(kill -9などで)落ちてもOSが外してくれるので、参照カウントと違って数え漏れがない。
+	if (flock(fd, LOCK_SH) != 0)
+	{
+		detach();
+		return nullptr;
+	}
+
+	// 先頭の1ページを管理用に使う。
+	// ftruncate()で広げただけだと実際のページは触ったときに確保されるので、/dev/shmの空きが足りないと
+	// 読み込みの途中でSIGBUSで落ちる。posix_fallocate()でここで確保しておき、足りなければ失敗させる。
+	// (確保済みの部分に対しては何もしないので、複数のプロセスから同時に呼び出されても問題ない。)
+	const size_t s = page + (size + page - 1) / page * page;
+	if (posix_fallocate(fd, 0, (off_t)s) != 0)
+	{
+		detach();
+		return nullptr;
+	}
+
+	void* p = mmap(nullptr, s, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		detach();
+		return nullptr;
+	}
+
+	header = (Header*)p;
+	map_size = s;
+
+	void* data = (u8*)p + page;
+	const u64 pid = (u64)getpid();
+
+	while (true)
+	{
+		u64 state = 0;
+		if (header->state.compare_exchange_strong(state, (pid << 2) | 1))
+		{
+			// 自分が初期化する。
+			header->size = size;
+			init(data);
+			created = true;
+			header->state.store(2, std::memory_order_release);
+			break;
+		}
+
+		if ((state & 3) == 2)
+			break;
+
+		// 他のプロセスが初期化中。そのプロセスが落ちていたら未初期化に戻して自分が引き継ぐ。
+		if (kill((pid_t)(state >> 2), 0) != 0 && errno == ESRCH)
+		{
+			header->state.compare_exchange_strong(state, 0);
+			continue;
+		}
+
+		sleep(10);
+	}
+
+	if (header->size != size)
+	{
+		// 同じ名前で異なるサイズのものを共有しようとした。
+		detach();
+		return nullptr;
+	}
+
+	if (read_only)
+		mprotect(data, map_size - page, PROT_READ);
+
+	return data;
+}
+
+void SharedMemory::detach()
+{
+	if (header)
+		munmap(header, map_size);
+
+	// 他にattachしているプロセスがいなければ削除する。
+	// (削除したあとでもmapしているプロセスはそのまま使えるので、同時にattachしようとしているプロセスがいても問題ない。)
+	if (fd != -1)
+	{
+		unlink_if_unused(fd, shm_name);
+		close(fd);
+	}
+
+	header = nullptr;
+	map_size = 0;
+	fd = -1;
+	created = false;
+}
+
+void SharedMemory::remove_unused(const std::string& prefix)
+{
+	// Linuxでは、shm_open()で作ったものは/dev/shm/にファイルとして見える。
+	DIR* d = opendir("/dev/shm");
+	if (d == nullptr)
+		return;
+
+	while (dirent* e = readdir(d))
+	{
+		const std::string name = std::string("/") + e->d_name;
+		if (name.compare(0, prefix.size(), prefix) != 0)
+			continue;
+
+		int fd = shm_open(name.c_str(), O_RDWR, 0600);
+		if (fd == -1)
+			continue;
+		unlink_if_unused(fd, name);
+		close(fd);
+	}
+	closedir(d);
+}
+
+#endif
+
 // --------------------
 //  全プロセッサを使う
 // --------------------
 
 namespace WinProcGroup {
 
-#if !defined ( _WIN32 )
+	std::atomic<int> binding_generation(0);
+
+#if defined(_LINUX)
+
+	namespace {
+
+		// 論理プロセッサの番号と、それが属するNUMA node
+		struct LogicalCpu { int cpu; int node; };
+
+		// このプロセスで使える論理プロセッサを、スレッドを割り当てていく順番に並べたもの。
+		struct CpuOrder
+		{
+			// NUMA node 0の物理コアから順に使い切ってから次のnodeの物理コアへ。
+			// 物理コアを使い切ったら、各物理コアの2つ目以降の論理プロセッサ(SMT)を同じ順番で使う。
+			std::vector<LogicalCpu> compact;
+
+			// 物理コアを各NUMA nodeから1つずつ順番に使う。SMTの論理プロセッサも同様。
+			std::vector<LogicalCpu> spread;
+
+			// 起動時のaffinity。(tasksetなどで制限されているかも知れない) 割り当てを解除するときはこれに戻す。
+			cpu_set_t allowed;
+
+			// NUMA nodeの数
+			size_t nodes;
+		};
+
+		// sysfsからCPUの構成を読み込んでCpuOrderを構築する。(初回に呼び出されたときに1度だけ)
+		const CpuOrder& cpu_order()
+		{
+			static const CpuOrder order = [] {
+
+				CpuOrder o;
+				o.nodes = 0;
+				if (sched_getaffinity(0, sizeof(o.allowed), &o.allowed) != 0)
+					return o;
+
+				auto allowed = [&](int cpu) { return 0 <= cpu && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &o.allowed); };
+
+				// NUMAの情報がなければ(NUMAに対応していないkernelなど)、全体で1つのnodeとみなす。
+				auto nodes = online_numa_nodes();
+				if (nodes.empty())
+					nodes.push_back(-1);
+
+				// node[i]の、物理コアの1つ目の論理プロセッサ(primary)とそれ以外(secondary)
+				std::vector<std::vector<int>> primary(nodes.size()), secondary(nodes.size());
+				for (size_t i = 0; i < nodes.size(); ++i)
+				{
+					auto cpus = nodes[i] >= 0
+						? read_sysfs_list("/sys/devices/system/node/node" + std::to_string(nodes[i]) + "/cpulist")
+						: read_sysfs_list("/sys/devices/system/cpu/online");
+
+					for (int cpu : cpus)
+					{
+						if (!allowed(cpu))
+							continue;
+
+						// 同じ物理コアの論理プロセッサのうち、使って良いもので一番番号が小さいものをprimaryとする。
+						auto siblings = read_sysfs_list("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+						bool is_primary = true;
+						for (int s : siblings)
+							if (s < cpu && allowed(s))
+								is_primary = false;
+
+						(is_primary ? primary : secondary)[i].push_back(cpu);
+					}
+				}
+
+				for (auto* list : { &primary , &secondary })
+				{
+					for (size_t i = 0; i < nodes.size(); ++i)
+						for (int cpu : (*list)[i])
+							o.compact.push_back({ cpu, nodes[i] });
+
+					for (size_t k = 0; ; ++k)
+					{
+						bool found = false;
+						for (size_t i = 0; i < nodes.size(); ++i)
+							if (k < (*list)[i].size())
+							{
+								o.spread.push_back({ (*list)[i][k], nodes[i] });
+								found = true;
+							}
+						if (!found)
+							break;
+					}
+				}
+
+				o.nodes = nodes.size();
+				return o;
+			}();
+
+			return order;
+		}
+	}
+
+	// Options["ThreadBinding"]に従って、idx番目のスレッドを論理プロセッサ(またはNUMA node)に割り当てる。
+	//  "No"      : 割り当てない。(OSに任せる)
+	//  "Auto"    : スレッド数が8以上でNUMA nodeが複数あるときだけ、Windowsと同じ順番でNUMA nodeに割り当てる。
+	//  "Compact" : 1つの論理プロセッサに割り当てる。NUMA node 0の物理コアから順番に使い切っていく。
+	//  "Spread"  : 1つの論理プロセッサに割り当てる。各NUMA nodeの物理コアを順番に1つずつ使う。
+	// 論理プロセッサの数より多いスレッドは割り当てない。
+	void bindThisThread(size_t idx)
+	{
+		const auto& order = cpu_order();
+		if (order.compact.empty())
+			return;
+
+		const std::string mode = Options.count("ThreadBinding") ? (std::string)Options["ThreadBinding"] : "No";
+
+		// デフォルトでは起動時のaffinityに戻す。(以前の設定で割り当てられていたかも知れないので)
+		cpu_set_t set = order.allowed;
+
+		if (mode == "Auto")
+		{
+			// 1スレッドのエンジンを何個も同時に動かすような状況で、すべてが同じ論理プロセッサに割り当てられると困るので
+			// Windowsと同じく、スレッド数が少ないときは何もしない。
+			if ((int)Options["Threads"] >= 8 && order.nodes >= 2 && idx < order.compact.size())
+			{
+				CPU_ZERO(&set);
+				const int node = order.compact[idx].node;
+				for (auto& c : order.compact)
+					if (c.node == node)
+						CPU_SET(c.cpu, &set);
+			}
+		}
+		else if (mode == "Compact" || mode == "Spread")
+		{
+			const auto& list = mode == "Compact" ? order.compact : order.spread;
+			if (idx < list.size())
+			{
+				CPU_ZERO(&set);
+				CPU_SET(list[idx].cpu, &set);
+			}
+		}
+
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+#elif !defined ( _WIN32 )
 
 	void bindThisThread(size_t) {}
 
@@ -1,6 +1,7 @@
 ﻿#ifndef _MISC_H_
 #define _MISC_H_
 
+#include <atomic>
 #include <chrono>
 #include <thread>
 #include <mutex>
@@ -61,6 +62,34 @@ extern int read_all_lines(std::string filename, std::vector<std::string>& lines)
 extern int read_file_to_memory(std::string filename, std::function<void*(u64)> callback_func);
 extern int write_memory_to_file(std::string filename, void *ptr, u64 size);
 
+// ファイルの任意の位置を読み込むためのclass。
+// ・read()はファイルポインタを共有しない(POSIXではpread()、WindowsではOVERLAPPED付きのReadFile()を用いる)ので、
+// 　open()したあとは、ひとつのインスタンスに対して複数スレッドから同時にread()を呼び出して良い。
+// ・巨大なファイルでもメモリに丸読みせずに、必要な箇所だけを読み込める。
+struct FileReader
+{
+	// ファイルを読み込み用にopenする。成功すればtrue。
+	bool open(const std::string& filename);
+	void close();
+	bool is_open() const { return opened; }
+
+	// open()したときのファイルサイズ
+	u64 size() const { return file_size; }
+
+	// ファイルのoffsetの位置からsizeバイトをbufに読み込む。実際に読み込めたバイト数を返す。
+	// ファイルの終端に達しているか、エラーであれば0が返る。
+	size_t read(u64 offset, void* buf, size_t size) const;
+
+	FileReader() : handle(nullptr), fd(-1), file_size(0), opened(false) {}
+	~FileReader() { close(); }
+
+private:
+	void* handle; // Windows用のファイルハンドル
+	int fd;       // POSIX用のfile descriptor
+	u64 file_size;
+	bool opened;
+};
+
 // --------------------
 //  統計情報
 // --------------------
@@ -338,6 +367,141 @@ extern void prefetch(void* addr);
 // 連続する128バイトをprefetchするときに用いる。
 extern void prefetch2(void* addr);
 
+// --------------------
+//  Large Pageの確保
+// --------------------
+
+// 置換表のような巨大なメモリをLarge Page(Huge Page)で確保するときに用いる。
+// 巨大なメモリを4KBのページで確保すると、probe()のたびにTLB missが起きて遅くなるため。
+
+// 確保するページの種類。上から順に試していき、確保できなければ一つ下のモードにfallbackする。
+enum LargePageMode {
+	LARGE_PAGE_NONE,        // 通常の4KBのページ
+	LARGE_PAGE_TRANSPARENT, // Linuxのtransparent huge page(madvise)
+	LARGE_PAGE_2MB,         // 明示的な2MBのhuge page(MAP_HUGETLB)
+	LARGE_PAGE_1GB,         // 明示的な1GBのhuge page(MAP_HUGETLB | MAP_HUGE_1GB)
+};
+
+// USIのoptionで指定された文字列からLargePageModeに変換する。
+// "No","Transparent","2MB","1GB"のいずれか。
+extern LargePageMode to_large_page_mode(const std::string& s);
+
+// Large Pageで確保されたメモリ
+// alloc()で確保されたメモリはゼロクリアされていることが保証される。
+// ただし、物理メモリへの割り当ては最初に書き込んだ(first touch)ときに行われるので
+// NUMA環境では、各スレッドから並列にゼロクリアするなどしてやると良い。
+struct LargeMemory
+{
+	// sizeバイトのメモリを確保して、その先頭アドレス(align bytesでalignされている)を返す。
+	// mode      : 確保したいページの種類。確保できなければ下位のモードにfallbackする。
+	// interleave: trueならNUMA nodeが複数あるときにメモリをすべてのnodeにinterleaveして配置する。
+	// 確保に失敗したときはnullptrが返る。
+	void* alloc(size_t size, size_t align, LargePageMode mode, bool interleave);
+
+	// ファイルをcopy-on-writeでメモリにmapして、その先頭アドレスを返す。size にはファイルサイズが返る。
+	// 書き換えてもファイルには反映されない。ページは実際にアクセスしたときに読み込まれるので、
+	// 巨大なファイルでも瞬時にmapできる。(WindowsではCreateFileMapping()でmapする。
+	// Linux、Windows以外の環境では、単にファイルを丸読みする。)
+	// populate  : trueならmapするときにすべてのページを読み込んで(page cacheにあればページテーブルを設定するだけ)おく。
+	// 　　　　　　 探索中にpage faultが起きなくなる。falseのときは、OSに先読みだけ依頼しておく。
+	// read_only : trueなら書き込みを禁止する。(書き込むと落ちる)
+	// 書き換えていないページはpage cacheのものがそのまま使われるので、同じファイルをmapしたプロセス間で
+	// 物理メモリは共有される。
+	// 失敗したときはnullptrが返る。
+	void* map_file(const std::string& filename, size_t& size, bool populate = false, bool read_only = false);
+
+	// alloc()またはmap_file()で確保したメモリを解放する。
+	void free();
+
+	// alloc()またはmap_file()で確保しているメモリの先頭(alignされている)
+	void* get() const { return ptr; }
+
+	// 実際に確保できたページの種類とNUMAの配置を文字列化したもの。"info string"で出力するのに用いる。
+	std::string info() const;
+
+	// 確保しているメモリをotherと交換する。
+	// 新しいメモリを別のLargeMemoryに確保しておいて、成功したときにだけ差し替えるのに用いる。
+	void swap(LargeMemory& other) {
+		std::swap(ptr, other.ptr); std::swap(mem, other.mem); std::swap(mem_size, other.mem_size);
+		std::swap(mode, other.mode); std::swap(numa_nodes, other.numa_nodes); std::swap(mapped_file, other.mapped_file);
+	}
+
+	LargeMemory() : ptr(nullptr), mem(nullptr), mem_size(0), mode(LARGE_PAGE_NONE), numa_nodes(0), mapped_file(false) {}
+	~LargeMemory() { free(); }
+
+private:
+	// alignされたメモリの先頭
+	void* ptr;
+
+	// 確保したメモリの先頭(alignされていない)とそのサイズ
+	void* mem;
+	size_t mem_size;
+
+	// 実際に確保できたページの種類
+	LargePageMode mode;
+
+	// interleaveしたNUMA nodeの数。interleaveしていなければ0。
+	int numa_nodes;
+
+	// map_file()でファイルをmapしているのか。
+	bool mapped_file;
+};
+
+// --------------------
+//  プロセス間の共有メモリ
+// --------------------
+
+#if defined(_LINUX)
+// 名前をつけて複数のプロセスで共有するメモリ(POSIXのshared memory)。
+// 評価関数パラメーターのような巨大で読み込み専用のデータを、同じマシン上の複数の思考エンジンで共有するのに用いる。
+// (Windowsでは、CreateFileMapping()を用いて評価関数ごとに実装してある。)
+//
+// ・最初にattachしたプロセスだけが中身を初期化して、他のプロセスは初期化の完了を待ってから共有する。
+// ・初期化中のプロセスが落ちた場合は、待っていたプロセスが初期化を引き継ぐ。
+// ・attachしているプロセスがなくなったら(detach()されたら)shared memoryは削除される。
+// 　attachしているかどうかは、shared memoryのfile descriptorに対するflock()の共有ロックで判定する。
+// 　kill -9などで強制終了されたプロセスがあって残ってしまったものは、remove_unused()で削除できる。
+// ・/dev/shmの空きが足りないときは、attach()が失敗する。(nullptrが返るので、共有しないメモリを用いること)
+struct SharedMemory
+{
+	// nameのshared memoryをsizeバイト分attachして、その先頭アドレス(ページ境界でalignされている)を返す。
+	// name      : '/'で始まり、それ以降に'/'を含まない名前。(shm_open()の仕様)
+	// init      : shared memoryを初期化するプロセスだけで呼び出される。
+	// read_only : trueなら初期化が終わったあとは読み込み専用にする。(誤って書き換えると落ちるようになる)
+	// 失敗したときはnullptrが返る。
+	void* attach(const std::string& name, size_t size, const std::function<void(void*)>& init, bool read_only);
+
+	// attach()に成功して共有しているか。
+	bool attached() const { return header != nullptr; }
+
+	// attach()でinitを呼び出したのが自分のプロセスであったか。
+	bool initialized_by_self() const { return created; }
+
+	// 共有をやめる。最後のプロセスであればshared memoryを削除する。
+	void detach();
+
+	// 名前がprefixで始まるshared memoryのうち、どのプロセスもattachしていないものを削除する。
+	static void remove_unused(const std::string& prefix);
+
+	SharedMemory() : header(nullptr), map_size(0), fd(-1), created(false) {}
+	~SharedMemory() { detach(); }
+
+private:
+	// shared memoryの先頭に置く管理用の情報
+	struct Header;
+	Header* header;
+
+	// mapしたサイズ(管理用のページを含む)
+	size_t map_size;
+
+	// shm_open()したfile descriptor。attachしている間は共有ロックを持っておくためにcloseしない。
+	int fd;
+
+	std::string shm_name;
+	bool created;
+};
+#endif
+
 // --------------------
 //  全プロセッサを使う
 // --------------------
@@ -348,11 +512,18 @@ extern void prefetch2(void* addr);
 // それぞのスレッドがgroup affinityを設定しなければならない。
 // 元のコードはPeter ÖsterlundによるTexelから。
 
+// Linux環境では、sysfsからNUMA nodeと物理コアの構成を読み取って、Options["ThreadBinding"]に従って
+// スレッドを論理プロセッサ(またはNUMA node)に割り当てる。
+
 namespace WinProcGroup {
 	// 各スレッドがidle_loop()などで自分のスレッド番号(0～)を渡す。
 	// 1つ目のプロセッサをまず使い切るようにgroup affinityを割り当てる。
 	// 1つ目のプロセッサの論理コアを使い切ったら次は2つ目のプロセッサを使っていくような動作。
 	void bindThisThread(size_t idx);
+
+	// スレッドの割り当て方("ThreadBinding"オプション)が変更されたときにインクリメントされる。
+	// 探索スレッドは探索を開始するときにこれを調べて、変わっていればbindThisThread()しなおす。
+	extern std::atomic<int> binding_generation;
 }
 
 #endif // _MISC_H_
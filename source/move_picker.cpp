@@ -1,4 +1,8 @@
 ﻿#include "move_picker.h"
+
+// このMovePickerはSEEを用いるので、USE_SEEが定義されていないエディション(詰将棋エンジンなど)ではコンパイルしない。
+#if defined (USE_SEE)
+
 #include "thread.h"
 
 namespace {
@@ -540,3 +544,5 @@ Move MovePicker::next_move2() {
 
 	return MOVE_NONE;
 }
+
+#endif // defined (USE_SEE)
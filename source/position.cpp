@@ -150,6 +150,15 @@ std::string USI_PIECE_KANJI[] = {
 std::string pretty(Piece pc) { return USI_PIECE_KANJI[pc]; }
 #endif
 
+// posの局面をコピーして、探索スレッドをthにする。
+void Position::set(const Position& pos, Thread* th)
+{
+	// operator=()でStateInfoはstartStateにコピーされるが、st->previousはposのものを指したままである。
+	if (this != &pos)
+		*this = pos;
+	thisThread = th;
+}
+
 // sfen文字列で盤面を設定する
 void Position::set(std::string sfen , Thread* th)
 {
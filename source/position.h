@@ -182,6 +182,12 @@ struct Position
 	// ※　内部的にinit()は呼び出される。
 	void set(std::string sfen , Thread* th);
 
+	// posの局面をコピーして、探索スレッドをthにする。sfen()→set()よりずっと速い。
+	// 現局面のStateInfoはコピーするが、それより前の局面のStateInfo(st->previous以降)はposと共有する。
+	// これにより、探索開始局面より前の局面も含めて千日手の判定ができる。
+	// (共有しているStateInfoは探索中に書き換えてはならない)
+	void set(const Position& pos, Thread* th);
+
 	// 局面のsfen文字列を取得する
 	// ※ USIプロトコルにおいては不要な機能ではあるが、デバッグのために局面を標準出力に出力して
 	// 　その局面から開始させたりしたいときに、sfenで現在の局面を出力出来ないと困るので用意してある。
@@ -171,11 +171,12 @@ namespace Search {
 			return false;
 
 		pos.do_move(pv[0], st, pos.gives_check(pv[0]));
-		TTEntry* tte = TT.probe(pos.state()->key(), ttHit);
+		TTEntry ttData;
+		TT.probe(pos.state()->key(), ttHit, ttData);
 		Move m;
 		if (ttHit)
 		{
-			m = tte->move(); // SMP safeにするためlocal copy
+			m = ttData.move();
 			if (MoveList<LEGAL_ALL>(pos).contains(m))
 				goto FOUND;
 		}
@@ -5,14 +5,13 @@ ThreadPool Threads;		// Global object
 void* Thread::operator new(size_t s) { return aligned_malloc(s, alignof(Thread)); }
 void Thread::operator delete(void*p) noexcept { aligned_free(p); }
 
-Thread::Thread(size_t n) : idx(n) , stdThread(&Thread::idle_loop, this)
+Thread::Thread(size_t n) : idx(n)
 {
-	// スレッドはsearching == trueで開始するので、このままworkerのほう待機状態にさせておく
-	wait_for_search_finished();
+	stdThread = std::thread(&Thread::idle_loop, this);
 
-	// historyなどをゼロクリアする。
-	// このタイミングでやらないとgccで変数が未初期化扱いされてしまう。
-	clear();
+	// スレッドはsearching == trueで開始して、idle_loop()のなかでhistoryなどをゼロクリアしてから待機状態になる。
+	// スレッドを何個も生成するときに並列にゼロクリアさせたいので、ここではその完了を待たない。
+	// 生成した側(ThreadPool)がwait_for_search_finished()で待つこと。
 }
 
 // std::threadの終了を待つ
@@ -49,6 +48,14 @@ void Thread::start_searching()
 	cv.notify_one(); // idle_loop()で回っているスレッドを起こす。(次の処理をさせる)
 }
 
+void Thread::start_clearing()
+{
+	std::unique_lock<Mutex> lk(mutex);
+	clearing = true;
+	searching = true;
+	cv.notify_one();
+}
+
 // 探索が終わるのを待機する。(searchingフラグがfalseになるのを待つ)
 void Thread::wait_for_search_finished()
 {
@@ -59,8 +66,14 @@ void Thread::wait_for_search_finished()
 // 探索するときのmaster,slave用のidle_loop。探索開始するまで待っている。
 void Thread::idle_loop() {
 
+	bindingGeneration = WinProcGroup::binding_generation;
 	WinProcGroup::bindThisThread(idx);
 
+	// historyなどをゼロクリアする。
+	// このスレッド自身が最初に書き込むことで、NUMA環境ではこのスレッドが割り当てられたnodeのメモリに配置される。
+	// (コンストラクタで呼び出すと、Threadを生成したスレッドのnodeに配置されてしまう)
+	clear();
+
 	while (!exit)
 	{
 		std::unique_lock<Mutex> lk(mutex);
@@ -76,8 +89,25 @@ void Thread::idle_loop() {
 		if (exit)
 			return;
 
+		const bool clear_only = clearing;
+		clearing = false;
+
 		lk.unlock();
 
+		// "ThreadBinding"オプションが変更されていたら割り当てなおす。
+		if (bindingGeneration != WinProcGroup::binding_generation)
+		{
+			bindingGeneration = WinProcGroup::binding_generation;
+			WinProcGroup::bindThisThread(idx);
+		}
+
+		// start_clearing()で起こされたのであればclear()だけ行なう。
+		if (clear_only)
+		{
+			clear();
+			continue;
+		}
+
 		// exit == falseということはsearch == trueというわけだから探索する。
 		search();
 	}
@@ -87,9 +117,26 @@ void Thread::idle_loop() {
 void ThreadPool::init(size_t requested)
 {
 	push_back(new MainThread(0));
+	main()->wait_for_search_finished();
 	set(requested);
 }
 
+// 全スレッドのhistoryなどをゼロクリアする。
+// スレッド数が多いと時間がかかるので、それぞれのスレッド自身に(idle_loop()のなかで)並列に行なわせる。
+// 各スレッドは自分の論理プロセッサ(NUMA node)にbindされているので、そのnodeのメモリに書き込むことになる。
+void ThreadPool::clear()
+{
+	// 探索中のスレッドがあれば、その終了を待ってから起こす。
+	for (Thread* th : *this)
+		th->wait_for_search_finished();
+
+	for (Thread* th : *this)
+		th->start_clearing();
+
+	for (Thread* th : *this)
+		th->wait_for_search_finished();
+}
+
 void ThreadPool::exit()
 {
 	// 探索の終了を待つ
@@ -101,9 +148,14 @@ void ThreadPool::exit()
 void ThreadPool::set(size_t requested)
 {
 	// スレッドが足りなければ生成
+	const size_t first = size();
 	while (size() < requested)
 		push_back(new Thread(size()));
 
+	// 生成したスレッドがそれぞれ並列にhistoryなどのゼロクリアを終えて、待機状態になるのを待つ。
+	for (size_t i = first; i < size(); ++i)
+		at(i)->wait_for_search_finished();
+
 	// スレッドが余っていれば解体
 	while (size() > requested)
 		delete back(), pop_back();
@@ -128,8 +180,10 @@ void ThreadPool::start_thinking(const Position& pos, StateListPtr& states ,
 	// あと宣言勝ちできるなら、その指し手を先頭に入れておいてやる。
 	// (ただし、トライルールのときはMOVE_WINではないので、トライする指し手はsearchmovesに含まれていなければ
 	// 指しては駄目な手なのでrootMovesに追加しない。)
+#if defined (USE_ENTERING_KING_WIN)
 	if (pos.DeclarationWin() == MOVE_WIN)
 		rootMoves.emplace_back(MOVE_WIN);
+#endif
 
 	for (auto m : MoveList<LEGAL>(pos))
 		if (limits.searchmoves.empty()
@@ -144,21 +198,39 @@ void ThreadPool::start_thinking(const Position& pos, StateListPtr& states ,
 	if (states.get())
 		setupStates = std::move(states);
 
-	// Position::set()によってst->previosがクリアされるので事前にコピーして保存する。
-	// cf. Fix incorrect StateInfo : https://github.com/official-stockfish/Stockfish/commit/232c50fed0b80a0f39322a925575f760648ae0a5
-	StateInfo tmp = setupStates->back();
+	// posの開始局面のStateInfoはpos自身(Position::startState)が保持しているので、探索中にposが書き換えられると
+	// 壊れてしまう。setupStatesの先頭(position_cmd()では未使用のStateInfo)にコピーしてそちらを参照させる。
+	{
+		StateInfo* si = pos.state();
+		StateInfo* front = &setupStates->front();
+		bool shared = si == front;
+		while (si->previous && si->previous->previous)
+		{
+			si = si->previous;
+			shared |= si == front;
+		}
+		if (si->previous && !shared && si->previous != front)
+		{
+			*front = *si->previous;
+			si->previous = front;
+		}
+	}
 
-	auto sfen = pos.sfen();
+	// 各スレッドのrootPosはposをコピーする。sfen文字列を経由しないので速く、
+	// StateInfoの履歴(setupStates)も共有されるので、全スレッドが探索開始局面以前の局面との千日手を判定できる。
 	for (auto th : *this)
 	{
 		th->nodes = 0;
+#if defined(USE_EVAL_HASH_STATS)
+		th->evalHashProbes = th->evalHashHits = th->evalHashCollisions = 0;
+#endif
+#if defined(USE_TT_FALSE_HIT_STATS)
+		th->ttFalseHits = 0;
+#endif
 		th->rootDepth = th->completedDepth = DEPTH_ZERO;
 		th->rootMoves = rootMoves;
-		th->rootPos.set(sfen,th);
+		th->rootPos.set(pos, th);
 	}
 
-	// Position::set()によってクリアされていた、st->previousを復元する。
-	setupStates->back() = tmp;
-
 	main()->start_searching();
 }
@@ -35,9 +35,16 @@ class Thread
 	// 探索中であるかを表すフラグ。プログラムを簡素化するため、事前にtrueにしてある。
 	bool searching = true;
 
+	// start_clearing()で起こされたときに立っている。idle_loop()はsearch()の代わりにclear()を行なう。
+	bool clearing = false;
+
 	// wrapしているstd::thread
+	// idle_loop()が他のメンバー変数を使うので、すべて初期化されてからコンストラクタの本体で開始する。
 	std::thread stdThread;
 
+	// このスレッドをbindThisThread()したときのWinProcGroup::binding_generationの値
+	int bindingGeneration;
+
 public:
 
 	// ThreadPoolで何番目のthreadであるかをコンストラクタで渡すこと。この値は、idx(スレッドID)となる。
@@ -64,9 +71,15 @@ public:
 	// Thread::search()を開始させるときに呼び出す。
 	void start_searching();
 
+	// このスレッド自身にclear()を行なわせるときに呼び出す。完了はwait_for_search_finished()で待つ。
+	void start_clearing();
+
 	// 探索が終わるのを待機する。(searchingフラグがfalseになるのを待つ)
 	void wait_for_search_finished();
 
+	// 探索中(searchingフラグがtrue)であるかを返す。
+	bool is_searching() { std::unique_lock<Mutex> lk(mutex); return searching; }
+
 	// ------------------------------
 	//       プロパティ
 	// ------------------------------
@@ -97,6 +110,18 @@ public:
 	// このスレッドが探索したノード数(≒Position::do_move()を呼び出した回数)
 	std::atomic<uint64_t> nodes;
 
+#if defined(USE_EVAL_HASH_STATS)
+	// このスレッドがeval hashを調べた回数、そのうちhitした回数、別の局面のentryが入っていた(衝突した)回数
+	// 書き込むのはこのスレッドだけなので、fetch_add()ではなくload()とstore()で加算すれば良い。
+	std::atomic<uint64_t> evalHashProbes, evalHashHits, evalHashCollisions;
+#endif
+
+#if defined(USE_TT_FALSE_HIT_STATS)
+	// このスレッドで置換表にhitしたが、その指し手がpseudo_legalではなかった(false hitであった)回数
+	// evalHashProbesなどと同じく、書き込むのはこのスレッドだけ。
+	std::atomic<uint64_t> ttFalseHits;
+#endif
+
 	// 反復深化の深さ
 	// Lazy SMPなのでスレッドごとにこの変数を保有している。
 	Depth rootDepth;
@@ -172,6 +197,10 @@ struct ThreadPool: public std::vector<Thread*>
 	// 終了時に呼び出される
 	void exit();
 
+	// 全スレッドのhistoryなどをゼロクリアする。(スレッドごとに並列に行なう)
+	// Search::clear()から呼び出される。
+	void clear();
+
 	// mainスレッドに思考を開始させる。
 	void start_thinking(const Position& pos, StateListPtr& states , const Search::LimitsType& limits , bool ponderMode = false);
 
@@ -184,6 +213,18 @@ struct ThreadPool: public std::vector<Thread*>
 	// 今回、goコマンド以降に探索したノード数
 	uint64_t nodes_searched() { return accumulate(&Thread::nodes); }
 
+#if defined(USE_EVAL_HASH_STATS)
+	// 今回、goコマンド以降にeval hashを調べた回数、hitした回数、衝突した回数
+	uint64_t eval_hash_probes()     { return accumulate(&Thread::evalHashProbes); }
+	uint64_t eval_hash_hits()       { return accumulate(&Thread::evalHashHits); }
+	uint64_t eval_hash_collisions() { return accumulate(&Thread::evalHashCollisions); }
+#endif
+
+#if defined(USE_TT_FALSE_HIT_STATS)
+	// 今回、goコマンド以降に置換表でfalse hitした回数
+	uint64_t tt_false_hits() { return accumulate(&Thread::ttFalseHits); }
+#endif
+
 	// stop   : 探索中にこれがtrueになったら探索を即座に終了すること。
 	// ponder : "go ponder" コマンドでの探索中であるかを示すフラグ
 	// stopOnPonderhit : Stockfishのこのフラグは、やねうら王では用いない。(もっと上手にponderの時間を活用したいため)
@@ -1,5 +1,6 @@
 ﻿#include "tt.h"
 #include "misc.h"
+#include "thread.h"
 
 TranspositionTable TT; // 置換表をglobalに確保。
 
@@ -13,29 +14,71 @@ void TranspositionTable::resize(size_t mbSize) {
 
 	size_t newClusterCount = size_t(1) << MSB64((mbSize * 1024 * 1024) / sizeof(Cluster));
 
-	// 同じサイズなら確保しなおす必要はない。
-	if (newClusterCount == clusterCount)
+	LargePageMode mode = to_large_page_mode(Options["LargePages"]);
+	bool interleave = Options["NumaInterleave"];
+
+	// 同じサイズ、同じ確保方法なら確保しなおす必要はない。
+	if (newClusterCount == clusterCount && mode == large_page_mode && interleave == numa_interleave)
 		return;
 
 	clusterCount = newClusterCount;
+	large_page_mode = mode;
+	numa_interleave = interleave;
 
-	free(mem);
+	// 古いメモリを先に解放しておかないと、一時的に2倍のメモリが必要になる。
+	mem.free();
 
-	// tableはCacheLineSizeでalignされたメモリに配置したいので、CacheLineSize-1だけ余分に確保する。
-	mem = calloc(clusterCount * sizeof(Cluster) + CacheLineSize - 1, 1);
+	// tableはCacheLineSizeでalignされたメモリに配置する。
+	table = (Cluster*)mem.alloc(clusterCount * sizeof(Cluster), CacheLineSize, mode, interleave);
 
-	if (!mem)
+	if (!table)
 	{
 		std::cout << "info string Error : Failed to allocate " << mbSize
 			<< "MB for transposition table. ClusterCount = " << newClusterCount << std::endl;
 		my_exit();
 	}
 
-	table = (Cluster*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+	// 確保したメモリはゼロクリアされているので、ここではclear()しない。
+	// (isreadyに対してSearch::clear()からTT.clear()が呼び出されるので、そこで探索スレッド数だけのスレッドで
+	// 並列にゼロクリアしてfirst touchすることになる。二度クリアすると巨大な置換表では時間がかかる。)
+
+	sync_cout << "info string Hash " << (clusterCount * sizeof(Cluster) >> 20) << "MB allocated with "
+		<< mem.info() << sync_endl;
 }
 
+// 置換表のエントリーの全クリア
+void TranspositionTable::clear()
+{
+	const size_t size = clusterCount * sizeof(Cluster);
+
+	// 置換表が小さいときはスレッドを起こすほうが遅い。
+	const size_t thread_num = size < 64 * 1024 * 1024 ? 1 : std::max(Threads.size(), (size_t)1);
+
+	std::vector<std::thread> threads;
+
+	for (size_t idx = 0; idx < thread_num; ++idx)
+	{
+		threads.push_back(std::thread([this, idx, thread_num, size]() {
+
+			// NUMA環境では、探索スレッドと同じnodeで実行しておけばそのnodeのメモリに割り当てられる。
+			if (thread_num > 8)
+				WinProcGroup::bindThisThread(idx);
 
-TTEntry* TranspositionTable::probe(const Key key, bool& found
+			// それぞれのスレッドがstride分ずつクリアする。端数は最後のスレッドが受け持つ。
+			const size_t stride = size / thread_num;
+			const size_t start = stride * idx;
+			const size_t len = idx != thread_num - 1 ? stride : size - start;
+
+			std::memset((u8*)table + start, 0, len);
+		}));
+	}
+
+	for (auto& th : threads)
+		th.join();
+}
+
+
+TTEntry* TranspositionTable::probe(const Key key, bool& found, TTEntry& data
 #if defined(USE_GLOBAL_OPTIONS)
 	, size_t thread_id
 #endif
@@ -92,6 +135,19 @@ TTEntry* TranspositionTable::probe(const Key key, bool& found
 	// 上位16bitが合致するTT_ENTRYを探す
 	const uint16_t key16 = key >> 48;
 
+	// keyが合致するTT_ENTRYを見つけたときの処理
+	auto hit = [&](TTEntry* e) {
+#if defined(USE_GLOBAL_OPTIONS)
+		// 置換表とTTEntryの世代が異なるなら、信用できないと仮定するフラグ。
+		if (GlobalOptions.use_strict_generational_tt)
+			if (data.generation() != gen8)
+				return found = false, e;
+#endif
+
+		e->set_generation(gen8); // Refresh
+		return found = true, e;
+	};
+
 	// クラスターのなかから、keyが合致するTT_ENTRYを探す
 	for (int i = 0; i < ClusterSize; ++i)
 	{
@@ -102,22 +158,28 @@ TTEntry* TranspositionTable::probe(const Key key, bool& found
 		// Stockfishのコードだと、1.が成立したタイミングでもgenerationのrefreshをしているが、
 		// save()のときにgenerationを書き出すため、このケースにおいてrefreshは必要ない。
 
+#if defined(USE_TT_XOR_VERIFY)
+		// entryを一度だけ読み出して検証する。書き込み中で壊れているentryはkey16がでたらめな値になるので、
+		// hitすることはない。hitしたなら、この検証済みのコピーをそのままdataとして返す。
+		const TTEntry e = tte[i].load();
+		const uint16_t k = e.key16;
+#else
+		const uint16_t k = tte[i].key16;
+#endif
+
 		// 1.
-		if (!tte[i].key16)
+		if (!k)
 			return found = false, &tte[i];
 
 		// 2.
-		if (tte[i].key16 == key16)
+		if (k == key16)
 		{
-#if defined(USE_GLOBAL_OPTIONS)
-			// 置換表とTTEntryの世代が異なるなら、信用できないと仮定するフラグ。
-			if (GlobalOptions.use_strict_generational_tt)
-				if (tte[i].generation() != gen8)
-					return found = false, &tte[i];
+#if defined(USE_TT_XOR_VERIFY)
+			data = e;
+#else
+			data = tte[i];
 #endif
-
-			tte[i].set_generation(gen8); // Refresh
-			return found = true, &tte[i];
+			return hit(&tte[i]);
 		}
 	}
 
@@ -161,3 +223,144 @@ int TranspositionTable::hashfull() const
 	}
 	return cnt;
 }
+
+// --------------------
+//  置換表の保存と読み込み
+// --------------------
+
+namespace {
+
+	// save()で書き出すファイルのheader
+	// 置換表本体がページ境界にalignされてmapされるように、header全体で4096bytesとする。
+	struct TTFileHeader
+	{
+		char magic[16];        // "YaneuraOuTT"
+		u32  version;          // ファイル形式のversion
+		u32  cluster_size;     // sizeof(Cluster)
+		u32  entry_count;      // 1クラスターあたりのTTEntryの数
+		u32  layout;           // TTEntryのlayoutの種類(NO_EVAL_IN_TT,USE_TT_XOR_VERIFY)
+		u64  cluster_count;    // クラスター数
+		u8   generation;       // 書き出したときのTT.generation()
+		u8   padding[4096 - 16 - 4 * 4 - 8 - 1];
+	};
+	static_assert(sizeof(TTFileHeader) == 4096, "TTFileHeader size incorrect");
+
+	const char TTFileMagic[] = "YaneuraOuTT";
+	const u32 TTFileVersion = 1;
+
+	// TTEntryのlayoutはコンパイルオプションで変わるので、異なるlayoutのファイルは読み込めない。
+	const u32 TTFileLayout = 0
+#if defined(NO_EVAL_IN_TT)
+		| 1
+#endif
+#if defined(USE_TT_XOR_VERIFY)
+		| 2
+#endif
+		;
+}
+
+bool TranspositionTable::save(const std::string& filename) const
+{
+	TTFileHeader header = {};
+	std::memcpy(header.magic, TTFileMagic, sizeof(TTFileMagic));
+	header.version = TTFileVersion;
+	header.cluster_size = sizeof(Cluster);
+	header.entry_count = ClusterSize;
+	header.layout = TTFileLayout;
+	header.cluster_count = clusterCount;
+	header.generation = generation8;
+
+	// 書き出し先はload()でmapしているファイルであることがあるので、直接上書きしてはならない。
+	// (truncateした時点で、まだ読み込まれていないページが失われて、書き出し中にSIGBUSになる)
+	// 一時ファイルに書き出してからrename()で置き換える。mapしている古いファイルはunmapするまで残るので、
+	// 置換表の内容は失われない。
+	// ※　Windowsではmapしているファイルは削除できないので、その場合はrename()に失敗して書き出しは失敗扱いとなる。
+	const std::string tmp = filename + ".tmp";
+	{
+		std::fstream fs(tmp, std::ios::out | std::ios::binary);
+		if (fs.fail())
+			return false;
+
+		fs.write((const char*)&header, sizeof(header));
+
+		// 一度に2GB以上書き出せない環境があるので細切れに書き出す。(write_memory_to_file()と同様)
+		const u64 size = (u64)clusterCount * sizeof(Cluster);
+		const u64 block_size = 1024 * 1024 * 1024;
+		for (u64 pos = 0; pos < size && !fs.fail(); pos += block_size)
+			fs.write((const char*)table + pos, std::min(block_size, size - pos));
+
+		fs.close();
+		if (fs.fail())
+		{
+			std::remove(tmp.c_str());
+			return false;
+		}
+	}
+
+#if defined(_WIN32)
+	// Windowsではrename()先が存在すると失敗するので先に削除しておく。
+	std::remove(filename.c_str());
+#endif
+	if (std::rename(tmp.c_str(), filename.c_str()) != 0)
+	{
+		std::remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool TranspositionTable::load(const std::string& filename)
+{
+	// mapしなおす前に、headerとファイルサイズが正しいかを確認しておく。
+	TTFileHeader header;
+	{
+		std::fstream fs(filename, std::ios::in | std::ios::binary);
+		if (fs.fail())
+			return false;
+
+		fs.read((char*)&header, sizeof(header));
+		if (fs.fail()
+			|| std::memcmp(header.magic, TTFileMagic, sizeof(TTFileMagic)) != 0
+			|| header.version != TTFileVersion
+			|| header.cluster_size != sizeof(Cluster)
+			|| header.entry_count != ClusterSize
+			|| header.layout != TTFileLayout
+			|| header.cluster_count == 0
+			|| (header.cluster_count & (header.cluster_count - 1)) != 0)
+			return false;
+
+		fs.seekg(0, std::fstream::end);
+		if ((u64)fs.tellg() != sizeof(header) + header.cluster_count * sizeof(Cluster))
+			return false;
+	}
+
+	// 一時的なLargeMemoryにmapして、成功したときにだけ元の置換表と差し替える。
+	// (失敗したときに元の置換表の内容を失わないように)
+	LargeMemory file_mem;
+	size_t file_size;
+	if (!file_mem.map_file(filename, file_size))
+		return false;
+
+	// 元の置換表のメモリはfile_memに移り、この関数を抜けるときに解放される。
+	mem.swap(file_mem);
+
+	clusterCount = (size_t)header.cluster_count;
+	table = (Cluster*)((u8*)mem.get() + sizeof(header));
+
+	// 世代を書き出したときのものに戻す。
+	// こうしておけば、entryのgenerationを書き換える(=すべてのページにアクセスする)ことなく、
+	// 読み込んだentryを書き出したときと同じだけ新しいものとして扱える。
+	generation8 = header.generation;
+#if defined(USE_GLOBAL_OPTIONS)
+	std::fill(a_generation8.begin(), a_generation8.end(), header.generation);
+#endif
+
+	// Options["Hash"]を置換表のサイズに合わせておかないと、次のresize()で確保しなおされてしまう。
+	// (clusterCountは変更済みなので、このハンドラから呼び出されるresize()では何もしない。)
+	Options["Hash"] = std::to_string((clusterCount * sizeof(Cluster)) >> 20);
+
+	sync_cout << "info string Hash " << (clusterCount * sizeof(Cluster) >> 20) << "MB loaded from "
+		<< filename << " with " << mem.info() << sync_endl;
+
+	return true;
+}
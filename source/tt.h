@@ -1,7 +1,10 @@
 ﻿#ifndef _TT_H_
 #define _TT_H_
 
+#include <atomic>
+
 #include "shogi.h"
+#include "misc.h"
 
 // --------------------
 //       置換表
@@ -14,7 +17,11 @@ struct TTEntry {
 
 	Move move() const { return (Move)move16; }
 	Value value() const { return (Value)value16; }
+#if !defined(USE_TT_XOR_VERIFY)
 	void set_value(Value v) { value16 = v; }
+#else
+	void set_value(Value v) { TTEntry e = load(); e.value16 = v; store(e); }
+#endif
 
 #if !defined (NO_EVAL_IN_TT)
 	// この局面でevaluate()を呼び出したときの値
@@ -25,6 +32,8 @@ struct TTEntry {
 	Bound bound() const { return (Bound)(genBound8 & 0x3); }
 
 	uint8_t generation() const { return genBound8 & 0xfc; }
+
+	// USE_TT_XOR_VERIFYのときも、generationはfold16()に含まれないので、genBound8の1byteを書き換えるだけで良い。
 	void set_generation(uint8_t g) { genBound8 = bound() | g; }
 
 	// 置換表のエントリーに対して与えられたデータを保存する。上書き動作
@@ -68,8 +77,16 @@ struct TTEntry {
 		// これは、このnodeで、TT::probeでhitして、その指し手は試したが、それよりいい手が見つかって、枝刈り等が発生しているような
 		// ケースが考えられる。ゆえに、今回の指し手のほうが、いまの置換表の指し手より価値があると考えられる。
 
-		if (m != MOVE_NONE || (k >> 48) != key16)
-			move16 = (uint16_t)m;
+#if defined(USE_TT_XOR_VERIFY)
+		// 他のスレッドと同時に書き込んだときにデータが混ざらないように、ローカルにコピーしたものを
+		// 更新してから一括して書き戻す。
+		TTEntry e = load();
+#else
+		TTEntry& e = *this;
+#endif
+
+		if (m != MOVE_NONE || (k >> 48) != e.key16)
+			e.move16 = (uint16_t)m;
 
 		// このエントリーの現在の内容のほうが価値があるなら上書きしない。
 		// 1. hash keyが違うということはTT::probeでここを使うと決めたわけだから、このEntryは無条件に潰して良い
@@ -77,22 +94,27 @@ struct TTEntry {
 		// 　少しの深さのマイナスなら許容)
 		// 3. BOUND_EXACT(これはPVnodeで探索した結果で、とても価値のある情報なので無条件で書き込む)
 		// 1. or 2. or 3.
-		if (  (k >> 48) != key16
-			|| (d / ONE_PLY > depth8 - 4)
+		if (  (k >> 48) != e.key16
+			|| (d / ONE_PLY > e.depth8 - 4)
 			/*|| g != generation() // probe()において非0のkeyとマッチした場合、その瞬間に世代はrefreshされている。　*/
 			|| b == BOUND_EXACT
 			)
 		{
-			key16 = (uint16_t)(k >> 48);
-			value16 = (int16_t)v;
+			e.key16 = (uint16_t)(k >> 48);
+			e.value16 = (int16_t)v;
 #if !defined (NO_EVAL_IN_TT)
-			eval16 = (int16_t)eval;
+			e.eval16 = (int16_t)eval;
 #endif
-			genBound8 = (uint8_t)(gen | b);
-			depth8 = (int8_t)(d / ONE_PLY);
+			e.genBound8 = (uint8_t)(gen | b);
+			e.depth8 = (int8_t)(d / ONE_PLY);
 		}
+
+#if defined(USE_TT_XOR_VERIFY)
+		store(e);
+#endif
 	}
 
+
 private:
 	friend struct TranspositionTable;
 
@@ -118,6 +140,73 @@ private:
 	// そのときの残り深さ(これが大きいものほど価値がある)
 	// 1バイトに収めるために、DepthをONE_PLYで割ったものを格納する。
 	int8_t depth8;
+
+#if defined(USE_TT_XOR_VERIFY)
+
+	// --- lockless hashing
+	//
+	// 多数のスレッドが同じTTEntryに非atomicに書き込むと、あるスレッドが書き込んだkey16と
+	// 別のスレッドが書き込んだmove16などが混ざったTTEntryが出来る(torn write)。
+	// そこで、key16以外の8bytes(NO_EVAL_IN_TTのときは6bytes)をまとめて1命令で読み書きして、
+	// key16のところには、key ^ (データ部を16bitに畳み込んだもの)を格納しておく。
+	// 読み出したときにkeyとデータ部の組が一致しなければ、そのentryは壊れているとみなせる。
+	// (Robert Hyattのlockless hashingの16bit版)
+	//
+	// TTEntryは32bytesでalignされたClusterのなかにあり、データ部はcache lineを跨がないので、
+	// x86ではこの非alignedな8bytesの読み書きもatomicに行われる。
+	//
+	// 探索部は、TT.probe()がload()で一度だけ読み出して検証したentryのコピーから値を読み出す。
+	// (置換表上のentryを直接読むと、そのあいだに他のスレッドに書き換えられるかも知れないため)
+	//
+	// genBound8のうちgeneration(上位6bit)はfold16()に含めない。probe()でhitしたときのgenerationのrefreshは
+	// genBound8の1byteを書き換えるだけで済み、key16とデータ部の組を壊さない。
+	// (Boundはfold16()に含まれるので、refreshと他のスレッドのsave()とが重なってBoundが混ざったentryは検出される。)
+
+#if !defined (NO_EVAL_IN_TT)
+	// move16～depth8の8bytes。genBound8はbit48～55。
+	u64 load_data() const { u64 d; std::memcpy(&d, &move16, sizeof(d)); return d; }
+	static const u64 GenerationMask = u64(0xfc) << 48;
+#else
+	// TTEntry全体が8bytesなので、key16も含めて1命令で読み出して、上位48bitをデータ部とする。genBound8はbit32～39。
+	u64 load_raw() const { u64 r; std::memcpy(&r, this, sizeof(r)); return r; }
+	u64 load_data() const { return load_raw() >> 16; }
+	static const u64 GenerationMask = u64(0xfc) << 32;
+#endif
+
+	// データ部(generationを除く)を16bitに畳み込む。
+	static uint16_t fold16(u64 d) { d &= ~GenerationMask; return (uint16_t)(d ^ (d >> 16) ^ (d >> 32) ^ (d >> 48)); }
+
+	// このentryの内容をkey16をxorを外した状態で取得する。壊れているentryならば、key16はでたらめな値になる。
+	TTEntry load() const {
+		TTEntry e;
+#if !defined (NO_EVAL_IN_TT)
+		u64 d = load_data();
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		std::memcpy(&e.move16, &d, sizeof(d));
+		e.key16 = key16 ^ fold16(d);
+#else
+		u64 r = load_raw();
+		std::memcpy(&e, &r, sizeof(r));
+		e.key16 = (uint16_t)r ^ fold16(r >> 16);
+#endif
+		return e;
+	}
+
+	// load()で取得したentryを書き戻す。データ部を1命令で書き込んでからkey16を書き込む。
+	void store(const TTEntry& e) {
+#if !defined (NO_EVAL_IN_TT)
+		u64 d = e.load_data();
+		std::memcpy(&move16, &d, sizeof(d));
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		key16 = e.key16 ^ fold16(d);
+#else
+		u64 r = e.load_raw();
+		r = (r & ~u64(0xffff)) | (uint16_t)(e.key16 ^ fold16(r >> 16));
+		std::memcpy(this, &r, sizeof(r));
+#endif
+	}
+
+#endif
 };
 
 // --- 置換表本体
@@ -129,9 +218,13 @@ struct TranspositionTable {
 	// 置換表のなかから与えられたkeyに対応するentryを探す。
 	// 見つかったならfound == trueにしてそのTT_ENTRY*を返す。
 	// 見つからなかったらfound == falseで、このとき置換表に書き戻すときに使うと良いTT_ENTRY*を返す。
+	// found == trueのときは、そのentryの内容を一度だけ読み出してコピーしたものがdataに返る。
+	// 探索部はdataから値を読み出して、返されたTT_ENTRY*はsave()で書き戻すときにだけ使うこと。
+	// (置換表上のentryは他のスレッドによっていつ書き換えられるかわからないので)
+	// found == falseのときのdataの内容は不定。
 	// GlobalOptions.use_per_thread_tt == trueのときはスレッドごとに置換表の異なるエリアに属するTTEntryを
 	// 渡す必要があるので、引数としてthread_idを渡す。
-	TTEntry* probe(const Key key, bool& found
+	TTEntry* probe(const Key key, bool& found, TTEntry& data
 #if defined(USE_GLOBAL_OPTIONS)
 		, size_t thread_id = -1
 #endif
@@ -143,10 +236,15 @@ struct TranspositionTable {
 	}
 
 	// 置換表のサイズを変更する。mbSize == 確保するメモリサイズ。MB単位。
+	// Options["LargePages"]に従ってLarge Pageでの確保を試み、NUMA nodeが複数あるなら
+	// Options["NumaInterleave"]に従ってすべてのnodeにinterleaveして配置する。
+	// 確保するだけでクリア(first touch)はしない。それはSearch::clear()から呼び出されるclear()で行なう。
 	void resize(size_t mbSize);
 
 	// 置換表のエントリーの全クリア
-	void clear() { memset(table, 0, clusterCount * sizeof(Cluster)); }
+	// 巨大な置換表だとmemsetに数秒かかるので、Threads.size()個のスレッドで並列にクリアする。
+	// (NUMA環境では、これがそのまま各nodeへのfirst touchとなる。)
+	void clear();
 
 	// 新しい探索ごとにこの関数を呼び出す。(generationを加算する。)
 	// USE_GLOBAL_OPTIONSが有効のときは、このタイミングで、Options["Threads"]の値を
@@ -191,8 +289,22 @@ struct TranspositionTable {
 	// 置換表の使用率を1000分率で返す。(USIプロトコルで統計情報として出力するのに使う)
 	int hashfull() const;
 
-	TranspositionTable() { mem = nullptr; clusterCount = 0; }
-	~TranspositionTable() { free(mem); }
+	// 置換表の内容をファイルに書き出す。(USI拡張コマンドの"savehash")
+	// 探索中に呼び出してはならない。成功すればtrueが返る。
+	// filename + ".tmp"に書き出してからrename()するので、load()したファイルに上書きしても良い。
+	bool save(const std::string& filename) const;
+
+	// save()で書き出したファイルを置換表として読み込む。(USI拡張コマンドの"loadhash")
+	// ファイルはcopy-on-writeでmapされるので、巨大な置換表でも実際にアクセスされたところから順次読み込まれる。
+	// 置換表のサイズはファイルのものに変更され、Options["Hash"]もそれに合わせて変更される。
+	// 書き出したときの世代をそのまま引き継ぐので、読み込んだentryは以降のnew_search()で正しく古くなっていく。
+	// 成功すればtrueが返る。失敗したとき(ファイルが見つからないときや形式が異なるときなど)は置換表の内容は変化しない。
+	// ※　isreadyに対してはSearch::clear()で置換表がクリアされるので、isreadyのあとに呼び出すこと。
+	bool load(const std::string& filename);
+
+	TranspositionTable() {
+		clusterCount = 0; large_page_mode = LARGE_PAGE_NONE; numa_interleave = false;
+	}
 
 private:
 
@@ -233,8 +345,13 @@ private:
 	// 確保されているクラスターの先頭(alignされている)
 	Cluster* table;
 
-	// 確保されたメモリの先頭(alignされていない)
-	void* mem;
+	// 確保されたメモリ(Large Pageで確保されているかも知れない)
+	LargeMemory mem;
+
+	// 前回のresize()のときに指定されたOptions["LargePages"]とOptions["NumaInterleave"]の値
+	// これが変更されていれば、サイズが同じでも確保しなおす。
+	LargePageMode large_page_mode;
+	bool numa_interleave;
 
 	uint8_t generation8; // TT_ENTRYのset_gen()で書き込む
 };
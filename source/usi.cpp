@@ -221,13 +221,14 @@ namespace USI
 					{
 						// 次の手を置換表から拾う。
 						bool found;
-						auto* tte = TT.probe(pos.state()->key(), found);
+						TTEntry ttData;
+						TT.probe(pos.state()->key(), found, ttData);
 
 						// 置換表になかった
 						if (!found)
 							break;
 
-						m = tte->move();
+						m = ttData.move();
 
 						// 置換表にはpsudo_legalではない指し手が含まれるのでそれを弾く。
 						// 宣言勝ちでないならこれが合法手であるかのチェックが必要。
@@ -317,6 +318,28 @@ namespace USI
 
 		o["Hash"] << Option(16, 1, MaxHashMB, [](const Option&o) { TT.resize(o); });
 
+		// 置換表をLarge Page(Huge Page)で確保するか。
+		// 巨大な置換表だとTLB missが頻発するので、Large Pageで確保したほうが速い。
+		// "2MB","1GB"はOS側でhuge pageを予約しておく必要がある。確保できなければ"Transparent"→"No"の順にfallbackする。
+		// (いまのところLinuxのみ対応。その他の環境では"No"と同じ。)
+		// 変更は、次のisreadyのタイミングで反映される。
+		o["LargePages"] << Option(std::vector<std::string>{ "No", "Transparent", "2MB", "1GB" }, "Transparent");
+
+		// NUMA nodeが複数ある環境で、置換表をすべてのnodeにinterleaveして配置するか。
+		o["NumaInterleave"] << Option(true);
+
+#if defined(_LINUX)
+		// 探索スレッドを論理プロセッサ(またはNUMA node)に割り当てる方法。
+		// "No"      : 割り当てない。(OSに任せる)
+		// "Auto"    : スレッド数が8以上でNUMA nodeが複数あるときだけ、各スレッドをNUMA nodeに割り当てる。
+		// "Compact" : 各スレッドを1つの論理プロセッサに割り当てる。NUMA node 0の物理コアから順番に使い切っていく。
+		// "Spread"  : 各スレッドを1つの論理プロセッサに割り当てる。各NUMA nodeの物理コアを順番に1つずつ使う。
+		// 1台のマシンで複数の思考エンジンを同時に動かすときは、同じ論理プロセッサに割り当てられてしまうので"Compact","Spread"にしてはならない。
+		// 変更は、次の探索開始時に反映される。
+		o["ThreadBinding"] << Option(std::vector<std::string>{ "No", "Auto", "Compact", "Spread" }, "Auto",
+			[](const Option&) { ++WinProcGroup::binding_generation; });
+#endif
+
 		// その局面での上位N個の候補手を調べる機能
 		o["MultiPV"] << Option(1, 1, 800);
 
@@ -376,13 +399,30 @@ namespace USI
 		// 評価関数フォルダ。これを変更したとき、評価関数を次のisreadyタイミングで読み直す必要がある。
 		o["EvalDir"] << Option("eval", [](const USI::Option&o) { load_eval_finished = false; });
 
-#if defined (USE_SHARED_MEMORY_IN_EVAL) && defined(_WIN32) && \
+#if defined (USE_SHARED_MEMORY_IN_EVAL) && \
 	 (defined(EVAL_KPPT) || defined(EVAL_KPP_KKPT) || defined(EVAL_KPPPT) || defined(EVAL_KPPP_KKPT) || defined(EVAL_EXPERIMENTAL) || defined(EVAL_HELICES) )
 		// 評価関数パラメーターを共有するか
 		// 異種評価関数との自己対局のときにこの設定で引っかかる人が後を絶たないのでデフォルトでオフにする。
 		o["EvalShare"] << Option(false);
 #endif
 
+#if defined(USE_EVAL_HASH)
+		// eval hash(評価値を保存しておくhash table)のサイズ[MB]。
+		// 長い持ち時間で多くのスレッドを使うなら、大きくしたほうが評価関数本体の呼び出し回数が減る。
+		// 置換表と同じくLargePages,NumaInterleaveの設定に従って確保する。
+		// 変更は、次のisreadyのタイミングで反映される。
+		o["EvalHash"] << Option(Eval::EvalHashDefaultMB, 1, MaxHashMB);
+#endif
+
+#if defined(EVAL_KPPT) || defined(EVAL_KPP_KKPT)
+		// 評価関数ファイルをメモリに読み込まずに、mapしてそのまま用いるか。
+		// "No"       : mapしない。(普通に読み込む)
+		// "Lazy"     : mapして、各ページは最初にアクセスしたときに読み込む。
+		// "Populate" : mapするときに全ページを読み込んでおく。(ファイルがpage cacheにあれば一瞬で終わる)
+		// 同じファイルをmapしたプロセス間ではpage cacheを介して物理メモリが共有されるので、EvalShareより優先される。
+		o["EvalMmap"] << Option(std::vector<std::string>{ "No", "Lazy", "Populate" }, "No", [](const USI::Option&o) { load_eval_finished = false; });
+#endif
+
 #if defined(LOCAL_GAME_SERVER)
 		// 子プロセスでEngineを実行するプロセッサグループ(Numa node)
 		// -1なら、指定なし。
@@ -478,6 +518,11 @@ void is_ready(bool skipCorruptCheck)
 		// ソフト名の表示
 		Eval::print_softname(eval_sum);
 
+#if defined(USE_EVAL_HASH)
+		// 評価関数が変わったので、eval hashに保存されている評価値は無効である。
+		Eval::g_evalTable.clear();
+#endif
+
 		load_eval_finished = true;
 
 	}
@@ -493,6 +538,9 @@ void is_ready(bool skipCorruptCheck)
 	// このタイミングで各種変数の初期化もしておく。
 
 	TT.resize(Options["Hash"]);
+#if defined(USE_EVAL_HASH)
+	Eval::g_evalTable.resize(Options["EvalHash"]);
+#endif
 	Search::clear();
 	Time.availableNodes = 0;
 
@@ -608,6 +656,34 @@ void getoption_cmd(istringstream& is)
 		sync_cout << "No such option: " << name << sync_endl;
 }
 
+// savehash/loadhashコマンド応答(USI独自拡張)
+// 置換表の内容をファイルに保存する/ファイルから読み込む。
+// 検討用のエンジンを再起動したときに、それまでの探索結果を引き継ぐために用いる。
+//  例) savehash hash.bin
+//      loadhash hash.bin
+void hash_file_cmd(const string& token, istringstream& is)
+{
+	string filename = "hash.bin";
+	is >> filename;
+
+	// "go infinite"や"go ponder"の探索は"stop"などが送られてくるまで終わらないので、ここで終了を待つと
+	// USIコマンドが読めなくなって固まってしまう。このときは何もせずにエラーとする。
+	if (Threads.main()->is_searching() && (Threads.ponder || Search::Limits.infinite))
+	{
+		sync_cout << "info string Error! : " << token << " is not available while searching. send stop first." << sync_endl;
+		return;
+	}
+
+	// 探索中に置換表を読み書きするわけにはいかないので、探索の終了を待つ。
+	Threads.main()->wait_for_search_finished();
+
+	bool success = token == "savehash" ? TT.save(filename) : TT.load(filename);
+	if (!success)
+		sync_cout << "info string Error! : " << token << " failed. file = " << filename << sync_endl;
+	else if (token == "savehash")
+		sync_cout << "info string Hash saved to " << filename << sync_endl;
+}
+
 
 // go()は、思考エンジンがUSIコマンドの"go"を受け取ったときに呼び出される。
 // この関数は、入力文字列から思考時間とその他のパラメーターをセットし、探索を開始する。
@@ -821,6 +897,9 @@ void USI::loop(int argc, char* argv[])
 		// 思考エンジンの準備が出来たかの確認
 		else if (token == "isready") is_ready_cmd(pos);
 
+		// 置換表をファイルに保存する/ファイルから読み込む(USI独自拡張)
+		else if (token == "savehash" || token == "loadhash") hash_file_cmd(token, is);
+
 		// ユーザーによる実験用コマンド。user.cppのuser()が呼び出される。
 		else if (token == "user") user_test(pos, is);
 